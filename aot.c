@@ -0,0 +1,473 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdarg.h>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Ahead-of-time backend: lowers the resolved (and folded) AST to one C
+// translation unit and builds it with the system gcc. Globals become C
+// globals, function locals C locals, and if/while native control flow.
+// The generated file includes definitions.h and is linked against the
+// interpreter's own runtime sources (c_runtime_sources), so values, ropes,
+// interning, arrays, builtins and buffered output are the same code the VM
+// runs, and a program prints exactly what it prints in the VM, errors
+// included. Each subexpression is computed into its own temporary, which
+// pins down the VM's left-to-right evaluation order.
+
+// Runtime sources every generated program is linked with
+const char* c_runtime_sources[] = {"value.c", "array.c", "output.c", "builtins.c", NULL};
+
+// Glue every generated program starts with; the rest of the runtime is linked in
+const char* c_prelude =
+    "#include \"definitions.h\"\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "\n"
+    "static int call_depth = 0;\n"
+    "\n"
+    "static __attribute__((unused)) void enter_call(const char* name) {\n"
+    "    if (call_depth >= CALL_STACK_SIZE) {\n"
+    "        flush_output();\n"
+    "        printf(\"VM ERROR: Call stack overflow in '%s'\\n\", name);\n"
+    "        exit(1);\n"
+    "    }\n"
+    "    call_depth++;\n"
+    "}\n"
+    "\n";
+
+FILE* c_out;
+int c_indent;
+int c_temp_count;
+
+// Distinct string literals, each emitted once so equal strings stay one
+// pointer, as they are in the VM's intern table
+const char** c_strings;
+int c_string_count;
+int c_string_capacity;
+
+void c_line(const char* format, ...) {
+    for (int i = 0; i < c_indent; i++) fputs("    ", c_out);
+    va_list args;
+    va_start(args, format);
+    vfprintf(c_out, format, args);
+    va_end(args);
+    fputc('\n', c_out);
+}
+
+int c_string_index(const char* s) {
+    for (int i = 0; i < c_string_count; i++) {
+        if (c_strings[i] == s) return i;
+    }
+    if (c_string_count == c_string_capacity) {
+        c_string_capacity = c_string_capacity ? c_string_capacity * 2 : 16;
+        c_strings = realloc(c_strings, sizeof(char*) * c_string_capacity);
+    }
+    c_strings[c_string_count] = s;
+    return c_string_count++;
+}
+
+// Registers every string literal; names are interned, so pointers compare
+void collect_strings(ASTNode* node) {
+    if (!node) return;
+    switch (node->type) {
+        case AST_STRING:
+            c_string_index(node->string);
+            break;
+        case AST_ASSIGNMENT:
+            collect_strings(node->assignment.value);
+            break;
+        case AST_BINARY_OP: {
+            int base = push_spine(node);
+            collect_strings(spine[spine_top - 1]->binary.left);
+            for (int i = spine_top - 1; i >= base; i--) collect_strings(spine[i]->binary.right);
+            spine_top = base;
+            break;
+        }
+        case AST_IF:
+            collect_strings(node->if_stmt.condition);
+            collect_strings(node->if_stmt.then_branch);
+            collect_strings(node->if_stmt.else_branch);
+            break;
+        case AST_WHILE:
+            collect_strings(node->while_stmt.condition);
+            collect_strings(node->while_stmt.body);
+            break;
+        case AST_FUNCTION_DEF:
+            collect_strings(node->function_def.body);
+            break;
+        case AST_FUNCTION_CALL:
+            for (int i = 0; i < node->function_call.arg_count; i++) collect_strings(node->function_call.args[i]);
+            break;
+        case AST_BLOCK:
+            for (int i = 0; i < node->block.count; i++) collect_strings(node->block.statements[i]);
+            break;
+        case AST_RETURN:
+            collect_strings(node->return_stmt.value);
+            break;
+        case AST_ARRAY:
+            for (int i = 0; i < node->array.count; i++) collect_strings(node->array.elements[i]);
+            break;
+        case AST_INDEX:
+        case AST_INDEX_ASSIGNMENT:
+            collect_strings(node->index.array);
+            collect_strings(node->index.index);
+            collect_strings(node->index.value);
+            break;
+        default:
+            break;
+    }
+}
+
+// Writes s as a C string literal
+void c_quoted(const char* s) {
+    fputc('"', c_out);
+    for (const unsigned char* p = (const unsigned char*)s; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(c_out, "\\%c", *p);
+        } else if (*p < 0x20 || *p >= 0x7F || *p == '?') {
+            fprintf(c_out, "\\%03o", *p);   // also keeps trigraphs out
+        } else {
+            fputc(*p, c_out);
+        }
+    }
+    fputc('"', c_out);
+}
+
+// The C name holding a variable's value
+void c_variable(const char* name, char* out) {
+    int id = variable_id(name);
+    if (id >= MAX_VARS) {
+        sprintf(out, "g%d", id - MAX_VARS);
+    } else {
+        sprintf(out, "l%d", id);
+    }
+}
+
+// Emits the statements computing node into a fresh temporary and returns
+// its number
+int c_expression(ASTNode* node) {
+    int args[256];
+    char name[16];
+    switch (node->type) {
+        case AST_NUMBER: {
+            int t = c_temp_count++;
+            c_line("Value t%d = UINT64_C(0x%" PRIx64 ");", t, ((uint64_t)(int64_t)node->number << 1) | 1);
+            return t;
+        }
+        case AST_STRING: {
+            int t = c_temp_count++;
+            c_line("Value t%d = make_string(s%d);", t, c_string_index(node->string));
+            return t;
+        }
+        case AST_VARIABLE: {
+            // Copied, so a call later in the same expression cannot change it
+            int t = c_temp_count++;
+            c_variable(node->name, name);
+            c_line("Value t%d = %s;", t, name);
+            return t;
+        }
+        case AST_BINARY_OP: {
+            // Left-nested chains with a loop, see push_spine
+            int base = push_spine(node);
+            int a = c_expression(spine[spine_top - 1]->binary.left);
+            for (int i = spine_top - 1; i >= base; i--) {
+                int b = c_expression(spine[i]->binary.right);
+                int t = c_temp_count++;
+                switch (spine[i]->binary.op) {
+                    case '+': c_line("Value t%d = VALUE_ADD(t%d, t%d);", t, a, b); break;
+                    case '-': c_line("Value t%d = VALUE_SUB(t%d, t%d);", t, a, b); break;
+                    case '*': c_line("Value t%d = VALUE_MUL(t%d, t%d);", t, a, b); break;
+                    case '/': c_line("Value t%d = divide(t%d, t%d);", t, a, b); break;
+                    case '>': c_line("Value t%d = make_bool(VALUE_CMP(t%d, >, t%d));", t, a, b); break;
+                    case '<': c_line("Value t%d = make_bool(VALUE_CMP(t%d, <, t%d));", t, a, b); break;
+                    case 'G': c_line("Value t%d = make_bool(VALUE_CMP(t%d, >=, t%d));", t, a, b); break;
+                    case 'L': c_line("Value t%d = make_bool(VALUE_CMP(t%d, <=, t%d));", t, a, b); break;
+                    case '=': c_line("Value t%d = make_bool(VALUE_EQ(t%d, t%d));", t, a, b); break;
+                    case '!': c_line("Value t%d = make_bool(!VALUE_EQ(t%d, t%d));", t, a, b); break;
+                    default:
+                        printf("COMPILER ERROR: Unknown binary operator '%c'\n", spine[i]->binary.op);
+                        exit(1);
+                }
+                a = t;
+            }
+            spine_top = base;
+            return a;
+        }
+        case AST_FUNCTION_CALL: {
+            int count = node->function_call.arg_count;
+            if (count > 256) {
+                printf("COMPILER ERROR: Too many arguments to '%s' for the C backend\n", node->function_call.name);
+                exit(1);
+            }
+            for (int i = 0; i < count; i++) args[i] = c_expression(node->function_call.args[i]);
+            int t = c_temp_count++;
+            int f = find_function(node->function_call.name);
+            int b = f < 0 ? resolve_builtin(node->function_call.name, count) : -1;
+            if (f >= 0) {
+                for (int i = 0; i < c_indent; i++) fputs("    ", c_out);
+                fprintf(c_out, "Value t%d = fn%d(", t, f);
+                for (int i = 0; i < count; i++) fprintf(c_out, "%st%d", i ? ", " : "", args[i]);
+                fprintf(c_out, ");\n");
+            } else if (b >= 0) {
+                // Same registry index the VM calls through, since builtins.c is linked in
+                for (int i = 0; i < c_indent; i++) fputs("    ", c_out);
+                fprintf(c_out, "Value t%d = builtins[%d].call(", t, b);
+                if (count == 0) {
+                    fprintf(c_out, "NULL");
+                } else {
+                    fprintf(c_out, "(Value[]){");
+                    for (int i = 0; i < count; i++) fprintf(c_out, "%st%d", i ? ", " : "", args[i]);
+                    fprintf(c_out, "}");
+                }
+                fprintf(c_out, ", %d);   // %s\n", count, builtins[b].name);
+            } else {
+                for (int i = 0; i < c_indent; i++) fputs("    ", c_out);
+                fprintf(c_out, "unknown_builtin(");
+                c_quoted(node->function_call.name);
+                fprintf(c_out, ");\n");
+                c_line("Value t%d = VAL_NIL;", t);
+            }
+            return t;
+        }
+        case AST_ARRAY: {
+            int count = node->array.count;
+            int* items = malloc(sizeof(int) * (count > 0 ? count : 1));
+            for (int i = 0; i < count; i++) items[i] = c_expression(node->array.elements[i]);
+            int t = c_temp_count++;
+            for (int i = 0; i < c_indent; i++) fputs("    ", c_out);
+            fprintf(c_out, "Value t%d = array_literal((Value[]){", t);
+            for (int i = 0; i < count; i++) fprintf(c_out, "%st%d", i ? ", " : "", items[i]);
+            fprintf(c_out, "%s}, %d);\n", count ? "" : "0", count);
+            free(items);
+            return t;
+        }
+        case AST_INDEX: {
+            int a = c_expression(node->index.array);
+            int i = c_expression(node->index.index);
+            int t = c_temp_count++;
+            c_line("Value t%d = index_array(t%d, t%d);", t, a, i);
+            return t;
+        }
+        default:
+            printf("COMPILER ERROR: Node type %d is not an expression\n", node->type);
+            exit(1);
+    }
+}
+
+void c_statement(ASTNode* node) {
+    if (!node) return;
+    char name[16];
+    switch (node->type) {
+        case AST_ASSIGNMENT: {
+            int t = c_expression(node->assignment.value);
+            c_variable(node->assignment.name, name);
+            c_line("%s = t%d;", name, t);
+            break;
+        }
+        case AST_IF: {
+            int t = c_expression(node->if_stmt.condition);
+            c_line("if (!is_falsey(t%d)) {", t);
+            c_indent++;
+            c_statement(node->if_stmt.then_branch);
+            c_indent--;
+            if (node->if_stmt.else_branch) {
+                c_line("} else {");
+                c_indent++;
+                c_statement(node->if_stmt.else_branch);
+                c_indent--;
+            }
+            c_line("}");
+            break;
+        }
+        case AST_WHILE: {
+            c_line("for (;;) {");
+            c_indent++;
+            int t = c_expression(node->while_stmt.condition);
+            c_line("if (is_falsey(t%d)) break;", t);
+            c_statement(node->while_stmt.body);
+            c_indent--;
+            c_line("}");
+            break;
+        }
+        case AST_RETURN: {
+            int t = c_expression(node->return_stmt.value);
+            c_line("call_depth--;");
+            c_line("return t%d;", t);
+            break;
+        }
+        case AST_BLOCK:
+            c_line("{");
+            c_indent++;
+            for (int i = 0; i < node->block.count; i++) c_statement(node->block.statements[i]);
+            c_indent--;
+            c_line("}");
+            break;
+        case AST_INDEX_ASSIGNMENT: {
+            int a = c_expression(node->index.array);
+            int i = c_expression(node->index.index);
+            int v = c_expression(node->index.value);
+            c_line("store_index(t%d, t%d, t%d);", a, i, v);
+            break;
+        }
+        case AST_FUNCTION_DEF:
+            // Generated as C functions by compile_c
+            break;
+        default: {
+            int t = c_expression(node);
+            c_line("(void)t%d;", t);
+            break;
+        }
+    }
+}
+
+void c_signature(int f, ASTNode* def) {
+    fprintf(c_out, "static Value fn%d(", f);
+    for (int p = 0; p < def->function_def.param_count; p++) fprintf(c_out, "%sValue l%d", p ? ", " : "", p);
+    if (def->function_def.param_count == 0) fprintf(c_out, "void");
+    fprintf(c_out, ")");
+}
+
+// Writes program as a C translation unit to out. Expects resolve_symbols()
+// to have run, like emit_program.
+void compile_c(ASTNode* program, FILE* out) {
+    c_out = out;
+    c_indent = 0;
+    c_temp_count = 0;
+    c_string_count = 0;
+    collect_strings(program);
+
+    fprintf(out, "// Generated by the Penguin C backend\n");
+    fputs(c_prelude, out);
+    // Interned at startup, so == on strings stays a pointer comparison
+    for (int i = 0; i < c_string_count; i++) fprintf(out, "static String* s%d;\n", i);
+    for (int i = 0; i < slot_count; i++) fprintf(out, "static Value g%d = VAL_NIL;   // %s\n", i, slot_names[i]);
+
+    // Every function is declared first, since calls may precede definitions
+    ASTNode** defs = malloc(sizeof(ASTNode*) * (MAX_FUNCS + 1));
+    int def_count = 0;
+    for (int i = 0; i < program->block.count; i++) {
+        ASTNode* stmt = program->block.statements[i];
+        if (stmt->type == AST_FUNCTION_DEF) defs[def_count++] = stmt;
+    }
+    fprintf(out, "\n");
+    for (int i = 0; i < def_count; i++) {
+        c_signature(find_function(defs[i]->function_def.name), defs[i]);
+        fprintf(out, ";\n");
+    }
+
+    for (int i = 0; i < def_count; i++) {
+        ASTNode* def = defs[i];
+        int f = find_function(def->function_def.name);
+        enter_scope(f);
+        fprintf(out, "\n// %s\n", def->function_def.name);
+        c_signature(f, def);
+        fprintf(out, " {\n    enter_call(");
+        c_quoted(def->function_def.name);
+        fprintf(out, ");\n");
+        c_indent = 1;
+        for (int l = def->function_def.param_count; l < functions[f].local_count; l++) c_line("Value l%d = VAL_NIL;", l);
+        c_statement(def->function_def.body);
+        c_line("call_depth--;");
+        c_line("return make_int(0);");
+        fprintf(out, "}\n");
+    }
+
+    enter_scope(-1);
+    fprintf(out, "\nint main(void) {\n");
+    c_indent = 1;
+    for (int i = 0; i < c_string_count; i++) {
+        for (int j = 0; j < c_indent; j++) fputs("    ", c_out);
+        fprintf(out, "s%d = intern_string(", i);
+        c_quoted(c_strings[i]);
+        fprintf(out, ", %zu);\n", strlen(c_strings[i]));
+    }
+    c_statement(program);
+    c_line("flush_output();");
+    c_line("return 0;");
+    fprintf(out, "}\n");
+    free(defs);
+}
+
+// The directory holding definitions.h and the runtime sources: the one this
+// file was compiled from, unless the build passes -DPENGUIN_RUNTIME_DIR
+void c_runtime_dir(char* out, size_t size) {
+#ifdef PENGUIN_RUNTIME_DIR
+    snprintf(out, size, "%s", PENGUIN_RUNTIME_DIR);
+#else
+    const char* file = __FILE__;
+    int end = -1;
+    for (int i = 0; file[i]; i++) {
+        if (file[i] == '/' || file[i] == '\\') end = i;
+    }
+    if (end < 0) {
+        snprintf(out, size, ".");
+    } else {
+        snprintf(out, size, "%.*s", end, file);
+    }
+#endif
+}
+
+// Writes <exe_path>.c and builds it, with the runtime sources, into exe_path
+// with gcc -O2. Returns 0 on success; gcc's own diagnostics go to stderr.
+int build_native(ASTNode* program, const char* exe_path) {
+    size_t length = strlen(exe_path);
+    char* c_path = malloc(length + 3);
+    sprintf(c_path, "%s.c", exe_path);
+    FILE* out = fopen(c_path, "w");
+    if (!out) {
+        printf("COMPILER ERROR: Cannot write '%s'\n", c_path);
+        exit(1);
+    }
+    compile_c(program, out);
+    fclose(out);
+
+    char dir[1024];
+    c_runtime_dir(dir, sizeof(dir));
+    char include[1040];
+    snprintf(include, sizeof(include), "-I%s", dir);
+    char sources[8][1040];
+    int source_count = 0;
+    for (int i = 0; c_runtime_sources[i]; i++) {
+        snprintf(sources[source_count++], sizeof(sources[0]), "%s/%s", dir, c_runtime_sources[i]);
+    }
+
+    fflush(stdout);
+    int status;
+#ifndef _WIN32
+    const char* argv[16];
+    int argc = 0;
+    argv[argc++] = "gcc";
+    argv[argc++] = "-O2";
+    argv[argc++] = include;
+    argv[argc++] = "-o";
+    argv[argc++] = exe_path;
+    argv[argc++] = c_path;
+    for (int i = 0; i < source_count; i++) argv[argc++] = sources[i];
+    argv[argc] = NULL;
+    pid_t pid = fork();
+    if (pid == 0) {
+        execvp("gcc", (char* const*)argv);
+        _exit(127);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+        status = -1;
+    } else {
+        status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+#else
+    char* command = malloc(2 * length + sizeof(include) + sizeof(sources) + 64);
+    int used = sprintf(command, "gcc -O2 \"%s\" -o \"%s\" \"%s\"", include, exe_path, c_path);
+    for (int i = 0; i < source_count; i++) used += sprintf(command + used, " \"%s\"", sources[i]);
+    status = system(command);
+    free(command);
+#endif
+    if (status != 0) printf("COMPILER ERROR: gcc could not build '%s'\n", c_path);
+    free(c_path);
+    return status;
+}
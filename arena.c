@@ -0,0 +1,69 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bump-pointer arena: allocations are carved from large blocks and only
+// ever released all at once
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+void init_arena(Arena* arena) {
+    arena->head = NULL;
+    arena->used = 0;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ArenaBlock* block = arena->head;
+    if (!block || block->used + size > block->size) {
+        size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + capacity);
+        if (!block) {
+            printf("ERROR: Out of memory allocating %zu bytes\n", capacity);
+            exit(1);
+        }
+        block->next = arena->head;
+        block->used = 0;
+        block->size = capacity;
+        arena->head = block;
+    }
+    void* p = block->data + block->used;
+    block->used += size;
+    arena->used += size;
+    return p;
+}
+
+void vec_init(Arena* arena, ArenaVec* vec, int capacity) {
+    if (capacity < 1) capacity = 1;
+    vec->items = arena_alloc(arena, sizeof(void*) * capacity);
+    vec->count = 0;
+    vec->capacity = capacity;
+}
+
+void vec_push(Arena* arena, ArenaVec* vec, void* item) {
+    if (vec->count == vec->capacity) {
+        ArenaBlock* block = arena->head;
+        size_t old_size = sizeof(void*) * vec->capacity;
+        if ((char*)vec->items + old_size == block->data + block->used && block->used + old_size <= block->size) {
+            // Nothing was allocated after the list, so it can just grow
+            block->used += old_size;
+            arena->used += old_size;
+        } else {
+            void** items = arena_alloc(arena, old_size * 2);
+            memcpy(items, vec->items, old_size);
+            vec->items = items;
+        }
+        vec->capacity *= 2;
+    }
+    vec->items[vec->count++] = item;
+}
+
+void arena_release(Arena* arena) {
+    ArenaBlock* block = arena->head;
+    while (block) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    init_arena(arena);
+}
@@ -0,0 +1,253 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Arrays hold plain int64s in 64-byte aligned storage, one cache line per
+// eight elements, so the bulk builtins are straight vector loops: AVX2 when
+// the build targets it, otherwise SSE2, with a scalar loop for the tail (and
+// for everything on other targets). Elements always stay within the 63-bit
+// int range, so reading one back never loses bits.
+
+// Wraps a 64-bit result into the 63-bit int range the way tagged int
+// arithmetic does: ((x & 2^63-1) ^ 2^62) - 2^62 sign-extends bit 62
+#define INT_MASK 0x7FFFFFFFFFFFFFFFull
+#define INT_SIGN 0x4000000000000000ull
+
+static inline int64_t wrap_int(uint64_t x) {
+    return (int64_t)(((x & INT_MASK) ^ INT_SIGN) - INT_SIGN);
+}
+
+Array* new_array(int64_t length) {
+    if (length < 0 || length > INT32_MAX) {
+        flush_output();
+        printf("VM ERROR: Array size must be between 0 and %d, got %lld\n", INT32_MAX, (long long)length);
+        exit(1);
+    }
+    Array* array = malloc(sizeof(Array));
+    size_t size = ((size_t)length * sizeof(int64_t) + 63) & ~(size_t)63;
+    array->length = length;
+#ifndef _WIN32
+    if (posix_memalign((void**)&array->items, 64, size ? size : 64) != 0) array->items = NULL;
+#else
+    array->items = _aligned_malloc(size ? size : 64, 64);
+#endif
+    if (!array->items) {
+        flush_output();
+        printf("VM ERROR: Out of memory for an array of %lld ints\n", (long long)length);
+        exit(1);
+    }
+    memset(array->items, 0, size);
+    return array;
+}
+
+int64_t element_int(Value v) {
+    if (!is_int(v)) {
+        flush_output();
+        printf("VM ERROR: Arrays hold ints, got %s\n", value_type_name(v));
+        exit(1);
+    }
+    return as_int(v);
+}
+
+// [a, b, c]: items are the literal's values in order
+Value array_literal(Value* items, int count) {
+    Array* array = new_array(count);
+    for (int i = 0; i < count; i++) array->items[i] = element_int(items[i]);
+    return make_array(array);
+}
+
+int64_t checked_index(Value array, Value index) {
+    if (!is_array(array)) {
+        flush_output();
+        printf("VM ERROR: Cannot index %s\n", value_type_name(array));
+        exit(1);
+    }
+    if (!is_int(index)) {
+        flush_output();
+        printf("VM ERROR: Array index must be an int, got %s\n", value_type_name(index));
+        exit(1);
+    }
+    int64_t i = as_int(index);
+    if (i < 0 || i >= as_array(array)->length) {
+        flush_output();
+        printf("VM ERROR: Index %lld out of bounds for array of length %lld\n", (long long)i,
+               (long long)as_array(array)->length);
+        exit(1);
+    }
+    return i;
+}
+
+Value index_array(Value array, Value index) {
+    int64_t i = checked_index(array, index);
+    return make_int(as_array(array)->items[i]);
+}
+
+void store_index(Value array, Value index, Value value) {
+    int64_t i = checked_index(array, index);
+    as_array(array)->items[i] = element_int(value);
+}
+
+// Bulk kernels. Sums and products wrap like int arithmetic: they are
+// computed modulo 2^64 and wrapped into the int range at the end.
+
+int64_t array_sum(Array* a) {
+    const int64_t* x = a->items;
+    int64_t n = a->length, i = 0;
+    uint64_t total = 0;
+#if defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 4 <= n; i += 4) acc = _mm256_add_epi64(acc, _mm256_load_si256((const __m256i*)(x + i)));
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 2 <= n; i += 2) acc = _mm_add_epi64(acc, _mm_load_si128((const __m128i*)(x + i)));
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    total = lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++) total += (uint64_t)x[i];
+    return wrap_int(total);
+}
+
+// 64-bit lane products from 32-bit multiplies; SSE2 and AVX2 have no
+// 64-bit multiply: lo*lo + ((hi*lo + lo*hi) << 32)
+#if defined(__AVX2__)
+static inline __m256i mul_epi64_256(__m256i a, __m256i b) {
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+}
+
+static inline __m256i wrap_int_256(__m256i x) {
+    __m256i sign = _mm256_set1_epi64x(INT_SIGN);
+    return _mm256_sub_epi64(_mm256_xor_si256(_mm256_and_si256(x, _mm256_set1_epi64x(INT_MASK)), sign), sign);
+}
+#endif
+#if defined(__SSE2__)
+static inline __m128i mul_epi64_128(__m128i a, __m128i b) {
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b), _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+    return _mm_add_epi64(_mm_mul_epu32(a, b), _mm_slli_epi64(cross, 32));
+}
+
+static inline __m128i wrap_int_128(__m128i x) {
+    __m128i sign = _mm_set1_epi64x(INT_SIGN);
+    return _mm_sub_epi64(_mm_xor_si128(_mm_and_si128(x, _mm_set1_epi64x(INT_MASK)), sign), sign);
+}
+#endif
+
+int64_t array_dot(Array* a, Array* b) {
+    const int64_t* x = a->items;
+    const int64_t* y = b->items;
+    int64_t n = a->length, i = 0;
+    uint64_t total = 0;
+#if defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 4 <= n; i += 4) {
+        __m256i p = mul_epi64_256(_mm256_load_si256((const __m256i*)(x + i)), _mm256_load_si256((const __m256i*)(y + i)));
+        acc = _mm256_add_epi64(acc, p);
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 2 <= n; i += 2) {
+        acc = _mm_add_epi64(acc, mul_epi64_128(_mm_load_si128((const __m128i*)(x + i)), _mm_load_si128((const __m128i*)(y + i))));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    total = lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++) total += (uint64_t)x[i] * (uint64_t)y[i];
+    return wrap_int(total);
+}
+
+// Smallest (want_max 0) or largest element of a non-empty array. Signed
+// 64-bit compares need SSE4.2, so plain SSE2 builds use the scalar loop.
+int64_t array_extreme(Array* a, int want_max) {
+    const int64_t* x = a->items;
+    int64_t n = a->length, i = 0;
+    int64_t best = x[0];
+#if defined(__AVX2__)
+    if (n >= 4) {
+        __m256i acc = _mm256_load_si256((const __m256i*)x);
+        for (i = 4; i + 4 <= n; i += 4) {
+            __m256i v = _mm256_load_si256((const __m256i*)(x + i));
+            __m256i take = want_max ? _mm256_cmpgt_epi64(v, acc) : _mm256_cmpgt_epi64(acc, v);
+            acc = _mm256_blendv_epi8(acc, v, take);
+        }
+        int64_t lanes[4];
+        _mm256_storeu_si256((__m256i*)lanes, acc);
+        for (int l = 0; l < 4; l++) best = (want_max ? lanes[l] > best : lanes[l] < best) ? lanes[l] : best;
+    }
+#elif defined(__SSE4_2__)
+    if (n >= 2) {
+        __m128i acc = _mm_load_si128((const __m128i*)x);
+        for (i = 2; i + 2 <= n; i += 2) {
+            __m128i v = _mm_load_si128((const __m128i*)(x + i));
+            __m128i take = want_max ? _mm_cmpgt_epi64(v, acc) : _mm_cmpgt_epi64(acc, v);
+            acc = _mm_blendv_epi8(acc, v, take);
+        }
+        int64_t lanes[2];
+        _mm_storeu_si128((__m128i*)lanes, acc);
+        for (int l = 0; l < 2; l++) best = (want_max ? lanes[l] > best : lanes[l] < best) ? lanes[l] : best;
+    }
+#endif
+    for (; i < n; i++) best = (want_max ? x[i] > best : x[i] < best) ? x[i] : best;
+    return best;
+}
+
+void array_fill(Array* a, int64_t value) {
+    int64_t* x = a->items;
+    int64_t n = a->length, i = 0;
+#if defined(__AVX2__)
+    __m256i v = _mm256_set1_epi64x(value);
+    for (; i + 4 <= n; i += 4) _mm256_store_si256((__m256i*)(x + i), v);
+#elif defined(__SSE2__)
+    __m128i v = _mm_set1_epi64x(value);
+    for (; i + 2 <= n; i += 2) _mm_store_si128((__m128i*)(x + i), v);
+#endif
+    for (; i < n; i++) x[i] = value;
+}
+
+// a = a op b element-wise (b_items NULL: op with the scalar b), op '+' or '*'
+void array_combine(Array* a, const int64_t* b_items, int64_t b, char op) {
+    int64_t* x = a->items;
+    int64_t n = a->length, i = 0;
+#if defined(__AVX2__)
+    __m256i k = _mm256_set1_epi64x(b);
+    for (; i + 4 <= n; i += 4) {
+        __m256i u = _mm256_load_si256((const __m256i*)(x + i));
+        __m256i v = b_items ? _mm256_load_si256((const __m256i*)(b_items + i)) : k;
+        __m256i r = op == '+' ? _mm256_add_epi64(u, v) : mul_epi64_256(u, v);
+        _mm256_store_si256((__m256i*)(x + i), wrap_int_256(r));
+    }
+#elif defined(__SSE2__)
+    __m128i k = _mm_set1_epi64x(b);
+    for (; i + 2 <= n; i += 2) {
+        __m128i u = _mm_load_si128((const __m128i*)(x + i));
+        __m128i v = b_items ? _mm_load_si128((const __m128i*)(b_items + i)) : k;
+        __m128i r = op == '+' ? _mm_add_epi64(u, v) : mul_epi64_128(u, v);
+        _mm_store_si128((__m128i*)(x + i), wrap_int_128(r));
+    }
+#endif
+    for (; i < n; i++) {
+        uint64_t v = b_items ? (uint64_t)b_items[i] : (uint64_t)b;
+        x[i] = wrap_int(op == '+' ? (uint64_t)x[i] + v : (uint64_t)x[i] * v);
+    }
+}
+
+void print_array(Array* a) {
+    output_char('[');
+    for (int64_t i = 0; i < a->length; i++) {
+        if (i > 0) output_bytes(", ", 2);
+        output_int(a->items[i]);
+    }
+    output_char(']');
+}
@@ -2,6 +2,8 @@
 #include "definitions.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <limits.h>
 
 // Token stream helpers
 Token peek(void);
@@ -28,7 +30,6 @@ ASTNode* parse_block(void);
 ASTNode* parse_statement(void);
 ASTNode* parse_expression(void);
 ASTNode* parse_primary(void);
-ASTNode* parse_binary_op(int min_prec);
 
 // Specific statement parsers
 ASTNode* parse_assignment(void);
@@ -61,17 +62,19 @@ char* tokentypes[] = {
     "TOKEN_STRING", //type 19
     "TOKEN_EOF", //type 20
     "TOKEN_COMMA", //type 21, for func call arg
-    "TOKEN_KEYWORD_RETURN" // type 22, for func return
+    "TOKEN_KEYWORD_RETURN", // type 22, for func return
+    "TOKEN_BRACKET_OPEN", // type 23
+    "TOKEN_BRACKET_CLOSE" // type 24
     };
 
 int current = 0;
 
 Token peek() {
-    return tokens[current];
+    return token_at(current);
 }
 
 Token advance() {
-    return tokens[current++];
+    return token_at(current++);
 }
 
 int match(TokenType type) {
@@ -85,75 +88,261 @@ int match(TokenType type) {
 Token expect(TokenType type) {
     if (!match(type)) {
         Token t = peek();
-        printf("PARSER Syntax error: expected token type %s, got %s ('%s') at line %d, column %d\n",
-               tokentypes[type], tokentypes[t.type], t.lexeme, t.line, t.column);
+        printf("PARSER Syntax error: expected token type %s, got %s ('%.*s') at line %d, column %d\n",
+               tokentypes[type], tokentypes[t.type], (int)t.length, token_text(t), t.line, t.column);
         exit(1);
     }
-    return tokens[current - 1];  // return the token just matched
+    return token_at(current - 1);  // return the token just matched
+}
+
+// Every node, list and parameter array of the current program
+Arena ast_arena;
+
+#define NODE_SIZE(member) (offsetof(ASTNode, member) + sizeof(((ASTNode*)0)->member))
+
+// Bytes a node of this kind needs: the header plus its own union member
+size_t node_size(ASTNodeType type) {
+    switch (type) {
+        case AST_NUMBER: return NODE_SIZE(number);
+        case AST_STRING: return NODE_SIZE(string);
+        case AST_VARIABLE: return NODE_SIZE(name);
+        case AST_BINARY_OP: return NODE_SIZE(binary);
+        case AST_ASSIGNMENT: return NODE_SIZE(assignment);
+        case AST_IF: return NODE_SIZE(if_stmt);
+        case AST_WHILE: return NODE_SIZE(while_stmt);
+        case AST_FUNCTION_DEF: return NODE_SIZE(function_def);
+        case AST_FUNCTION_CALL: return NODE_SIZE(function_call);
+        case AST_BLOCK: return NODE_SIZE(block);
+        case AST_RETURN: return NODE_SIZE(return_stmt);
+        case AST_ARRAY: return NODE_SIZE(array);
+        case AST_INDEX: return NODE_SIZE(index);
+        case AST_INDEX_ASSIGNMENT: return NODE_SIZE(index);
+        default: return sizeof(ASTNode);
+    }
+}
+
+void* ast_alloc(size_t size) {
+    return arena_alloc(&ast_arena, size);
+}
+
+// Allocates a node positioned at the token it starts at
+ASTNode* new_node(ASTNodeType type, Token at) {
+    ASTNode* node = ast_alloc(node_size(type));
+    node->type = type;
+    node->line = at.line;
+    node->column = at.column;
+    return node;
+}
+
+// Frees the whole tree in one go; names and strings stay interned
+void release_ast() {
+    arena_release(&ast_arena);
+}
+
+// First-pass list capacity from the tokens still to parse. A statement is
+// at least about four tokens and an argument two; blocks and argument lists
+// are capped so typical ones fit without reserving the rest of the file.
+int list_capacity(int tokens_per_item, int limit) {
+    int n = tokens_remaining(current) / tokens_per_item + 1;
+    return n < limit ? n : limit;
 }
 
 ASTNode* parse_primary() {
     Token t = advance();
-    ASTNode* node = malloc(sizeof(ASTNode));
+    ASTNode* node;
 
     if (t.type == TOKEN_NUMBER) {
-        node->type = AST_NUMBER;
-        node->number = t.value;
+        node = new_node(AST_NUMBER, t);
+        node->number = token_number(t);
     } else if (t.type == TOKEN_STRING) {
-        node->type = AST_STRING;
-        strcpy(node->string, t.lexeme);
+        node = new_node(AST_STRING, t);
+        node->string = token_string(t);
     } else if (t.type == TOKEN_IDENTIFIER) {
         if (peek().type == TOKEN_PAREN_OPEN) {
     advance(); // skip '('
 
-    ASTNode** args = malloc(sizeof(ASTNode*) * 10);
-    int count = 0;
+    ArenaVec args;
+    vec_init(&ast_arena, &args, list_capacity(2, 8));
 
     if (peek().type != TOKEN_PAREN_CLOSE) {
             do {
-                args[count++] = parse_expression();
+                vec_push(&ast_arena, &args, parse_expression());
             } while (match(TOKEN_COMMA));
         }
 
         expect(TOKEN_PAREN_CLOSE);  // ✅ THIS IS CRUCIAL
 
-        node->type = AST_FUNCTION_CALL;
-        strcpy(node->function_call.name, t.lexeme);
-        node->function_call.args = args;
-        node->function_call.arg_count = count;
+        node = new_node(AST_FUNCTION_CALL, t);
+        node->function_call.name = token_name(t);
+        node->function_call.args = (ASTNode**)args.items;
+        node->function_call.arg_count = args.count;
     } else {
-        node->type = AST_VARIABLE;
-        strcpy(node->name, t.lexeme);
+        node = new_node(AST_VARIABLE, t);
+        node->name = token_name(t);
     }
+    } else if (t.type == TOKEN_BRACKET_OPEN) {
+        ArenaVec elements;
+        vec_init(&ast_arena, &elements, list_capacity(2, 8));
+        if (peek().type != TOKEN_BRACKET_CLOSE) {
+            do {
+                vec_push(&ast_arena, &elements, parse_expression());
+            } while (match(TOKEN_COMMA));
+        }
+        expect(TOKEN_BRACKET_CLOSE);
+
+        node = new_node(AST_ARRAY, t);
+        node->array.elements = (ASTNode**)elements.items;
+        node->array.count = elements.count;
     } else {
-        printf("PARSER: Unexpected token in expression: %s\n", t.lexeme);
+        printf("PARSER: Unexpected token in expression: %.*s at line %d, column %d\n",
+               (int)t.length, token_text(t), t.line, t.column);
         exit(1);
     }
 
     return node;
 }
 
-ASTNode* parse_binary_op(int min_prec) {
-    ASTNode* left = parse_primary();
+// Expressions are parsed by operator precedence with explicit operand and
+// operator stacks, so long chains and deep parentheses never recurse. Only
+// call arguments, array elements and indexes re-enter parse_expression();
+// the stacks are shared and each call works above the entries it found on
+// entry.
+
+#define PREC_UNARY 5
+
+// Binary operator precedence by Token.op; 0 means not a binary operator
+const uint8_t binary_precedences[128] = {
+    ['='] = 1, ['!'] = 1,                         // == !=
+    ['<'] = 2, ['>'] = 2, ['L'] = 2, ['G'] = 2,   // < > <= >=
+    ['+'] = 3, ['-'] = 3,
+    ['*'] = 4, ['/'] = 4,
+};
+
+int binary_precedence(Token t) {
+    if (t.type != TOKEN_OPERATOR && !(t.type >= TOKEN_GT && t.type <= TOKEN_LTE)) return 0;
+    return (unsigned char)t.op < 128 ? binary_precedences[(unsigned char)t.op] : 0;
+}
 
-    while (peek().type == TOKEN_OPERATOR || peek().type >= TOKEN_GT) {
-        Token op_token = advance();
-        char op = op_token.op;
-        ASTNode* right = parse_primary();
+typedef struct {
+    char op;       // operator char, 'u' for unary minus, '(' for an open parenthesis
+    int prec;
+    Token at;
+} PendingOp;
+
+ASTNode** operand_stack = NULL;
+int operand_top = 0;
+int operand_capacity = 0;
+PendingOp* operator_stack = NULL;
+int operator_top = 0;
+int operator_capacity = 0;
+
+void push_operand(ASTNode* node) {
+    if (operand_top == operand_capacity) {
+        operand_capacity = operand_capacity ? operand_capacity * 2 : 64;
+        operand_stack = realloc(operand_stack, sizeof(ASTNode*) * operand_capacity);
+    }
+    operand_stack[operand_top++] = node;
+}
 
-        ASTNode* bin = malloc(sizeof(ASTNode));
-        bin->type = AST_BINARY_OP;
-        bin->binary.op = op;
-        bin->binary.left = left;
-        bin->binary.right = right;
-        left = bin;
+void push_operator(char op, int prec, Token at) {
+    if (operator_top == operator_capacity) {
+        operator_capacity = operator_capacity ? operator_capacity * 2 : 64;
+        operator_stack = realloc(operator_stack, sizeof(PendingOp) * operator_capacity);
     }
+    operator_stack[operator_top++] = (PendingOp){op, prec, at};
+}
 
-    return left;
+// Pops the top operator and the operands it takes, pushing the result.
+// Negated literals become negative numbers; other negations become 0 - x.
+void reduce() {
+    PendingOp p = operator_stack[--operator_top];
+    if (p.op == 'u') {
+        ASTNode* operand = operand_stack[operand_top - 1];
+        if (operand->type == AST_NUMBER) {
+            operand->number = -operand->number;
+            operand->line = p.at.line;
+            operand->column = p.at.column;
+            return;
+        }
+        ASTNode* zero = new_node(AST_NUMBER, p.at);
+        zero->number = 0;
+        ASTNode* neg = new_node(AST_BINARY_OP, p.at);
+        neg->binary.op = '-';
+        neg->binary.left = zero;
+        neg->binary.right = operand;
+        operand_stack[operand_top - 1] = neg;
+        return;
+    }
+    ASTNode* bin = new_node(AST_BINARY_OP, p.at);
+    bin->binary.op = p.op;
+    bin->binary.right = operand_stack[--operand_top];
+    bin->binary.left = operand_stack[operand_top - 1];
+    operand_stack[operand_top - 1] = bin;
 }
 
 ASTNode* parse_expression() {
-    return parse_binary_op(1);
+    int operand_base = operand_top;
+    int operator_base = operator_top;
+    int open_parens = 0;
+    int expect_operand = 1;
+
+    for (;;) {
+        Token t = peek();
+        if (expect_operand) {
+            if (t.type == TOKEN_OPERATOR && t.op == '-') {
+                advance();
+                push_operator('u', PREC_UNARY, t);
+            } else if (t.type == TOKEN_PAREN_OPEN) {
+                advance();
+                push_operator('(', 0, t);
+                open_parens++;
+            } else {
+                push_operand(parse_primary());
+                expect_operand = 0;
+            }
+            continue;
+        }
+
+        int prec = binary_precedence(t);
+        if (prec > 0) {
+            // Left associative: equal precedence reduces first
+            while (operator_top > operator_base && operator_stack[operator_top - 1].prec >= prec) reduce();
+            advance();
+            push_operator(t.op, prec, t);
+            expect_operand = 1;
+        } else if (t.type == TOKEN_PAREN_CLOSE && open_parens > 0) {
+            advance();
+            while (operator_stack[operator_top - 1].op != '(') reduce();
+            operator_top--;
+            open_parens--;
+        } else if (t.type == TOKEN_BRACKET_OPEN) {
+            // Indexing binds tighter than any operator: it applies to the
+            // operand just parsed (or just closed by a parenthesis)
+            advance();
+            ASTNode* index = new_node(AST_INDEX, t);
+            index->index.array = operand_stack[operand_top - 1];
+            index->index.index = parse_expression();
+            index->index.value = NULL;
+            expect(TOKEN_BRACKET_CLOSE);
+            operand_stack[operand_top - 1] = index;
+        } else {
+            break;
+        }
+    }
+
+    if (open_parens > 0) {
+        Token t = peek();
+        printf("PARSER Syntax error: expected ')', got '%.*s' at line %d, column %d\n",
+               (int)t.length, token_text(t), t.line, t.column);
+        exit(1);
+    }
+    while (operator_top > operator_base) reduce();
+    ASTNode* result = operand_stack[--operand_top];
+    if (operand_top != operand_base) {
+        printf("PARSER: Malformed expression at line %d, column %d\n", result->line, result->column);
+        exit(1);
+    }
+    return result;
 }
 
 ASTNode* parse_assignment() {
@@ -162,9 +351,8 @@ ASTNode* parse_assignment() {
     ASTNode* value = parse_expression();
     expect(TOKEN_SEMICOLON);
 
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_ASSIGNMENT;
-    strcpy(node->assignment.name, var.lexeme);
+    ASTNode* node = new_node(AST_ASSIGNMENT, var);
+    node->assignment.name = token_name(var);
     node->assignment.value = value;
     return node;
 }
@@ -176,14 +364,13 @@ ASTNode* parse_function_def() {
 
     expect(TOKEN_PAREN_OPEN);
 
-    char** params = malloc(sizeof(char*) * 10);
-    int count = 0;
+    ArenaVec params;
+    vec_init(&ast_arena, &params, list_capacity(2, 8));
 
     if (peek().type != TOKEN_PAREN_CLOSE) {
         do {
             Token param = expect(TOKEN_IDENTIFIER);
-            params[count] = malloc(strlen(param.lexeme) + 1);
-            strcpy(params[count++], param.lexeme);
+            vec_push(&ast_arena, &params, (void*)token_name(param));
         } while (match(TOKEN_COMMA));
     }
 
@@ -191,18 +378,17 @@ ASTNode* parse_function_def() {
 
     ASTNode* body = parse_block();
 
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_FUNCTION_DEF;
-    strcpy(node->function_def.name, name.lexeme);
-    node->function_def.params = params;
-    node->function_def.param_count = count;
+    ASTNode* node = new_node(AST_FUNCTION_DEF, name);
+    node->function_def.name = token_name(name);
+    node->function_def.params = (const char**)params.items;
+    node->function_def.param_count = params.count;
     node->function_def.body = body;
 
     return node;
 }
 
 ASTNode* parse_if() {
-    advance(); // skip 'if'
+    Token keyword = advance(); // skip 'if'
     expect(TOKEN_PAREN_OPEN);
     ASTNode* condition = parse_expression();
     expect(TOKEN_PAREN_CLOSE);
@@ -213,8 +399,7 @@ ASTNode* parse_if() {
         else_branch = parse_block();
     }
 
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_IF;
+    ASTNode* node = new_node(AST_IF, keyword);
     node->if_stmt.condition = condition;
     node->if_stmt.then_branch = then_branch;
     node->if_stmt.else_branch = else_branch;
@@ -222,14 +407,13 @@ ASTNode* parse_if() {
 }
 
 ASTNode* parse_while() {
-    advance(); // skip 'while'
+    Token keyword = advance(); // skip 'while'
     expect(TOKEN_PAREN_OPEN);
     ASTNode* condition = parse_expression();
     expect(TOKEN_PAREN_CLOSE);
     ASTNode* body = parse_block();
 
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_WHILE;
+    ASTNode* node = new_node(AST_WHILE, keyword);
     node->while_stmt.condition = condition;
     node->while_stmt.body = body;
     return node;
@@ -246,30 +430,33 @@ ASTNode* parse_statement() {
         return parse_var_declaration();
     } else if (peek().type == TOKEN_KEYWORD_RETURN) {
         return parse_return();  // ✅ NEW: handles return statements
-    } else if (peek().type == TOKEN_IDENTIFIER && tokens[current + 1].type == TOKEN_ASSIGN) {
+    } else if (peek().type == TOKEN_IDENTIFIER && token_at(current + 1).type == TOKEN_ASSIGN) {
         return parse_assignment();
     } else {
         ASTNode* expr = parse_expression();
+        if (expr->type == AST_INDEX && match(TOKEN_ASSIGN)) {
+            expr->type = AST_INDEX_ASSIGNMENT;
+            expr->index.value = parse_expression();
+        }
         expect(TOKEN_SEMICOLON);
         return expr;
     }
 }
 
 ASTNode* parse_block() {
-    expect(TOKEN_BRACE_OPEN);
-    ASTNode** stmts = malloc(sizeof(ASTNode*) * 100);
-    int count = 0;
+    Token brace = expect(TOKEN_BRACE_OPEN);
+    ArenaVec stmts;
+    vec_init(&ast_arena, &stmts, list_capacity(4, 32));
 
     while (peek().type != TOKEN_BRACE_CLOSE && peek().type != TOKEN_EOF) {
-        stmts[count++] = parse_statement();
+        vec_push(&ast_arena, &stmts, parse_statement());
     }
 
     expect(TOKEN_BRACE_CLOSE);
 
-    ASTNode* block = malloc(sizeof(ASTNode));
-    block->type = AST_BLOCK;
-    block->block.statements = stmts;
-    block->block.count = count;
+    ASTNode* block = new_node(AST_BLOCK, brace);
+    block->block.statements = (ASTNode**)stmts.items;
+    block->block.count = stmts.count;
     return block;
 }
 
@@ -280,7 +467,7 @@ void print_ast(ASTNode* node, int indent) {
 
     switch (node->type) {
         case AST_NUMBER:
-            printf("Number: %d\n", node->number);
+            printf("Number: %lld\n", (long long)node->number);
             break;
         case AST_STRING:
             printf("String: \"%s\"\n", node->string);
@@ -292,11 +479,18 @@ void print_ast(ASTNode* node, int indent) {
             printf("Assignment: %s =\n", node->assignment.name);
             print_ast(node->assignment.value, indent + 1);
             break;
-        case AST_BINARY_OP:
-            printf("BinaryOp: %c\n", node->binary.op);
-            print_ast(node->binary.left, indent + 1);
-            print_ast(node->binary.right, indent + 1);
+        case AST_BINARY_OP: {
+            // A left-nested chain is printed with a loop, see push_spine
+            int base = push_spine(node);
+            for (int i = base; i < spine_top; i++) {
+                if (i > base) printf("%*s", (indent + i - base) * 2, "");
+                printf("BinaryOp: %c\n", spine[i]->binary.op);
+            }
+            print_ast(spine[spine_top - 1]->binary.left, indent + spine_top - base);
+            for (int i = spine_top - 1; i >= base; i--) print_ast(spine[i]->binary.right, indent + 1 + i - base);
+            spine_top = base;
             break;
+        }
         case AST_FUNCTION_CALL:
             printf("FunctionCall: %s()\n", node->function_call.name);
             for (int i = 0; i < node->function_call.arg_count; i++) {
@@ -337,35 +531,52 @@ void print_ast(ASTNode* node, int indent) {
             printf("%*sReturn:\n", indent * 2, "");
             print_ast(node->return_stmt.value, indent + 1);
             break;
+        case AST_ARRAY:
+            printf("Array: %d elements\n", node->array.count);
+            for (int i = 0; i < node->array.count; i++) {
+                print_ast(node->array.elements[i], indent + 1);
+            }
+            break;
+        case AST_INDEX:
+            printf("Index:\n");
+            print_ast(node->index.array, indent + 1);
+            print_ast(node->index.index, indent + 1);
+            break;
+        case AST_INDEX_ASSIGNMENT:
+            printf("IndexAssignment:\n");
+            print_ast(node->index.array, indent + 1);
+            print_ast(node->index.index, indent + 1);
+            print_ast(node->index.value, indent + 1);
+            break;
         default:
             printf("Unknown AST node type\n");
     }
 }
 
 ASTNode* parse_program(void) {
-    ASTNode** stmts = malloc(sizeof(ASTNode*) * 100);  // support up to 100 statements
-    int count = 0;
+    current = 0;
+    ArenaVec stmts;
+    vec_init(&ast_arena, &stmts, list_capacity(4, INT_MAX));
+    Token first = peek();
 
     while (peek().type != TOKEN_EOF) {
-        stmts[count++] = parse_statement();
+        vec_push(&ast_arena, &stmts, parse_statement());
     }
 
-    ASTNode* block = malloc(sizeof(ASTNode));
-    block->type = AST_BLOCK;
-    block->block.statements = stmts;
-    block->block.count = count;
+    ASTNode* block = new_node(AST_BLOCK, first);
+    block->block.statements = (ASTNode**)stmts.items;
+    block->block.count = stmts.count;
     return block;
 }
 
 ASTNode* parse_return() {
-    expect(TOKEN_KEYWORD_RETURN);
+    Token keyword = expect(TOKEN_KEYWORD_RETURN);
 
     ASTNode* value = parse_expression();
 
     expect(TOKEN_SEMICOLON);  // ✅ This is the missing piece!
 
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_RETURN;
+    ASTNode* node = new_node(AST_RETURN, keyword);
     node->return_stmt.value = value;
 
     return node;
@@ -379,15 +590,63 @@ ASTNode* parse_var_declaration() {
     ASTNode* value = parse_expression();
     expect(TOKEN_SEMICOLON);
 
-    ASTNode* node = malloc(sizeof(ASTNode));
-    node->type = AST_ASSIGNMENT; // store as regular assignment
-    strcpy(node->assignment.name, name.lexeme);
+    ASTNode* node = new_node(AST_ASSIGNMENT, name); // store as regular assignment
+    node->assignment.name = token_name(name);
     node->assignment.value = value;
     return node;
 }
 
 extern int token_count;
-int main() {
+#ifndef PENGUIN_NO_MAIN
+int main(int argc, char** argv) {
+    // --backend=register runs the three-address register VM instead of the stack VM
+    // --no-peephole keeps the stack VM code unfused
+    // --stream lets the parser pull tokens from the lexer instead of tokenizing first
+    // --no-cache neither loads nor writes the compiled script's .pgc image
+    // --jit compiles hot loops of the stack VM to native code (x86-64 only)
+    // --aot=<exe> writes the program as <exe>.c and builds <exe> with gcc instead of running it
+    // --dump prints the tokens and the AST, which for a long generated script can dwarf the script
+    // A script path (or - for stdin) replaces the built-in demo program. Piped
+    // stdin is read into memory in full before lexing; only files are mapped.
+    int use_register_backend = 0;
+    int use_peephole = 1;
+    int use_fold = 1;
+    int use_stream = 0;
+    int use_cache = 1;
+    int dump = 0;
+    const char* aot_path = NULL;
+    const char* script_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--backend=register") == 0) {
+            use_register_backend = 1;
+        } else if (strcmp(argv[i], "--backend=stack") == 0) {
+            use_register_backend = 0;
+        } else if (strcmp(argv[i], "--no-peephole") == 0) {
+            use_peephole = 0;
+        } else if (strcmp(argv[i], "--no-fold") == 0) {
+            use_fold = 0;
+        } else if (strcmp(argv[i], "--no-cfg") == 0) {
+            use_cfg = 0;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            use_stream = 1;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            use_cache = 0;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            use_jit = 1;
+        } else if (strcmp(argv[i], "--dump") == 0) {
+            dump = 1;
+        } else if (strncmp(argv[i], "--aot=", 6) == 0 && argv[i][6]) {
+            aot_path = argv[i] + 6;
+        } else if (!script_path && (argv[i][0] != '-' || argv[i][1] == '\0')) {
+            script_path = argv[i];
+        } else {
+            printf("Usage: %s [--backend=stack|--backend=register] [--no-peephole] [--no-fold] [--no-cfg] [--stream] [--no-cache] [--jit] [--aot=exe] [--dump] [script.pg|-]\n", argv[0]);
+            printf("  - reads the script from stdin; piped input is held in memory in full, a file is mapped\n");
+            return 1;
+        }
+    }
+
+
     /*
     const char* code =
         "while (true){print(\"penguin\");}";
@@ -405,25 +664,110 @@ int main() {
     "}\n"
     "print(\"Done!\");\n";
 
-    tokenize(code);  // from tokenizer.c
-    printf("\n=== TOKENS ===\n");
-    for (int i = 0; i < token_count; i++) {
-        Token t = tokens[i];
-        printf("Type: %d, Lexeme: '%s'\n", t.type, t.lexeme);
+    // Tokens point into the source, so it stays loaded until parsing is done
+    Source source = {NULL, 0, 0};
+    if (script_path) {
+        source = load_source(script_path);
+        code = source.text;
+    }
+
+    // Only the stack VM runs cached bytecode, and stdin has nowhere to keep it
+    char* image_path = NULL;
+    uint64_t source_hash = 0;
+    uint32_t options = (use_peephole ? CACHE_PEEPHOLE : 0) | (use_fold ? CACHE_FOLD : 0) | (use_cfg ? CACHE_CFG : 0);
+    Chunk chunk;
+    if (use_cache && !use_register_backend && !aot_path && script_path && strcmp(script_path, "-") != 0) {
+        image_path = cache_path(script_path);
+        source_hash = hash_source(source.text, source.size);
+        if (load_cached_chunk(image_path, source_hash, options, &chunk)) {
+            release_source(&source);
+            printf("\n=== CACHE ===\nloaded %s\n", image_path);
+            printf("\n=== ASM ===\n");
+            print_asm(&chunk);
+            goto run;
+        }
+    }
+
+    if (use_stream) {
+        begin_token_stream(code);
+    } else {
+        tokenize(code);  // from tokenizer.c
+        if (dump) {
+            printf("\n=== TOKENS ===\n");
+            for (int i = 0; i < token_count; i++) {
+                Token t = tokens[i];
+                printf("Type: %d, Lexeme: '%.*s'\n", t.type, (int)t.length, token_text(t));
+            }
+        }
     }
     ASTNode* program = parse_program();  // from parser.c
+    if (script_path) release_source(&source);
+
+    // Folding drops dead branches, so names are resolved on the full tree
+    resolve_symbols(program);
+    if (use_fold) fold_program(program);
+
+    if (dump) {
+        printf("\n=== AST ===\n");
+        print_ast(program, 0);
+    }
+    if (use_fold) {
+        printf("\n=== FOLDING ===\n");
+        print_fold_stats();
+    }
+
+    if (aot_path) {
+        printf("\n=== AOT ===\n");
+        int status = build_native(program, aot_path);
+        if (status == 0) printf("built %s from %s.c\n", aot_path, aot_path);
+        release_ast();
+        return status == 0 ? 0 : 1;
+    }
 
-    printf("\n=== AST ===\n");
-    print_ast(program, 0);
+    if (use_register_backend) {
+        printf("\n=== REGISTER ASM ===\n");
+        RegChunk reg_chunk;
+        compile_register(program, &reg_chunk);
+        print_reg_asm(&reg_chunk);
+        release_ast();
+        run_regvm(&reg_chunk);
+        return 0;
+    }
 
     printf("\n=== ASM ===\n");
-    // Emit and print
-    Instruction ir_buffer[MAX_IR];
-    int ir_index = 0;
-    emit_node(program, ir_buffer, &ir_index);
-    print_asm(ir_buffer, ir_index);
-    run_vm(ir_buffer, ir_index);
+    // Emit, link, assemble and print
+    IRBuffer ir;
+    init_ir(&ir);
+    emit_program(program, &ir);
+    if (use_peephole) peephole_optimize(&ir);
+    link_program(&ir);
+    assemble_program(&ir, &chunk);
+    release_ast();
+    if (image_path) save_cached_chunk(image_path, source_hash, options, &chunk);
+    print_asm(&chunk);
+    if (use_cfg) {
+        printf("\n=== CFG ===\n");
+        print_cfg_stats();
+    }
+    if (use_peephole) {
+        printf("\n=== PEEPHOLE ===\n");
+        print_peephole_stats();
+    }
+run:
+    printf("\n=== OUTPUT ===\n");
+    reset_vm();
+    run_vm(&chunk);
+#ifdef PENGUIN_JIT
+    if (use_jit) {
+        printf("\n=== JIT ===\n");
+        print_jit_stats();
+    }
+#endif
+#ifdef PENGUIN_PROFILE
+    printf("\n=== PROFILE ===\n");
+    print_profile(&chunk);
+#endif
 
     return 0;
 }
-
+#endif
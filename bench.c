@@ -0,0 +1,148 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Compares the VM dispatch engines and the register backend on a
+// loop-heavy script.
+// Build with `make bench`, which also turns on PENGUIN_COUNT_OPS.
+
+extern unsigned long long vm_op_count;
+
+ASTNode* parse_program(void);
+
+const char* loop_script =
+    "var i = 0;\n"
+    "var sum = 0;\n"
+    "while (i < 2000000) {\n"
+    "  if (i > 1000) {\n"
+    "    sum = sum + i * 2;\n"
+    "  } else {\n"
+    "    sum = sum - 1;\n"
+    "  }\n"
+    "  i = i + 1;\n"
+    "}\n";
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#ifdef __linux__
+int open_counter(unsigned int type, unsigned long long config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+// Both backends run from an opaque compiled program
+typedef struct {
+    const char* name;
+    void (*run)(void* program);
+} Engine;
+
+void run_switch(void* program) { run_vm_switch(program); }
+#ifdef PENGUIN_THREADED
+void run_threaded(void* program) { run_vm_threaded(program); }
+#endif
+void run_register(void* program) { run_regvm(program); }
+
+void bench_engine(Engine engine, void* program, int runs) {
+    long long branches = -1, misses = -1;
+#ifdef __linux__
+    int branch_fd = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS);
+    int miss_fd = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    if (branch_fd >= 0 && miss_fd >= 0) {
+        ioctl(branch_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(miss_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(branch_fd, PERF_EVENT_IOC_ENABLE, 0);
+        ioctl(miss_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+
+    vm_op_count = 0;
+    double start = now_seconds();
+    for (int r = 0; r < runs; r++) {
+        reset_vm();
+        engine.run(program);
+    }
+    double elapsed = now_seconds() - start;
+
+#ifdef __linux__
+    if (branch_fd >= 0 && miss_fd >= 0) {
+        ioctl(branch_fd, PERF_EVENT_IOC_DISABLE, 0);
+        ioctl(miss_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(branch_fd, &branches, sizeof(branches)) != sizeof(branches)) branches = -1;
+        if (read(miss_fd, &misses, sizeof(misses)) != sizeof(misses)) misses = -1;
+    }
+    if (branch_fd >= 0) close(branch_fd);
+    if (miss_fd >= 0) close(miss_fd);
+#endif
+
+    printf("%-10s %8.3f s  %12llu ops  %8.1f Mops/s", engine.name, elapsed,
+           vm_op_count, vm_op_count / elapsed / 1e6);
+    if (branches > 0 && misses >= 0) {
+        printf("  branch-miss %5.2f%%", 100.0 * misses / branches);
+    } else {
+        printf("  branch-miss n/a");
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    int runs = argc > 1 ? atoi(argv[1]) : 5;
+
+    tokenize(loop_script);
+    ASTNode* program = parse_program();
+    IRBuffer ir;
+    Chunk chunk;
+    init_ir(&ir);
+    resolve_symbols(program);
+    emit_program(program, &ir);
+    link_program(&ir);
+    assemble_program(&ir, &chunk);
+    RegChunk reg_chunk;
+    compile_register(program, &reg_chunk);
+
+    // Same program again with superinstructions
+    IRBuffer fused_ir;
+    Chunk fused_chunk;
+    init_ir(&fused_ir);
+    emit_program(program, &fused_ir);
+    peephole_optimize(&fused_ir);
+    link_program(&fused_ir);
+    assemble_program(&fused_ir, &fused_chunk);
+
+    printf("=== DISPATCH BENCHMARK (%d runs, %d bytes of bytecode) ===\n", runs, chunk.count);
+    bench_engine((Engine){"switch", run_switch}, &chunk, runs);
+#ifdef PENGUIN_THREADED
+    bench_engine((Engine){"threaded", run_threaded}, &chunk, runs);
+#else
+    printf("threaded   not available in this build\n");
+#endif
+#ifdef PENGUIN_THREADED
+    bench_engine((Engine){"peephole", run_threaded}, &fused_chunk, runs);
+#else
+    bench_engine((Engine){"peephole", run_switch}, &fused_chunk, runs);
+#endif
+    bench_engine((Engine){"register", run_register}, &reg_chunk, runs);
+    printf("\n");
+    print_peephole_stats();
+    return 0;
+}
@@ -0,0 +1,967 @@
+#include "definitions.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Times each pipeline phase (tokenize, parse_program, emit, run_vm) on the
+// .pg workloads in benchmarks/ plus several large generated scripts, and appends
+// one CSV row per workload and phase to a results file.
+// Build with `make bench-suite`, which also turns on PENGUIN_COUNT_OPS.
+//
+//   ./bench_suite [runs] [--stream|--lexer|--cache|--jit|--aot|--cfg-fuzz[=N]] [--out=results.csv] [workload.pg ...]
+//
+// --stream parses through the pull-based lexer, so the tokenize phase is
+// folded into parse_program and no token array is built.
+// --lexer instead compares the reference and table-driven scanners in MB/s
+// and checks that they produce identical tokens.
+// --cache compares compiling each workload with loading its cached bytecode.
+// --jit runs each workload with and without the JIT and checks the output
+// is identical (x86-64 only).
+// --aot builds each .pg workload with the C backend and checks the binary
+// prints what the VM prints; the generated scripts are skipped, they would
+// mostly time gcc.
+// --cfg-fuzz generates N random programs (seeds 1..N, default 1000) built
+// around loops, copies and overwritten stores, runs each with the cfg passes
+// on and off, and fails on the first one whose output differs.
+// Every differential mode first checks that all backends reject a few
+// invalid scripts, such as a func defined inside an if or while.
+
+extern unsigned long long vm_op_count;
+extern int token_count;
+
+ASTNode* parse_program(void);
+
+const char* default_workloads[] = {
+    "benchmarks/loop.pg",
+    "benchmarks/nested_if.pg",
+    "benchmarks/fib.pg",
+    "benchmarks/strings.pg",
+    "benchmarks/print.pg",
+    "benchmarks/concat.pg",
+    "benchmarks/string_eq.pg",
+    "benchmarks/array_loop.pg",
+    "benchmarks/array_bulk.pg",
+};
+
+typedef enum {
+    PHASE_TOKENIZE,
+    PHASE_PARSE,
+    PHASE_EMIT,
+    PHASE_RUN,
+    PHASE_COUNT
+} Phase;
+
+const char* phase_names[] = {"tokenize", "parse_program", "emit", "run_vm"};
+const char* phase_units[] = {"tokens", "nodes", "nodes", "ops"};
+
+typedef struct {
+    double seconds;        // best of all runs
+    unsigned long long items;
+    long peak_kb;          // peak resident set size while the phase ran (see phase_peak_kb)
+} PhaseResult;
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Process-wide peak so far; it only grows, so the per-phase numbers come
+// from phase_peak_kb instead
+long peak_memory_kb() {
+#ifndef _WIN32
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#else
+    return -1;
+#endif
+}
+
+// Front-end stress: blocks of straight-line assignments over a handful of
+// globals
+char* generate_large_script(int blocks, int statements_per_block) {
+    int capacity = 1024 + blocks * (64 + statements_per_block * 48);
+    char* source = malloc(capacity);
+    int n = 0;
+    for (int v = 0; v < 10; v++) {
+        n += sprintf(source + n, "var v%d = %d;\n", v, v);
+    }
+    for (int b = 0; b < blocks; b++) {
+        n += sprintf(source + n, "if (v%d >= 0) {\n", b % 10);
+        for (int s = 0; s < statements_per_block; s++) {
+            int k = b * statements_per_block + s;
+            n += sprintf(source + n, "  v%d = v%d + %d - v%d;\n", k % 10, (k + 3) % 10, k % 97, (k + 7) % 10);
+        }
+        n += sprintf(source + n, "}\n");
+    }
+    return source;
+}
+
+// Parser stress: one machine-generated formula with `terms` parenthesized
+// terms and a nested tail, the shape that used to need deep recursion
+char* generate_long_expression(int terms, int depth) {
+    char* source = malloc(64 + terms * 24 + depth * 2);
+    int n = sprintf(source, "var r = 0;\nr = ");
+    for (int t = 0; t < terms; t++) {
+        n += sprintf(source + n, "(%d - %d * %d) + ", t % 97, t % 7, t % 5);
+    }
+    for (int d = 0; d < depth; d++) source[n++] = '(';
+    source[n++] = '1';
+    for (int d = 0; d < depth; d++) source[n++] = ')';
+    n += sprintf(source + n, ";\nprint(r);\n");
+    return source;
+}
+
+// Pass stress: one left-nested chain of `terms` additions, which every pass
+// after the parser has to walk without recursing once per term
+char* generate_chain(int terms) {
+    char* source = malloc(64 + terms * 4);
+    int n = sprintf(source, "var x = 1;\nvar r = x");
+    for (int t = 1; t < terms; t++) n += sprintf(source + n, " + x");
+    n += sprintf(source + n, ";\nprint(r);\n");
+    return source;
+}
+
+// List stress: calls to print with `args` arguments each
+char* generate_wide_calls(int calls, int args) {
+    char* source = malloc(64 + calls * (16 + args * 8));
+    int n = sprintf(source, "var a = 1;\n");
+    for (int c = 0; c < calls; c++) {
+        n += sprintf(source + n, "print(");
+        for (int i = 0; i < args; i++) {
+            n += sprintf(source + n, i ? ", a + %d" : "a + %d", (c + i) % 100);
+        }
+        n += sprintf(source + n, ");\n");
+    }
+    return source;
+}
+
+unsigned long long count_nodes(ASTNode* node) {
+    if (!node) return 0;
+    unsigned long long n = 1;
+    // Down a left-nested chain without recursing, like the compiler passes
+    while (node->type == AST_BINARY_OP) {
+        n += 1 + count_nodes(node->binary.right);
+        node = node->binary.left;
+    }
+    switch (node->type) {
+        case AST_ASSIGNMENT:
+            return n + count_nodes(node->assignment.value);
+        case AST_IF:
+            return n + count_nodes(node->if_stmt.condition) + count_nodes(node->if_stmt.then_branch) +
+                   count_nodes(node->if_stmt.else_branch);
+        case AST_WHILE:
+            return n + count_nodes(node->while_stmt.condition) + count_nodes(node->while_stmt.body);
+        case AST_FUNCTION_DEF:
+            return n + count_nodes(node->function_def.body);
+        case AST_FUNCTION_CALL:
+            for (int i = 0; i < node->function_call.arg_count; i++) n += count_nodes(node->function_call.args[i]);
+            return n;
+        case AST_BLOCK:
+            for (int i = 0; i < node->block.count; i++) n += count_nodes(node->block.statements[i]);
+            return n;
+        case AST_RETURN:
+            return n + count_nodes(node->return_stmt.value);
+        case AST_ARRAY:
+            for (int i = 0; i < node->array.count; i++) n += count_nodes(node->array.elements[i]);
+            return n;
+        case AST_INDEX:
+        case AST_INDEX_ASSIGNMENT:
+            return n + count_nodes(node->index.array) + count_nodes(node->index.index) + count_nodes(node->index.value);
+        default:
+            return n;
+    }
+}
+
+// The program's own print() output would swamp the report
+int silence_stdout() {
+    fflush(stdout);
+#ifndef _WIN32
+    int saved = dup(1);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, 1);
+    close(null_fd);
+    return saved;
+#else
+    return -1;
+#endif
+}
+
+#ifndef _WIN32
+// Sends stdout to file instead, for comparing the output of two runs
+int capture_stdout(FILE* file) {
+    fflush(stdout);
+    int saved = dup(1);
+    dup2(fileno(file), 1);
+    return saved;
+}
+
+int same_contents(FILE* a, FILE* b) {
+    rewind(a);
+    rewind(b);
+    int ca, cb;
+    do {
+        ca = fgetc(a);
+        cb = fgetc(b);
+    } while (ca == cb && ca != EOF);
+    return ca == cb;
+}
+#endif
+
+void restore_stdout(int saved) {
+    fflush(stdout);
+#ifndef _WIN32
+    dup2(saved, 1);
+    close(saved);
+#endif
+}
+
+void record(PhaseResult* result, double seconds, unsigned long long items) {
+    if (result->seconds == 0 || seconds < result->seconds) result->seconds = seconds;
+    result->items = items;
+}
+
+int use_stream = 0;
+
+typedef Token (*Scanner)(Lexer* lx);
+
+int scan_all(Scanner scan, const char* source) {
+    Lexer lx;
+    init_lexer(&lx, source);
+    int count = 0;
+    while (scan(&lx).type != TOKEN_EOF) count++;
+    return count;
+}
+
+// Runs both scanners in lockstep and reports the first token they disagree on
+int scanners_agree(const char* name, const char* source) {
+    Lexer a, b;
+    init_lexer(&a, source);
+    init_lexer(&b, source);
+    for (int i = 0;; i++) {
+        Token x = scan_token_reference(&a);
+        Token y = scan_token(&b);
+        if (x.type != y.type || x.op != y.op || x.start != y.start || x.length != y.length ||
+            x.line != y.line || x.column != y.column) {
+            printf("BENCH ERROR: %s: scanners disagree at token %d (line %u, column %u)\n",
+                   name, i, x.line, x.column);
+            return 0;
+        }
+        if (x.type == TOKEN_EOF) return 1;
+    }
+}
+
+const char* simd_name() {
+#if defined(__AVX2__)
+    return "AVX2";
+#elif defined(__SSE2__)
+    return "SSE2";
+#else
+    return "none";
+#endif
+}
+
+void bench_lexers(const char* name, const char* source, int runs, FILE* out, long timestamp) {
+    if (!scanners_agree(name, source)) exit(1);
+    Scanner scanners[] = {scan_token_reference, scan_token};
+    const char* scanner_names[] = {"lex_reference", "lex_table"};
+    // Scan at least 8 MB per timing so small workloads still measure something
+    size_t bytes = strlen(source);
+    int repeat = bytes > 0 ? (int)((8u << 20) / bytes) + 1 : 1;
+
+    printf("%-14s %zu bytes\n", name, bytes);
+    for (int s = 0; s < 2; s++) {
+        double best = 0;
+        for (int r = 0; r < runs; r++) {
+            double start = now_seconds();
+            for (int k = 0; k < repeat; k++) scan_all(scanners[s], source);
+            double elapsed = now_seconds() - start;
+            if (best == 0 || elapsed < best) best = elapsed;
+        }
+        unsigned long long total = (unsigned long long)bytes * repeat;
+        double rate = best > 0 ? total / best : 0;
+        printf("  %-14s %10.6f s  %12llu bytes  %8.1f MB/s\n", scanner_names[s], best, total, rate / 1e6);
+        fprintf(out, "%ld,%s,%s,%d,%.9f,%llu,%s,%.1f,%ld\n", timestamp, name, scanner_names[s], runs,
+                best, total, "bytes", rate, peak_memory_kb());
+    }
+}
+
+// Compiles source with the same passes as the interpreter's defaults
+void compile_source(const char* source, Chunk* chunk) {
+    IRBuffer ir;
+    tokenize(source);
+    ASTNode* program = parse_program();
+    init_ir(&ir);
+    resolve_symbols(program);
+    fold_program(program);
+    emit_program(program, &ir);
+    peephole_optimize(&ir);
+    link_program(&ir);
+    assemble_program(&ir, chunk);
+    release_ast();
+    free(ir.code);
+}
+
+// Cold startup (hash the source, compile it) against a cached one (hash the
+// source, map the image the cold run wrote), and checks both give the same code
+void bench_cache(const char* name, const char* source, int runs, FILE* out, long timestamp) {
+    const char* path = "bench_cache.pgc";
+    const char* mode_names[] = {"compile", "cache_load"};
+    uint32_t options = CACHE_PEEPHOLE | CACHE_FOLD | CACHE_CFG;
+    size_t bytes = strlen(source);
+    double best[2] = {0, 0};
+
+    for (int r = 0; r < runs; r++) {
+        Chunk compiled, loaded;
+        double start = now_seconds();
+        uint64_t hash = hash_source(source, bytes);
+        compile_source(source, &compiled);
+        double elapsed = now_seconds() - start;
+        if (best[0] == 0 || elapsed < best[0]) best[0] = elapsed;
+        save_cached_chunk(path, hash, options, &compiled);
+
+        start = now_seconds();
+        int hit = load_cached_chunk(path, hash_source(source, bytes), options, &loaded);
+        elapsed = now_seconds() - start;
+        if (best[1] == 0 || elapsed < best[1]) best[1] = elapsed;
+        if (!hit || loaded.count != compiled.count || memcmp(loaded.code, compiled.code, compiled.count) != 0
+            || loaded.constants.count != compiled.constants.count || loaded.function_count != compiled.function_count) {
+            printf("BENCH ERROR: %s: cached bytecode differs from the compiled code\n", name);
+            exit(1);
+        }
+        free_chunk(&compiled);
+        free_chunk(&loaded);
+    }
+    remove(path);
+
+    printf("%-14s %zu bytes\n", name, bytes);
+    for (int m = 0; m < 2; m++) {
+        double rate = best[m] > 0 ? bytes / best[m] : 0;
+        printf("  %-14s %10.6f s  %12zu bytes  %8.1f MB/s\n", mode_names[m], best[m], bytes, rate / 1e6);
+        fprintf(out, "%ld,%s,%s,%d,%.9f,%zu,%s,%.1f,%ld\n", timestamp, name, mode_names[m], runs,
+                best[m], bytes, "bytes", rate, peak_memory_kb());
+    }
+}
+
+#ifdef PENGUIN_JIT
+// Runs each workload in the interpreter and again with the JIT, and fails
+// unless both print exactly the same output
+void bench_jit(const char* name, const char* source, int runs, FILE* out, long timestamp) {
+    const char* mode_names[] = {"interpret", "jit"};
+    double best[2] = {0, 0};
+    Chunk chunk;
+    compile_source(source, &chunk);
+    for (int r = 0; r < runs; r++) {
+        FILE* outputs[2];
+        for (int m = 0; m < 2; m++) {
+            outputs[m] = tmpfile();
+            int saved = capture_stdout(outputs[m]);
+            use_jit = m;
+            reset_vm();
+            double start = now_seconds();
+            run_vm(&chunk);
+            double elapsed = now_seconds() - start;
+            restore_stdout(saved);
+            if (best[m] == 0 || elapsed < best[m]) best[m] = elapsed;
+        }
+        use_jit = 0;
+        int same = same_contents(outputs[0], outputs[1]);
+        fclose(outputs[0]);
+        fclose(outputs[1]);
+        if (!same) {
+            printf("BENCH ERROR: %s: JIT output differs from the interpreter\n", name);
+            exit(1);
+        }
+    }
+    free_chunk(&chunk);
+
+    printf("%-14s output matches, %d loops compiled, %llu native entries\n", name, jit_loops_compiled, jit_entries);
+    for (int m = 0; m < 2; m++) {
+        printf("  %-14s %10.6f s  %6.2fx\n", mode_names[m], best[m], best[m] > 0 ? best[0] / best[m] : 0);
+        fprintf(out, "%ld,%s,%s,%d,%.9f,%d,%s,%.1f,%ld\n", timestamp, name, mode_names[m], runs,
+                best[m], 1, "runs", best[m] > 0 ? 1 / best[m] : 0, peak_memory_kb());
+    }
+}
+#endif
+
+#ifndef _WIN32
+// Builds the workload with the C backend, runs the binary and the VM, and
+// fails unless both print exactly the same output
+void bench_aot(const char* name, const char* source, int runs, FILE* out, long timestamp) {
+    const char* exe = "./bench_aot";
+    const char* mode_names[] = {"gcc_build", "vm", "aot"};
+    double best[3] = {0, 0, 0};
+
+    tokenize(source);
+    ASTNode* program = parse_program();
+    resolve_symbols(program);
+    fold_program(program);
+    double start = now_seconds();
+    int saved = silence_stdout();
+    int status = build_native(program, exe);
+    restore_stdout(saved);
+    best[0] = now_seconds() - start;
+    release_ast();
+    if (status != 0) {
+        printf("BENCH ERROR: %s: the C backend could not build it\n", name);
+        exit(1);
+    }
+    Chunk chunk;
+    compile_source(source, &chunk);
+
+    for (int r = 0; r < runs; r++) {
+        FILE* outputs[2] = {tmpfile(), tmpfile()};
+        saved = capture_stdout(outputs[0]);
+        reset_vm();
+        start = now_seconds();
+        run_vm(&chunk);
+        double elapsed = now_seconds() - start;
+        restore_stdout(saved);
+        if (best[1] == 0 || elapsed < best[1]) best[1] = elapsed;
+
+        fflush(stdout);
+        start = now_seconds();
+        pid_t pid = fork();
+        if (pid == 0) {
+            dup2(fileno(outputs[1]), 1);
+            execl(exe, exe, (char*)NULL);
+            _exit(127);
+        }
+        waitpid(pid, &status, 0);
+        elapsed = now_seconds() - start;
+        if (best[2] == 0 || elapsed < best[2]) best[2] = elapsed;
+
+        int same = same_contents(outputs[0], outputs[1]);
+        fclose(outputs[0]);
+        fclose(outputs[1]);
+        if (!same) {
+            printf("BENCH ERROR: %s: the native binary's output differs from the VM\n", name);
+            exit(1);
+        }
+    }
+    free_chunk(&chunk);
+    remove(exe);
+    remove("./bench_aot.c");
+
+    printf("%-14s output matches\n", name);
+    for (int m = 0; m < 3; m++) {
+        printf("  %-14s %10.6f s\n", mode_names[m], best[m]);
+        fprintf(out, "%ld,%s,%s,%d,%.9f,%d,%s,%.1f,%ld\n", timestamp, name, mode_names[m], m == 0 ? 1 : runs,
+                best[m], 1, "runs", best[m] > 0 ? 1 / best[m] : 0, peak_memory_kb());
+    }
+}
+#endif
+
+// Random programs for --cfg-fuzz. The last two names in each variable list,
+// k and z (zero), are read but never assigned, so loops see invariant
+// operands. Loops run 0 to 11 times, so hoisted code that can fail is
+// exercised on loops that never enter; f() has a side effect, so calls must
+// not be hoisted or dropped.
+typedef struct {
+    char* text;
+    size_t used;
+    size_t capacity;
+} FuzzProgram;
+
+uint64_t fuzz_state;
+
+int fuzz_pick(int n) {
+    fuzz_state ^= fuzz_state << 13;
+    fuzz_state ^= fuzz_state >> 7;
+    fuzz_state ^= fuzz_state << 17;
+    return (int)(fuzz_state % (uint64_t)n);
+}
+
+void fuzz_emit(FuzzProgram* p, const char* format, ...) {
+    va_list args;
+    for (;;) {
+        va_start(args, format);
+        int n = vsnprintf(p->text + p->used, p->capacity - p->used, format, args);
+        va_end(args);
+        if (p->used + n < p->capacity) {
+            p->used += n;
+            return;
+        }
+        p->capacity = p->capacity * 2 + n;
+        p->text = realloc(p->text, p->capacity);
+    }
+}
+
+void fuzz_expression(FuzzProgram* p, const char** vars, int var_count, int depth) {
+    int r = fuzz_pick(10);
+    if (depth > 2 || r < 4) {
+        if (r % 2 == 0) {
+            fuzz_emit(p, "%s", vars[fuzz_pick(var_count)]);
+        } else {
+            fuzz_emit(p, "%d", fuzz_pick(13) - 3);
+        }
+        return;
+    }
+    // A call makes LICM treat every global as assigned, so they stay rare
+    if (r == 9 && depth == 0) {
+        fuzz_emit(p, "f(");
+        fuzz_expression(p, vars, var_count, depth + 1);
+        fuzz_emit(p, ")");
+        return;
+    }
+    const char* ops = "+-*+-*/";
+    char op = ops[fuzz_pick(7)];
+    fuzz_emit(p, "(");
+    fuzz_expression(p, vars, var_count, depth + 1);
+    // Mostly constant divisors, so only some programs stop on a zero. The
+    // rest divide by a variable, which fold_program() cannot reject.
+    if (op == '/') {
+        if (fuzz_pick(4) > 0) {
+            fuzz_emit(p, " / %d)", fuzz_pick(2) ? 3 : -2);
+        } else {
+            fuzz_emit(p, " / %s)", vars[fuzz_pick(var_count)]);
+        }
+        return;
+    }
+    fuzz_emit(p, " %c ", op);
+    fuzz_expression(p, vars, var_count, depth + 1);
+    fuzz_emit(p, ")");
+}
+
+void fuzz_condition(FuzzProgram* p, const char** vars, int var_count) {
+    const char* compares[] = {"<", "==", "!=", ">="};
+    fuzz_expression(p, vars, var_count, 1);
+    fuzz_emit(p, " %s ", compares[fuzz_pick(4)]);
+    fuzz_expression(p, vars, var_count, 1);
+}
+
+void fuzz_block(FuzzProgram* p, const char** vars, int var_count, int depth) {
+    int statements = 1 + fuzz_pick(4);
+    for (int s = 0; s < statements; s++) {
+        const char* v = vars[fuzz_pick(var_count - 2)];
+        const char* w = vars[fuzz_pick(var_count)];
+        switch (depth > 2 ? fuzz_pick(5) : fuzz_pick(8)) {
+            case 0:
+            case 1:
+                fuzz_emit(p, "%s = ", v);
+                fuzz_expression(p, vars, var_count, 0);
+                fuzz_emit(p, ";\n");
+                break;
+            case 2:
+                // Overwritten before it is read
+                fuzz_emit(p, "%s = ", v);
+                fuzz_expression(p, vars, var_count, 0);
+                fuzz_emit(p, "; %s = ", v);
+                fuzz_expression(p, vars, var_count, 0);
+                fuzz_emit(p, ";\n");
+                break;
+            case 3:
+                // A copy read before and after its source changes
+                fuzz_emit(p, "%s = %s; print(%s + ", v, w, v);
+                fuzz_expression(p, vars, var_count, 1);
+                fuzz_emit(p, ");\n");
+                break;
+            case 4:
+                fuzz_emit(p, "print(");
+                fuzz_expression(p, vars, var_count, 0);
+                fuzz_emit(p, ");\n");
+                break;
+            case 5:
+                fuzz_emit(p, "if (");
+                fuzz_condition(p, vars, var_count);
+                fuzz_emit(p, ") {\n");
+                fuzz_block(p, vars, var_count, depth + 1);
+                fuzz_emit(p, "} else {\n");
+                fuzz_block(p, vars, var_count, depth + 1);
+                fuzz_emit(p, "}\n");
+                break;
+            default:
+                // The counter is never assigned by the body, so every loop ends
+                fuzz_emit(p, "i%d = 0;\nwhile (i%d < %d) {\n", depth, depth, fuzz_pick(12));
+                fuzz_block(p, vars, var_count, depth + 1);
+                fuzz_emit(p, "i%d = i%d + 1;\n}\n", depth, depth);
+                break;
+        }
+    }
+}
+
+void generate_fuzz_program(FuzzProgram* p, uint64_t seed) {
+    const char* globals[] = {"a", "b", "c", "d", "k", "z"};
+    const char* locals[] = {"p", "q", "t", "k", "z"};
+    fuzz_state = seed * 0x9E3779B97F4A7C15ull + 1;
+    p->used = 0;
+    fuzz_emit(p, "var a = 1; var b = 2; var c = 3; var d = 0; var g = 0; var k = 5; var z = 0;\n");
+    fuzz_emit(p, "var i0 = 0; var i1 = 0; var i2 = 0; var i3 = 0;\n");
+    fuzz_emit(p, "func f(x) { g = g + 1; return x; }\n");
+    fuzz_emit(p, "func h(p, q) {\nvar t = 0;\n");
+    fuzz_block(p, locals, 5, 1);
+    fuzz_emit(p, "return t;\n}\n");
+    fuzz_block(p, globals, 6, 0);
+    fuzz_emit(p, "print(h(a, b));\nprint(a, b, c, d, g);\n");
+}
+
+#ifndef _WIN32
+// Runs chunk in a child so a VM ERROR ends only that run; the error message
+// lands in output along with everything the program printed before it
+int run_in_child(Chunk* chunk, FILE* output) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fileno(output), 1);
+        reset_vm();
+        run_vm(chunk);
+        fflush(stdout);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return status;
+}
+
+// Scripts every backend must refuse to compile, with the error they expect
+typedef struct {
+    const char* name;
+    const char* source;
+    const char* error;
+} RejectedProgram;
+
+RejectedProgram rejected_programs[] = {
+    {"func_in_if", "if (1) {\nfunc f() { return 3; }\n}\nprint(f());\n",
+     "COMPILER ERROR: Function 'f' must be defined at top level"},
+    {"func_in_while", "var i = 0;\nwhile (i < 1) {\nfunc f() { return 3; }\ni = i + 1;\n}\nprint(f());\n",
+     "COMPILER ERROR: Function 'f' must be defined at top level"},
+    {"func_in_func", "func g() {\nfunc f() { return 3; }\nreturn f();\n}\nprint(g());\n",
+     "COMPILER ERROR: Function 'f' must be defined at top level"},
+};
+
+// Compiles and runs source with the stack VM, the register VM or the C
+// backend (0, 1, 2) in a child, collecting everything it prints in output
+int compile_in_child(const char* source, int backend, FILE* output) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fileno(output), 1);
+        if (backend == 0) {
+            Chunk chunk;
+            compile_source(source, &chunk);
+            reset_vm();
+            run_vm(&chunk);
+        } else {
+            tokenize(source);
+            ASTNode* program = parse_program();
+            resolve_symbols(program);
+            fold_program(program);
+            if (backend == 1) {
+                RegChunk chunk;
+                compile_register(program, &chunk);
+                run_regvm(&chunk);
+            } else if (build_native(program, "./bench_rejected") == 0) {
+                remove("./bench_rejected");
+                remove("./bench_rejected.c");
+            }
+        }
+        fflush(stdout);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return status;
+}
+
+// Fails unless every backend stops each rejected program with its error
+void check_rejected_programs() {
+    const char* backend_names[] = {"stack VM", "register VM", "C backend"};
+    int count = sizeof(rejected_programs) / sizeof(rejected_programs[0]);
+    for (int i = 0; i < count; i++) {
+        RejectedProgram* r = &rejected_programs[i];
+        for (int backend = 0; backend < 3; backend++) {
+            FILE* output = tmpfile();
+            int status = compile_in_child(r->source, backend, output);
+            char text[1024];
+            rewind(output);
+            size_t n = fread(text, 1, sizeof(text) - 1, output);
+            text[n] = '\0';
+            fclose(output);
+            if (WEXITSTATUS(status) != 1 || !strstr(text, r->error)) {
+                printf("BENCH ERROR: %s: the %s did not report \"%s\"\n", r->name, backend_names[backend], r->error);
+                exit(1);
+            }
+        }
+    }
+    printf("%d rejected programs refused by every backend\n", count);
+}
+
+// Compiles each generated program with the cfg passes on and off, runs both
+// and fails on the first whose output or exit status differs. The failing
+// program is left in cfg_fuzz_failure.pg.
+void fuzz_cfg(int programs, FILE* out, long timestamp) {
+    FuzzProgram program = {malloc(4096), 0, 4096};
+    int totals[CFG_STAT_COUNT] = {0};
+    int failures = 0;
+    double start = now_seconds();
+
+    for (int seed = 1; seed <= programs; seed++) {
+        generate_fuzz_program(&program, seed);
+        Chunk chunks[2];
+        FILE* outputs[2];
+        int status[2];
+        for (int m = 0; m < 2; m++) {
+            use_cfg = m;
+            compile_source(program.text, &chunks[m]);
+            outputs[m] = tmpfile();
+            status[m] = run_in_child(&chunks[m], outputs[m]);
+            free_chunk(&chunks[m]);
+        }
+        for (int i = 0; i < CFG_STAT_COUNT; i++) totals[i] += cfg_stats[i];
+        if (WEXITSTATUS(status[0]) == 1) failures++;
+        int same = status[0] == status[1] && same_contents(outputs[0], outputs[1]);
+        fclose(outputs[0]);
+        fclose(outputs[1]);
+        if (!same) {
+            FILE* file = fopen("cfg_fuzz_failure.pg", "w");
+            if (file) {
+                fputs(program.text, file);
+                fclose(file);
+            }
+            printf("BENCH ERROR: seed %d: output differs with the cfg passes on, see cfg_fuzz_failure.pg\n", seed);
+            exit(1);
+        }
+    }
+    use_cfg = 1;
+    double elapsed = now_seconds() - start;
+    free(program.text);
+
+    printf("%d programs match, %d stopped on a VM ERROR in both\n", programs, failures);
+    for (int i = 0; i < CFG_STAT_COUNT; i++) printf("  %-22s %d\n", cfg_stat_names[i], totals[i]);
+    fprintf(out, "%ld,%s,%s,%d,%.9f,%d,%s,%.1f,%ld\n", timestamp, "cfg_fuzz", "differential", 1,
+            elapsed, programs, "programs", elapsed > 0 ? programs / elapsed : 0, peak_memory_kb());
+}
+#endif
+
+// State handed from one pipeline phase to the next
+typedef struct {
+    const char* source;
+    ASTNode* program;
+    IRBuffer ir;
+    Chunk chunk;
+    unsigned long long items;   // what the phase processed, in phase_units
+} Pipeline;
+
+void phase_tokenize(Pipeline* p) {
+    if (use_stream) {
+        begin_token_stream(p->source);
+        p->items = 0;
+    } else {
+        tokenize(p->source);
+        p->items = token_count;
+    }
+}
+
+void phase_parse(Pipeline* p) {
+    p->program = parse_program();
+}
+
+void phase_emit(Pipeline* p) {
+    init_ir(&p->ir);
+    resolve_symbols(p->program);
+    fold_program(p->program);
+    emit_program(p->program, &p->ir);
+    peephole_optimize(&p->ir);
+    link_program(&p->ir);
+    assemble_program(&p->ir, &p->chunk);
+}
+
+void phase_run(Pipeline* p) {
+    reset_vm();
+    vm_op_count = 0;
+    run_vm(&p->chunk);
+    p->items = vm_op_count;
+}
+
+void (*phase_steps[])(Pipeline*) = {phase_tokenize, phase_parse, phase_emit, phase_run};
+
+// Peak resident memory while one phase runs, measured in a child forked
+// just before it. The child's high-water mark starts from what it inherits
+// (the earlier phases' live data), not from the parent's peak, so a large
+// phase no longer hides the ones after it.
+long phase_peak_kb(int phase, Pipeline* p) {
+#ifndef _WIN32
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (phase == PHASE_RUN) silence_stdout();
+        phase_steps[phase](p);
+        _exit(0);
+    }
+    struct rusage usage;
+    int status;
+    if (pid < 0 || wait4(pid, &status, 0, &usage) < 0) return -1;
+    return usage.ru_maxrss;
+#else
+    return -1;
+#endif
+}
+
+void bench_workload(const char* name, const char* source, int runs, FILE* out, long timestamp) {
+    PhaseResult results[PHASE_COUNT];
+    memset(results, 0, sizeof(results));
+
+    for (int r = 0; r < runs; r++) {
+        Pipeline p = {.source = source};
+        unsigned long long nodes = 0;
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            // Once per workload is enough; the child repeats the phase untimed
+            if (r == 0) results[phase].peak_kb = phase_peak_kb(phase, &p);
+            int saved = phase == PHASE_RUN ? silence_stdout() : -1;
+            double start = now_seconds();
+            phase_steps[phase](&p);
+            double elapsed = now_seconds() - start;
+            if (phase == PHASE_RUN) restore_stdout(saved);
+
+            if (phase == PHASE_PARSE) nodes = count_nodes(p.program);
+            if (phase == PHASE_EMIT) release_ast();
+            record(&results[phase], elapsed, phase == PHASE_PARSE || phase == PHASE_EMIT ? nodes : p.items);
+        }
+        free(p.ir.code);
+        free_chunk(&p.chunk);
+    }
+
+    printf("%-14s%s\n", name, use_stream ? " (streamed)" : "");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        PhaseResult* result = &results[p];
+        double rate = result->seconds > 0 ? result->items / result->seconds : 0;
+        printf("  %-14s %10.6f s  %12llu %-6s %12.3g %s/s  peak %ld KB\n", phase_names[p], result->seconds,
+               result->items, phase_units[p], rate, phase_units[p], result->peak_kb);
+        fprintf(out, "%ld,%s%s,%s,%d,%.9f,%llu,%s,%.1f,%ld\n", timestamp, name, use_stream ? "[stream]" : "",
+                phase_names[p], runs, result->seconds, result->items, phase_units[p], rate, result->peak_kb);
+    }
+}
+
+int main(int argc, char** argv) {
+    int runs = 3;
+    int use_lexer = 0;
+    int use_cache = 0;
+    int use_jit_check = 0;
+    int use_aot_check = 0;
+    int cfg_programs = 0;
+    const char* out_path = "bench_results.csv";
+    const char** workloads = default_workloads;
+    int workload_count = sizeof(default_workloads) / sizeof(default_workloads[0]);
+    const char** files = malloc(sizeof(char*) * argc);
+    int file_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stream") == 0) {
+            use_stream = 1;
+        } else if (strcmp(argv[i], "--lexer") == 0) {
+            use_lexer = 1;
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            use_cache = 1;
+#ifdef PENGUIN_JIT
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            use_jit_check = 1;
+#endif
+#ifndef _WIN32
+        } else if (strcmp(argv[i], "--aot") == 0) {
+            use_aot_check = 1;
+        } else if (strcmp(argv[i], "--cfg-fuzz") == 0) {
+            cfg_programs = 1000;
+        } else if (strncmp(argv[i], "--cfg-fuzz=", 11) == 0 && atoi(argv[i] + 11) > 0) {
+            cfg_programs = atoi(argv[i] + 11);
+#endif
+        } else if (strncmp(argv[i], "--out=", 6) == 0) {
+            out_path = argv[i] + 6;
+        } else if (strstr(argv[i], ".pg")) {
+            files[file_count++] = argv[i];
+        } else if (atoi(argv[i]) > 0) {
+            runs = atoi(argv[i]);
+        } else {
+            printf("Usage: %s [runs] [--stream|--lexer|--cache|--jit|--aot|--cfg-fuzz[=N]] [--out=results.csv] [workload.pg ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (file_count > 0) {
+        workloads = files;
+        workload_count = file_count;
+    }
+
+    // Appends, so one file accumulates the history of every run
+    FILE* probe = fopen(out_path, "r");
+    int new_file = probe == NULL;
+    if (probe) fclose(probe);
+    FILE* out = fopen(out_path, "a");
+    if (!out) {
+        printf("BENCH ERROR: Cannot open '%s' for writing\n", out_path);
+        return 1;
+    }
+    if (new_file) fprintf(out, "timestamp,workload,phase,runs,seconds,items,unit,items_per_second,peak_kb\n");
+    long timestamp = (long)time(NULL);
+
+#ifndef _WIN32
+    if (cfg_programs > 0) {
+        printf("=== CFG DIFFERENTIAL (%d programs) ===\n", cfg_programs);
+        check_rejected_programs();
+        fuzz_cfg(cfg_programs, out, timestamp);
+        fclose(out);
+        printf("\nresults appended to %s\n", out_path);
+        free(files);
+        return 0;
+    }
+#endif
+
+    // Both modes share the workload list and the results file
+    void (*bench)(const char*, const char*, int, FILE*, long) =
+        use_lexer ? bench_lexers : use_cache ? bench_cache : bench_workload;
+#ifdef PENGUIN_JIT
+    if (use_jit_check) bench = bench_jit;
+#endif
+#ifndef _WIN32
+    if (use_aot_check) bench = bench_aot;
+#endif
+    if (use_aot_check) {
+        printf("=== C BACKEND DIFFERENTIAL (best of %d runs) ===\n", runs);
+    } else if (use_jit_check) {
+        printf("=== JIT DIFFERENTIAL (best of %d runs) ===\n", runs);
+    } else if (use_lexer) {
+        printf("=== LEXER BENCHMARK (best of %d runs, SIMD: %s) ===\n", runs, simd_name());
+    } else if (use_cache) {
+        printf("=== CACHE BENCHMARK (best of %d runs) ===\n", runs);
+    } else {
+        printf("=== PIPELINE BENCHMARK (best of %d runs) ===\n", runs);
+    }
+#ifndef _WIN32
+    if (use_aot_check || use_jit_check) check_rejected_programs();
+#endif
+    for (int i = 0; i < workload_count; i++) {
+        Source source = load_source(workloads[i]);
+        bench(workloads[i], source.text, runs, out, timestamp);
+        release_source(&source);
+    }
+    if (file_count == 0 && !use_aot_check) {
+        char* source = generate_large_script(80, 99);
+        bench("generated", source, runs, out, timestamp);
+        free(source);
+        source = generate_large_script(2, 50000);
+        bench("generated_100k", source, runs, out, timestamp);
+        free(source);
+        source = generate_wide_calls(100, 1000);
+        bench("generated_calls", source, runs, out, timestamp);
+        free(source);
+        source = generate_long_expression(30000, 10000);
+        bench("generated_expr", source, runs, out, timestamp);
+        free(source);
+        source = generate_chain(300000);
+        bench("generated_chain", source, runs, out, timestamp);
+        free(source);
+    }
+
+    fclose(out);
+    printf("\nresults appended to %s\n", out_path);
+    free(files);
+    return 0;
+}
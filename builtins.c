@@ -0,0 +1,167 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Builtin functions. Adding one is an entry in builtins[]: the compilers
+// resolve call sites to an index into the table and check the argument
+// count against it, so the engines call through the index without any
+// name lookup or arity check at run time.
+
+// Prints its arguments separated by spaces, then a newline
+Value builtin_print(Value* args, int arg_count) {
+    for (int i = 0; i < arg_count; i++) {
+        if (i > 0) output_char(' ');
+        print_value(args[i]);
+    }
+    output_char('\n');
+    return VAL_NIL;
+}
+
+// Array builtins. The bulk ones run the vector kernels in array.c; add and
+// mul update their first argument in place and return it.
+
+Array* array_arg(const char* name, Value v) {
+    if (!is_array(v)) {
+        flush_output();
+        printf("VM ERROR: '%s' expects an array, got %s\n", name, value_type_name(v));
+        exit(1);
+    }
+    return as_array(v);
+}
+
+int64_t int_arg(const char* name, Value v) {
+    if (!is_int(v)) {
+        flush_output();
+        printf("VM ERROR: '%s' expects an int, got %s\n", name, value_type_name(v));
+        exit(1);
+    }
+    return as_int(v);
+}
+
+void check_same_length(const char* name, Array* a, Array* b) {
+    if (a->length != b->length) {
+        flush_output();
+        printf("VM ERROR: '%s' needs arrays of the same length, got %lld and %lld\n", name, (long long)a->length,
+               (long long)b->length);
+        exit(1);
+    }
+}
+
+// array(n): n zeros
+Value builtin_array(Value* args, int arg_count) {
+    (void)arg_count;
+    return make_array(new_array(int_arg("array", args[0])));
+}
+
+Value builtin_len(Value* args, int arg_count) {
+    (void)arg_count;
+    if (is_text(args[0])) return make_int(text_length(args[0]));
+    return make_int(array_arg("len", args[0])->length);
+}
+
+Value builtin_sum(Value* args, int arg_count) {
+    (void)arg_count;
+    return make_int(array_sum(array_arg("sum", args[0])));
+}
+
+Value extreme(const char* name, Value v, int want_max) {
+    Array* a = array_arg(name, v);
+    if (a->length == 0) {
+        flush_output();
+        printf("VM ERROR: '%s' of an empty array\n", name);
+        exit(1);
+    }
+    return make_int(array_extreme(a, want_max));
+}
+
+Value builtin_min(Value* args, int arg_count) {
+    (void)arg_count;
+    return extreme("min", args[0], 0);
+}
+
+Value builtin_max(Value* args, int arg_count) {
+    (void)arg_count;
+    return extreme("max", args[0], 1);
+}
+
+// fill(a, v): sets every element to v and returns a
+Value builtin_fill(Value* args, int arg_count) {
+    (void)arg_count;
+    array_fill(array_arg("fill", args[0]), element_int(args[1]));
+    return args[0];
+}
+
+Value builtin_dot(Value* args, int arg_count) {
+    (void)arg_count;
+    Array* a = array_arg("dot", args[0]);
+    Array* b = array_arg("dot", args[1]);
+    check_same_length("dot", a, b);
+    return make_int(array_dot(a, b));
+}
+
+// a op b element-wise into a, where b is an array of the same length or an int
+Value combine(const char* name, Value* args, char op) {
+    Array* a = array_arg(name, args[0]);
+    if (is_int(args[1])) {
+        array_combine(a, NULL, as_int(args[1]), op);
+    } else {
+        Array* b = array_arg(name, args[1]);
+        check_same_length(name, a, b);
+        array_combine(a, b->items, 0, op);
+    }
+    return args[0];
+}
+
+Value builtin_add(Value* args, int arg_count) {
+    (void)arg_count;
+    return combine("add", args, '+');
+}
+
+Value builtin_mul(Value* args, int arg_count) {
+    (void)arg_count;
+    return combine("mul", args, '*');
+}
+
+Builtin builtins[] = {
+    // name     min  max (-1: any number)
+    {"print",   0,   -1,  builtin_print},
+    {"array",   1,   1,   builtin_array},
+    {"len",     1,   1,   builtin_len},
+    {"sum",     1,   1,   builtin_sum},
+    {"min",     1,   1,   builtin_min},
+    {"max",     1,   1,   builtin_max},
+    {"fill",    2,   2,   builtin_fill},
+    {"dot",     2,   2,   builtin_dot},
+    {"add",     2,   2,   builtin_add},
+    {"mul",     2,   2,   builtin_mul},
+    {NULL,      0,   0,   NULL},
+};
+
+// Index of the builtin called name, or -1
+int find_builtin(const char* name) {
+    for (int i = 0; builtins[i].name; i++) {
+        if (strcmp(builtins[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+// Resolves a call site: the builtin's index, or -1 when name is not a
+// builtin. A call with the wrong number of arguments is a compile error.
+int resolve_builtin(const char* name, int arg_count) {
+    int index = find_builtin(name);
+    if (index < 0) return -1;
+    Builtin* b = &builtins[index];
+    if (arg_count < b->min_args || (b->max_args >= 0 && arg_count > b->max_args)) {
+        if (b->max_args < 0) {
+            printf("COMPILER ERROR: '%s' takes at least %d arguments, got %d\n", name, b->min_args, arg_count);
+        } else if (b->min_args == b->max_args) {
+            printf("COMPILER ERROR: '%s' takes %d arguments, got %d\n", name, b->min_args, arg_count);
+        } else {
+            printf("COMPILER ERROR: '%s' takes %d to %d arguments, got %d\n", name, b->min_args, b->max_args,
+                   arg_count);
+        }
+        exit(1);
+    }
+    return index;
+}
@@ -0,0 +1,501 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Serialized bytecode, cached next to the script as <script>c (loop.pg ->
+// loop.pgc). The image is a header followed by 8-aligned sections:
+//
+//   constants   ConstantRecord per constant
+//   functions   FunctionRecord per function
+//   slots       SlotRecord per global slot, for diagnostics and print_asm
+//   code        the assembled bytes, executed straight from the mapping
+//   lines       the LineInfo table, also used in place
+//   strings     NUL-terminated constant, function and slot names
+//
+// An image is only used when its magic, version, byte order, compiler
+// options and source hash all match, and its code passes verify_code();
+// anything else is recompiled and rewritten. Constants and function names
+// are pointers at run time, so those two small tables are rebuilt on load;
+// code and lines are not copied.
+
+#define BYTECODE_MAGIC "PGNBC\r\n\032"
+#define BYTE_ORDER_MARK 0x01020304u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t source_hash;
+    uint32_t options;
+    uint32_t constant_count;
+    uint32_t function_count;
+    uint32_t code_size;
+    uint32_t line_count;
+    uint32_t strings_size;
+    uint32_t constants_offset;
+    uint32_t functions_offset;
+    uint32_t code_offset;
+    uint32_t lines_offset;
+    uint32_t strings_offset;
+    uint32_t image_size;
+    uint32_t slot_count;
+    uint32_t slots_offset;
+} BytecodeHeader;
+
+typedef struct {
+    uint32_t type;         // 'i' or 's'
+    uint32_t string;       // offset into the strings section
+    uint32_t length;
+    uint32_t reserved;
+    int64_t int_value;
+} ConstantRecord;
+
+typedef struct {
+    uint32_t name;         // offset into the strings section
+    uint32_t name_length;
+    int32_t entry;
+    int32_t param_count;
+    int32_t local_count;
+} FunctionRecord;
+
+typedef struct {
+    uint32_t name;         // offset into the strings section
+    uint32_t name_length;
+} SlotRecord;
+
+// Word-at-a-time hash of the script text; it runs on every startup, so it
+// has to be much cheaper than lexing the same bytes
+uint64_t hash_source(const char* text, size_t size) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, text + i, 8);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, text + i, size - i);
+    h = (h ^ tail) * 0xC4CEB9FE1A85EC53ull;
+    return h ^ (h >> 29);
+}
+
+char* cache_path(const char* script_path) {
+    size_t length = strlen(script_path);
+    char* path = malloc(length + 2);
+    memcpy(path, script_path, length);
+    path[length] = 'c';
+    path[length + 1] = '\0';
+    return path;
+}
+
+uint32_t align8(uint32_t offset) {
+    return (offset + 7) & ~7u;
+}
+
+#ifndef _WIN32
+
+// Whether count records of size bytes at offset lie inside the image
+int section_fits(BytecodeHeader* h, uint32_t offset, uint32_t count, uint32_t size) {
+    return offset % 8 == 0 && offset <= h->image_size && count <= (h->image_size - offset) / size;
+}
+
+int string_fits(BytecodeHeader* h, const char* strings, uint32_t offset, uint32_t length) {
+    return offset < h->strings_size && length < h->strings_size - offset && strings[offset + length] == '\0';
+}
+
+// Operands popped and pushed by op, whose operands start at operand
+int stack_effect(Chunk* chunk, Opcode op, const uint8_t* operand, int* pops, int* pushes) {
+    *pops = 0;
+    *pushes = 0;
+    switch (op) {
+        case OP_LOAD_CONST: case OP_PUSH: case OP_LOAD_SLOT: case OP_LOAD_LOCAL:
+        case OP_LOAD_SLOT_ADD_CONST: case OP_LOAD_SLOT_SUB_CONST:
+        case OP_LOAD_LOCAL_ADD_CONST: case OP_LOAD_LOCAL_SUB_CONST:
+            *pushes = 1;
+            return 1;
+        case OP_LOAD_SLOT_CONST: case OP_LOAD_LOCAL_CONST:
+            *pushes = 2;
+            return 1;
+        case OP_POP: case OP_STORE_SLOT: case OP_STORE_LOCAL: case OP_JMP_IF_FALSE:
+        case OP_PRINT: case OP_RET:
+            *pops = 1;
+            return 1;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_INDEX:
+        case OP_EQ: case OP_NEQ: case OP_GT: case OP_LT: case OP_GTE: case OP_LTE:
+            *pops = 2;
+            *pushes = 1;
+            return 1;
+        case OP_JMP_IF_NOT_EQ: case OP_JMP_IF_NOT_NEQ: case OP_JMP_IF_NOT_GT:
+        case OP_JMP_IF_NOT_LT: case OP_JMP_IF_NOT_GTE: case OP_JMP_IF_NOT_LTE:
+            *pops = 2;
+            return 1;
+        case OP_STORE_INDEX:
+            *pops = 3;
+            return 1;
+        case OP_JMP: case OP_HALT:
+        case OP_ADD_SLOT_CONST: case OP_SUB_SLOT_CONST:
+        case OP_ADD_LOCAL_CONST: case OP_SUB_LOCAL_CONST:
+            return 1;
+        case OP_CALL:
+            *pops = chunk->functions[read_u16(operand)].param_count;
+            *pushes = 1;
+            return 1;
+        case OP_CALL_NATIVE: case OP_CALL_BUILTIN:
+            *pops = read_u16(operand + 2);
+            *pushes = 1;
+            return 1;
+        case OP_ARRAY:
+            *pops = read_u16(operand);
+            *pushes = 1;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Checks one instruction's operands against the tables they index. locals
+// is the enclosing function's local count, 0 for top-level code.
+int operands_valid(Chunk* chunk, Opcode op, const uint8_t* operand, int locals) {
+    int constants = chunk->constants.count;
+    switch (op) {
+        case OP_LOAD_CONST:
+            return read_u16(operand) < constants;
+        case OP_LOAD_SLOT: case OP_STORE_SLOT:
+            return read_u16(operand) < slot_count;
+        case OP_LOAD_LOCAL: case OP_STORE_LOCAL:
+            return read_u16(operand) < locals;
+        case OP_ADD_SLOT_CONST: case OP_SUB_SLOT_CONST: case OP_LOAD_SLOT_ADD_CONST:
+        case OP_LOAD_SLOT_SUB_CONST: case OP_LOAD_SLOT_CONST:
+            return read_u16(operand) < slot_count && read_u16(operand + 2) < constants;
+        case OP_ADD_LOCAL_CONST: case OP_SUB_LOCAL_CONST: case OP_LOAD_LOCAL_ADD_CONST:
+        case OP_LOAD_LOCAL_SUB_CONST: case OP_LOAD_LOCAL_CONST:
+            return read_u16(operand) < locals && read_u16(operand + 2) < constants;
+        case OP_CALL:
+            return read_u16(operand) < chunk->function_count;
+        case OP_CALL_NATIVE:
+            return read_u16(operand) < constants && chunk->constants.items[read_u16(operand)].type == 's';
+        case OP_CALL_BUILTIN: {
+            int index = read_u16(operand);
+            int args = read_u16(operand + 2);
+            for (int i = 0; i <= index; i++) {
+                if (!builtins[i].name) return 0;
+            }
+            return args >= builtins[index].min_args && (builtins[index].max_args < 0 || args <= builtins[index].max_args);
+        }
+        default:
+            return 1;
+    }
+}
+
+// Verifies code before anything runs it: every opcode is known and fits,
+// every operand indexes an existing constant, slot, local, function or
+// builtin (with an argument count it accepts), and every body (top-level code, then each function) only jumps
+// to instruction starts inside itself, never falls off its end and pops
+// no more than it pushed, reaching each instruction at one stack depth.
+int verify_code(Chunk* chunk) {
+    int size = chunk->count;
+    const uint8_t* code = chunk->code;
+    // Bodies start at offset 0 and at each function entry
+    int* body_at = malloc(sizeof(int) * (size + 1));
+    int* depth = malloc(sizeof(int) * (size + 1));
+    int* worklist = malloc(sizeof(int) * (size + 1));
+    for (int ip = 0; ip <= size; ip++) {
+        body_at[ip] = -2;   // not an instruction start
+        depth[ip] = -1;
+    }
+    int ok = 1;
+    for (int ip = 0; ip < size && ok; ) {
+        Opcode op = code[ip];
+        ok = op < OPCODE_COUNT && op != OP_LABEL && ip + 1 + operand_size(op) <= size;
+        body_at[ip] = -1;
+        if (ok) ip += 1 + operand_size(op);
+    }
+    for (int f = 0; f < chunk->function_count && ok; f++) {
+        Function* fn = &chunk->functions[f];
+        ok = fn->entry > 0 && fn->entry < size && body_at[fn->entry] == -1
+             && fn->param_count >= 0 && fn->param_count <= fn->local_count && fn->local_count <= MAX_VARS;
+        if (ok) body_at[fn->entry] = f;
+    }
+    // Tag each instruction start with its body, -1 for top-level code. The
+    // threaded engine and the JIT decode unreachable instructions too, so
+    // every instruction's operands are checked, not just those on a path.
+    int body = -1;
+    for (int ip = 0; ip < size && ok; ip += 1 + operand_size(code[ip])) {
+        if (body_at[ip] >= 0) body = body_at[ip];
+        body_at[ip] = body;
+        ok = operands_valid(chunk, code[ip], code + ip + 1, body < 0 ? 0 : chunk->functions[body].local_count);
+    }
+
+    for (int b = -1; b < chunk->function_count && ok; b++) {
+        int start = b < 0 ? 0 : chunk->functions[b].entry;
+        int pending = 0;
+        depth[start] = 0;
+        worklist[pending++] = start;
+        while (pending > 0 && ok) {
+            int ip = worklist[--pending];
+            Opcode op = code[ip];
+            const uint8_t* operand = code + ip + 1;
+            int pops, pushes;
+            ok = stack_effect(chunk, op, operand, &pops, &pushes) && depth[ip] >= pops;
+            if (!ok || op == OP_RET || op == OP_HALT) continue;
+            int after = depth[ip] - pops + pushes;
+            int next[2];
+            int successors = 0;
+            if (is_jump(op)) next[successors++] = read_u32(operand);
+            if (op != OP_JMP) next[successors++] = ip + 1 + operand_size(op);
+            for (int s = 0; s < successors && ok; s++) {
+                int target = next[s];
+                ok = target >= 0 && target < size && body_at[target] == b;
+                if (!ok) break;
+                if (depth[target] < 0) {
+                    depth[target] = after;
+                    worklist[pending++] = target;
+                } else {
+                    ok = depth[target] == after;
+                }
+            }
+        }
+    }
+    // The line table is searched by offset (chunk_line)
+    for (int i = 0; i < chunk->line_count && ok; i++) {
+        ok = chunk->lines[i].offset >= 0 && chunk->lines[i].offset < size
+             && (i == 0 || chunk->lines[i].offset >= chunk->lines[i - 1].offset);
+    }
+    free(body_at);
+    free(depth);
+    free(worklist);
+    return ok;
+}
+
+// Maps path and points chunk at it. Returns 0, leaving chunk untouched, when
+// there is no usable image for this source and these options.
+int load_cached_chunk(const char* path, uint64_t source_hash, uint32_t options, Chunk* chunk) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < (off_t)sizeof(BytecodeHeader)
+        || st.st_size > UINT32_MAX) {
+        close(fd);
+        return 0;
+    }
+    uint8_t* image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) return 0;
+
+    BytecodeHeader* h = (BytecodeHeader*)image;
+    const char* strings = (const char*)image + h->strings_offset;
+    if (memcmp(h->magic, BYTECODE_MAGIC, 8) != 0 || h->version != BYTECODE_VERSION
+        || h->byte_order != BYTE_ORDER_MARK || h->options != options || h->source_hash != source_hash
+        || h->image_size != (uint32_t)st.st_size || h->code_size == 0
+        || !section_fits(h, h->constants_offset, h->constant_count, sizeof(ConstantRecord))
+        || !section_fits(h, h->functions_offset, h->function_count, sizeof(FunctionRecord))
+        || !section_fits(h, h->slots_offset, h->slot_count, sizeof(SlotRecord))
+        || !section_fits(h, h->code_offset, h->code_size, 1)
+        || !section_fits(h, h->lines_offset, h->line_count, sizeof(LineInfo))
+        || !section_fits(h, h->strings_offset, h->strings_size, 1)
+        || h->function_count > MAX_FUNCS || h->slot_count > MAX_VARS) {
+        munmap(image, st.st_size);
+        return 0;
+    }
+
+    ConstantRecord* constants = (ConstantRecord*)(image + h->constants_offset);
+    FunctionRecord* functions = (FunctionRecord*)(image + h->functions_offset);
+    SlotRecord* slots = (SlotRecord*)(image + h->slots_offset);
+    for (uint32_t i = 0; i < h->constant_count; i++) {
+        if ((constants[i].type != 'i' && constants[i].type != 's')
+            || (constants[i].type == 's' && !string_fits(h, strings, constants[i].string, constants[i].length))) {
+            munmap(image, st.st_size);
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < h->function_count; i++) {
+        if (!string_fits(h, strings, functions[i].name, functions[i].name_length)
+            || functions[i].entry < 0 || (uint32_t)functions[i].entry >= h->code_size) {
+            munmap(image, st.st_size);
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < h->slot_count; i++) {
+        if (!string_fits(h, strings, slots[i].name, slots[i].name_length)) {
+            munmap(image, st.st_size);
+            return 0;
+        }
+    }
+
+    init_chunk(chunk);
+    chunk->code = image + h->code_offset;
+    chunk->count = h->code_size;
+    chunk->capacity = h->code_size;
+    chunk->lines = (LineInfo*)(image + h->lines_offset);
+    chunk->line_count = h->line_count;
+    chunk->image = image;
+    chunk->image_size = st.st_size;
+
+    // String constants keep pointing into the image; only their values are interned
+    chunk->constants.items = malloc(sizeof(Constant) * (h->constant_count ? h->constant_count : 1));
+    chunk->constants.count = h->constant_count;
+    chunk->constants.capacity = h->constant_count;
+    for (uint32_t i = 0; i < h->constant_count; i++) {
+        Constant* c = &chunk->constants.items[i];
+        c->type = (char)constants[i].type;
+        c->int_value = constants[i].int_value;
+        if (c->type == 's') {
+            c->str_value = (char*)strings + constants[i].string;
+            c->value = make_string(intern_string(c->str_value, constants[i].length));
+        } else {
+            c->str_value = NULL;
+            c->value = make_int(c->int_value);
+        }
+    }
+    chunk->functions = malloc(sizeof(Function) * (h->function_count ? h->function_count : 1));
+    chunk->function_count = h->function_count;
+    for (uint32_t i = 0; i < h->function_count; i++) {
+        chunk->functions[i] = (Function){
+            intern_string(strings + functions[i].name, functions[i].name_length)->chars,
+            functions[i].entry,
+            functions[i].param_count,
+            functions[i].local_count,
+        };
+    }
+    // The slot table is what the compiler would have built for this script
+    reset_symbols();
+    for (uint32_t i = 0; i < h->slot_count; i++) define_slot(strings + slots[i].name);
+    if (slot_count != (int)h->slot_count || !verify_code(chunk)) {
+        reset_symbols();
+        free_chunk(chunk);
+        return 0;
+    }
+    return 1;
+}
+
+int write_all(int fd, const void* data, size_t size) {
+    const uint8_t* p = data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n <= 0) return 0;
+        p += n;
+        size -= n;
+    }
+    return 1;
+}
+
+// Writes the image to a temporary file and renames it over path, so a run
+// that loads the cache never sees a half-written image. The cache is only
+// an optimization: if it cannot be written the script still runs.
+void save_cached_chunk(const char* path, uint64_t source_hash, uint32_t options, Chunk* chunk) {
+    BytecodeHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, BYTECODE_MAGIC, 8);
+    h.version = BYTECODE_VERSION;
+    h.byte_order = BYTE_ORDER_MARK;
+    h.source_hash = source_hash;
+    h.options = options;
+    h.constant_count = chunk->constants.count;
+    h.function_count = chunk->function_count;
+    h.code_size = chunk->count;
+    h.line_count = chunk->line_count;
+
+    // Strings first, so the records can refer to them by offset
+    size_t strings_size = 0;
+    for (int i = 0; i < chunk->constants.count; i++) {
+        if (chunk->constants.items[i].type == 's') strings_size += strlen(chunk->constants.items[i].str_value) + 1;
+    }
+    for (int i = 0; i < chunk->function_count; i++) strings_size += strlen(chunk->functions[i].name) + 1;
+    for (int i = 0; i < slot_count; i++) strings_size += strlen(slot_names[i]) + 1;
+    char* strings = malloc(strings_size ? strings_size : 1);
+    ConstantRecord* constants = calloc(chunk->constants.count ? chunk->constants.count : 1, sizeof(ConstantRecord));
+    FunctionRecord* functions = calloc(chunk->function_count ? chunk->function_count : 1, sizeof(FunctionRecord));
+    SlotRecord* slots = calloc(slot_count ? slot_count : 1, sizeof(SlotRecord));
+    h.slot_count = slot_count;
+    uint32_t used = 0;
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Constant* c = &chunk->constants.items[i];
+        constants[i].type = (uint8_t)c->type;
+        constants[i].int_value = c->int_value;
+        if (c->type == 's') {
+            uint32_t length = strlen(c->str_value);
+            constants[i].string = used;
+            constants[i].length = length;
+            memcpy(strings + used, c->str_value, length + 1);
+            used += length + 1;
+        }
+    }
+    for (int i = 0; i < chunk->function_count; i++) {
+        Function* f = &chunk->functions[i];
+        uint32_t length = strlen(f->name);
+        functions[i] = (FunctionRecord){used, length, f->entry, f->param_count, f->local_count};
+        memcpy(strings + used, f->name, length + 1);
+        used += length + 1;
+    }
+    for (int i = 0; i < slot_count; i++) {
+        uint32_t length = strlen(slot_names[i]);
+        slots[i] = (SlotRecord){used, length};
+        memcpy(strings + used, slot_names[i], length + 1);
+        used += length + 1;
+    }
+    h.strings_size = used;
+
+    h.constants_offset = align8(sizeof(BytecodeHeader));
+    h.functions_offset = align8(h.constants_offset + sizeof(ConstantRecord) * h.constant_count);
+    h.slots_offset = align8(h.functions_offset + sizeof(FunctionRecord) * h.function_count);
+    h.code_offset = align8(h.slots_offset + sizeof(SlotRecord) * h.slot_count);
+    h.lines_offset = align8(h.code_offset + h.code_size);
+    h.strings_offset = align8(h.lines_offset + sizeof(LineInfo) * h.line_count);
+    h.image_size = h.strings_offset + h.strings_size;
+
+    size_t length = strlen(path);
+    char* temporary = malloc(length + 32);
+    snprintf(temporary, length + 32, "%s.%ld.tmp", path, (long)getpid());
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        static const uint8_t padding[8] = {0};
+        int ok = write_all(fd, &h, sizeof(h))
+            && write_all(fd, padding, h.constants_offset - sizeof(h))
+            && write_all(fd, constants, sizeof(ConstantRecord) * h.constant_count)
+            && write_all(fd, padding, h.functions_offset - (h.constants_offset + sizeof(ConstantRecord) * h.constant_count))
+            && write_all(fd, functions, sizeof(FunctionRecord) * h.function_count)
+            && write_all(fd, padding, h.slots_offset - (h.functions_offset + sizeof(FunctionRecord) * h.function_count))
+            && write_all(fd, slots, sizeof(SlotRecord) * h.slot_count)
+            && write_all(fd, padding, h.code_offset - (h.slots_offset + sizeof(SlotRecord) * h.slot_count))
+            && write_all(fd, chunk->code, h.code_size)
+            && write_all(fd, padding, h.lines_offset - (h.code_offset + h.code_size))
+            && write_all(fd, chunk->lines, sizeof(LineInfo) * h.line_count)
+            && write_all(fd, padding, h.strings_offset - (h.lines_offset + sizeof(LineInfo) * h.line_count))
+            && write_all(fd, strings, h.strings_size);
+        ok = close(fd) == 0 && ok;
+        if (!ok || rename(temporary, path) != 0) unlink(temporary);
+    }
+    free(temporary);
+    free(strings);
+    free(constants);
+    free(functions);
+    free(slots);
+}
+
+void release_image(Chunk* chunk) {
+    munmap(chunk->image, chunk->image_size);
+}
+
+#else
+
+// No mmap: always compile
+int load_cached_chunk(const char* path, uint64_t source_hash, uint32_t options, Chunk* chunk) {
+    return 0;
+}
+
+void save_cached_chunk(const char* path, uint64_t source_hash, uint32_t options, Chunk* chunk) {
+}
+
+void release_image(Chunk* chunk) {
+}
+
+#endif
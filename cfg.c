@@ -0,0 +1,1044 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Basic-block optimizer. Each body (top-level code or one function) becomes
+// a graph of blocks holding assignments and expression statements, ended by
+// an explicit jump, branch, return or end. Expressions stay AST trees so
+// lowering can reuse emit_node(); the passes rewrite them in place.
+//
+// Passes, in order: copy propagation (variables and literals, followed by
+// refolding), unreachable-block removal, dead-store removal from liveness,
+// removal of expression statements that cannot fail or have effects, and
+// hoisting of loop-invariant expressions into a preheader.
+//
+// Ints are never allowed to change an error into a non-error: an expression
+// is only dropped or hoisted when it provably cannot fail, which for
+// arithmetic means both operands are known ints (see the int analysis).
+
+typedef enum {
+    EXIT_END,      // HALT, or the implicit return 0 of a function
+    EXIT_JUMP,     // to succ[0]
+    EXIT_BRANCH,   // value true: succ[0], else succ[1]
+    EXIT_RETURN,   // value is the AST_RETURN node
+} ExitKind;
+
+// Variable sets are bitsets over variable_id(): locals, then globals
+#define VAR_WORDS (2 * MAX_VARS / 64)
+
+typedef struct {
+    uint64_t bits[VAR_WORDS];
+} VarSet;
+
+typedef struct Block {
+    int id;                  // layout position
+    ArenaVec statements;     // assignments and expression statements
+    uint8_t exit;
+    ASTNode* value;
+    struct Block* succ[2];
+    uint32_t line;           // position stamped on the exit's jumps
+    uint16_t column;
+    int reachable;
+    int label;               // IR label, -1 until a jump needs one
+    ArenaVec preds;          // reachable predecessors
+    VarSet live_in;
+    VarSet live_out;
+    VarSet int_in;           // variables certainly holding an int on entry
+    VarSet int_out;
+    int taken;               // branch direction the copy analysis proved, or -1
+    ASTNode** copies_in;     // per copy target: its source, or NULL
+    ASTNode** copies_out;
+} Block;
+
+typedef struct {
+    Block* preheader;        // runs once before the header, hoisted code goes here
+    Block* header;           // evaluates the condition
+    int last;                // loop blocks are header->id .. last
+} Loop;
+
+typedef struct {
+    ArenaVec blocks;         // in layout order; blocks[0] is the entry
+    ArenaVec loops;          // outer loops before the loops they contain
+    int function;            // -1 for top-level code
+} Graph;
+
+const char* cfg_stat_names[] = {
+    "blocks",
+    "unreachable blocks",
+    "copies propagated",
+    "dead stores",
+    "dead expressions",
+    "hoisted",
+};
+
+int cfg_stats[CFG_STAT_COUNT];
+
+Arena cfg_arena;
+
+// Sentinel for "not computed yet" in the copy analysis
+ASTNode copy_unknown;
+
+VarSet globals_set() {
+    VarSet s;
+    for (int w = 0; w < VAR_WORDS; w++) s.bits[w] = w >= MAX_VARS / 64 ? ~0ull : 0;
+    return s;
+}
+
+static inline int set_has(VarSet* s, int id) {
+    return (s->bits[id >> 6] >> (id & 63)) & 1;
+}
+
+static inline void set_add(VarSet* s, int id) {
+    s->bits[id >> 6] |= 1ull << (id & 63);
+}
+
+static inline void set_remove(VarSet* s, int id) {
+    s->bits[id >> 6] &= ~(1ull << (id & 63));
+}
+
+int is_global_id(int id) {
+    return id >= MAX_VARS;
+}
+
+// Building
+
+Block* new_block(Graph* g) {
+    Block* b = arena_alloc(&cfg_arena, sizeof(Block));
+    memset(b, 0, sizeof(Block));
+    b->id = g->blocks.count;
+    b->label = -1;
+    vec_init(&cfg_arena, &b->statements, 4);
+    vec_push(&cfg_arena, &g->blocks, b);
+    cfg_stats[CFG_BLOCKS]++;
+    return b;
+}
+
+void end_block(Block* b, ExitKind exit, ASTNode* value, Block* a, Block* c, ASTNode* at) {
+    b->exit = exit;
+    b->value = value;
+    b->succ[0] = a;
+    b->succ[1] = c;
+    b->line = at->line;
+    b->column = at->column;
+}
+
+// Appends node to cur and returns the block that control reaches after it
+Block* build_statement(Graph* g, Block* cur, ASTNode* node) {
+    switch (node->type) {
+        case AST_BLOCK:
+            for (int i = 0; i < node->block.count; i++) {
+                cur = build_statement(g, cur, node->block.statements[i]);
+            }
+            return cur;
+
+        case AST_IF: {
+            Block* then_block = new_block(g);
+            end_block(cur, EXIT_BRANCH, node->if_stmt.condition, then_block, NULL, node);
+            Block* then_end = build_statement(g, then_block, node->if_stmt.then_branch);
+            Block* join;
+            if (node->if_stmt.else_branch) {
+                Block* else_block = new_block(g);
+                cur->succ[1] = else_block;
+                Block* else_end = build_statement(g, else_block, node->if_stmt.else_branch);
+                join = new_block(g);
+                end_block(else_end, EXIT_JUMP, NULL, join, NULL, node);
+            } else {
+                join = new_block(g);
+                cur->succ[1] = join;
+            }
+            end_block(then_end, EXIT_JUMP, NULL, join, NULL, node);
+            return join;
+        }
+
+        case AST_WHILE: {
+            Block* preheader = new_block(g);
+            end_block(cur, EXIT_JUMP, NULL, preheader, NULL, node);
+            Block* header = new_block(g);
+            end_block(preheader, EXIT_JUMP, NULL, header, NULL, node);
+            Loop* loop = arena_alloc(&cfg_arena, sizeof(Loop));
+            loop->preheader = preheader;
+            loop->header = header;
+            vec_push(&cfg_arena, &g->loops, loop);
+
+            Block* body = new_block(g);
+            end_block(header, EXIT_BRANCH, node->while_stmt.condition, body, NULL, node);
+            Block* body_end = build_statement(g, body, node->while_stmt.body);
+            end_block(body_end, EXIT_JUMP, NULL, header, NULL, node);
+            loop->last = g->blocks.count - 1;
+
+            Block* exit = new_block(g);
+            header->succ[1] = exit;
+            return exit;
+        }
+
+        case AST_RETURN:
+            end_block(cur, EXIT_RETURN, node, NULL, NULL, node);
+            return new_block(g);  // anything after the return is unreachable
+
+        case AST_FUNCTION_DEF:
+            return cur;  // bodies are separate graphs
+
+        default:
+            vec_push(&cfg_arena, &cur->statements, node);
+            return cur;
+    }
+}
+
+void build_graph(Graph* g, ASTNode* body, int function) {
+    vec_init(&cfg_arena, &g->blocks, 16);
+    vec_init(&cfg_arena, &g->loops, 4);
+    g->function = function;
+    Block* last = build_statement(g, new_block(g), body);
+    last->exit = EXIT_END;
+}
+
+#define BLOCK(g, i) ((Block*)(g)->blocks.items[i])
+
+// Marks what the entry reaches and rebuilds predecessor lists
+void find_reachable(Graph* g) {
+    for (int i = 0; i < g->blocks.count; i++) {
+        Block* b = BLOCK(g, i);
+        b->reachable = 0;
+        vec_init(&cfg_arena, &b->preds, 2);
+    }
+    Block** stack = malloc(sizeof(Block*) * g->blocks.count);
+    int top = 0;
+    stack[top++] = BLOCK(g, 0);
+    BLOCK(g, 0)->reachable = 1;
+    while (top > 0) {
+        Block* b = stack[--top];
+        int succ_count = b->exit == EXIT_BRANCH ? 2 : b->exit == EXIT_JUMP ? 1 : 0;
+        for (int s = 0; s < succ_count; s++) {
+            Block* next = b->succ[s];
+            vec_push(&cfg_arena, &next->preds, b);
+            if (!next->reachable) {
+                next->reachable = 1;
+                stack[top++] = next;
+            }
+        }
+    }
+    free(stack);
+}
+
+// Expression helpers
+
+// The predicates below go down the left operands of a binary chain in a
+// loop and only recurse into the right ones, see push_spine
+
+int has_call(ASTNode* e) {
+    while (e->type == AST_BINARY_OP) {
+        if (has_call(e->binary.right)) return 1;
+        e = e->binary.left;
+    }
+    switch (e->type) {
+        case AST_FUNCTION_CALL:
+            return 1;
+        case AST_ASSIGNMENT:
+            return has_call(e->assignment.value);
+        case AST_RETURN:
+            return has_call(e->return_stmt.value);
+        case AST_ARRAY:
+            for (int i = 0; i < e->array.count; i++) {
+                if (has_call(e->array.elements[i])) return 1;
+            }
+            return 0;
+        case AST_INDEX:
+        case AST_INDEX_ASSIGNMENT:
+            return has_call(e->index.array) || has_call(e->index.index) || (e->index.value && has_call(e->index.value));
+        default:
+            return 0;
+    }
+}
+
+// Builtins never touch variables; user functions may read or write any global
+int calls_user_function(ASTNode* e) {
+    while (e->type == AST_BINARY_OP) {
+        if (calls_user_function(e->binary.right)) return 1;
+        e = e->binary.left;
+    }
+    switch (e->type) {
+        case AST_FUNCTION_CALL:
+            if (find_function(e->function_call.name) >= 0) return 1;
+            for (int i = 0; i < e->function_call.arg_count; i++) {
+                if (calls_user_function(e->function_call.args[i])) return 1;
+            }
+            return 0;
+        case AST_ASSIGNMENT:
+            return calls_user_function(e->assignment.value);
+        case AST_RETURN:
+            return calls_user_function(e->return_stmt.value);
+        case AST_ARRAY:
+            for (int i = 0; i < e->array.count; i++) {
+                if (calls_user_function(e->array.elements[i])) return 1;
+            }
+            return 0;
+        case AST_INDEX:
+        case AST_INDEX_ASSIGNMENT:
+            return calls_user_function(e->index.array) || calls_user_function(e->index.index) ||
+                   (e->index.value && calls_user_function(e->index.value));
+        default:
+            return 0;
+    }
+}
+
+int is_comparison(char op) {
+    return op == '=' || op == '!' || op == '<' || op == '>' || op == 'L' || op == 'G';
+}
+
+// Whether e can only produce an int, given the variables known to hold ints
+int yields_int(ASTNode* e, VarSet* ints) {
+    while (e->type == AST_BINARY_OP && e->binary.op == '+') {
+        if (!yields_int(e->binary.right, ints)) return 0;
+        e = e->binary.left;
+    }
+    switch (e->type) {
+        case AST_NUMBER:
+            return 1;
+        case AST_VARIABLE:
+            return set_has(ints, variable_id(e->name));
+        case AST_BINARY_OP:
+            return !is_comparison(e->binary.op);  // - * / fail on anything but ints
+        case AST_INDEX:
+            return 1;  // arrays only hold ints
+        default:
+            return 0;
+    }
+}
+
+int cannot_fail(ASTNode* e, VarSet* ints);
+
+// cannot_fail for each node of the chain pushed at base, innermost first:
+// returns the outermost node's answer and, when safe is given, stores every
+// node's in safe[i - base]. Whether a left operand yields an int is carried
+// up the chain, since asking yields_int at every node of a long + chain
+// would be quadratic.
+int spine_cannot_fail(int base, VarSet* ints, char* safe) {
+    ASTNode* l = spine[spine_top - 1]->binary.left;
+    int ok = cannot_fail(l, ints);
+    int left_int = yields_int(l, ints);
+    for (int i = spine_top - 1; i >= base; i--) {
+        ASTNode* e = spine[i];
+        ASTNode* r = e->binary.right;
+        int right_int = yields_int(r, ints);
+        if (ok && !cannot_fail(r, ints)) ok = 0;
+        if (ok && e->binary.op != '=' && e->binary.op != '!') {
+            if (!left_int || !right_int) {
+                ok = 0;
+            } else if (e->binary.op == '/') {
+                ok = r->type == AST_NUMBER && r->number != 0;
+            }
+        }
+        if (safe) {
+            safe[i - base] = ok;
+        } else if (!ok) {
+            break;
+        }
+        left_int = e->binary.op == '+' ? left_int && right_int : !is_comparison(e->binary.op);
+    }
+    return ok;
+}
+
+// Whether evaluating e can neither fail nor have an effect
+int cannot_fail(ASTNode* e, VarSet* ints) {
+    switch (e->type) {
+        case AST_NUMBER:
+        case AST_STRING:
+        case AST_VARIABLE:
+            return 1;
+        case AST_BINARY_OP: {
+            int base = push_spine(e);
+            int safe = spine_cannot_fail(base, ints, NULL);
+            spine_top = base;
+            return safe;
+        }
+        default:
+            return 0;
+    }
+}
+
+ASTNode* copy_leaf(ASTNode* source, ASTNode* at) {
+    ASTNode* node = new_node(source->type, (Token){.line = at->line, .column = at->column});
+    switch (source->type) {
+        case AST_NUMBER: node->number = source->number; break;
+        case AST_STRING: node->string = source->string; break;
+        default: node->name = source->name; break;
+    }
+    return node;
+}
+
+// Copy propagation: forward "available copies". An assignment whose value
+// evaluates to a literal or a plain variable under the copies known at that
+// point makes its target a copy of that. Branches whose condition evaluates
+// to a constant only pass copies along the edge they take, so code guarded
+// by a known condition sees the copies from before it.
+
+int* copy_index;       // variable id -> copy entry, or -1
+int copy_count;
+
+int same_source(ASTNode* a, ASTNode* b) {
+    if (a == b) return 1;
+    if (!a || !b || a == &copy_unknown || b == &copy_unknown || a->type != b->type) return 0;
+    switch (a->type) {
+        case AST_NUMBER: return a->number == b->number;
+        case AST_STRING: return a->string == b->string;   // interned
+        default: return a->name == b->name;
+    }
+}
+
+int reads_variable(ASTNode* source, int id) {
+    return source && source != &copy_unknown && source->type == AST_VARIABLE && variable_id(source->name) == id;
+}
+
+void kill_copies_of(ASTNode** map, int id) {
+    if (copy_index[id] >= 0) map[copy_index[id]] = NULL;
+    for (int k = 0; k < copy_count; k++) {
+        if (reads_variable(map[k], id)) map[k] = NULL;
+    }
+}
+
+// A user call may assign any global
+void kill_global_copies(ASTNode** map) {
+    for (int id = MAX_VARS; id < 2 * MAX_VARS; id++) {
+        if (copy_index[id] >= 0) map[copy_index[id]] = NULL;
+    }
+    for (int k = 0; k < copy_count; k++) {
+        ASTNode* source = map[k];
+        if (source && source != &copy_unknown && source->type == AST_VARIABLE && is_global_id(variable_id(source->name))) {
+            map[k] = NULL;
+        }
+    }
+}
+
+// The leaf e amounts to under map: a literal, a variable, or NULL when it
+// is anything else. Arithmetic follows fold.c, so a literal result is what
+// fold_expression() produces after the reads are replaced.
+ASTNode* evaluate(ASTNode* e, ASTNode** map) {
+    switch (e->type) {
+        case AST_NUMBER:
+        case AST_STRING:
+            return e;
+        case AST_VARIABLE: {
+            int k = copy_index[variable_id(e->name)];
+            return k >= 0 && map[k] ? map[k] : e;
+        }
+        case AST_BINARY_OP: {
+            int base = push_spine(e);
+            ASTNode* value = evaluate(spine[spine_top - 1]->binary.left, map);
+            for (int i = spine_top - 1; i >= base && value; i--) {
+                ASTNode* op = spine[i];
+                ASTNode* r = is_comparison(op->binary.op) ? NULL : evaluate(op->binary.right, map);
+                if (!r || value->type != AST_NUMBER || r->type != AST_NUMBER) {
+                    value = NULL;
+                    break;
+                }
+                ASTNode* result = new_node(AST_BINARY_OP, (Token){.line = op->line, .column = op->column});
+                result->binary.op = op->binary.op;
+                result->binary.left = value;
+                result->binary.right = r;
+                result = refold_expression(result);
+                value = result->type == AST_NUMBER ? result : NULL;
+            }
+            spine_top = base;
+            return value;
+        }
+        default:
+            return NULL;
+    }
+}
+
+// Which way a branch goes under map: 1, 0, or -1 when not known
+int evaluate_truth(ASTNode* cond, ASTNode** map) {
+    if (has_call(cond)) return -1;
+    if (cond->type == AST_BINARY_OP && is_comparison(cond->binary.op)) {
+        ASTNode* l = evaluate(cond->binary.left, map);
+        ASTNode* r = evaluate(cond->binary.right, map);
+        if (!l || !r) return -1;
+        ASTNode compare = {.type = AST_BINARY_OP};
+        compare.binary.op = cond->binary.op;
+        compare.binary.left = l;
+        compare.binary.right = r;
+        return constant_truth(&compare);
+    }
+    ASTNode* value = evaluate(cond, map);
+    return value ? constant_truth(value) : -1;
+}
+
+// Walks e in evaluation order; with rewrite set, reads of copied variables
+// are replaced by their sources
+ASTNode* propagate(ASTNode* e, ASTNode** map, int rewrite) {
+    switch (e->type) {
+        case AST_VARIABLE: {
+            int k = copy_index[variable_id(e->name)];
+            if (rewrite && k >= 0 && map[k]) {
+                cfg_stats[CFG_COPIES]++;
+                return copy_leaf(map[k], e);
+            }
+            return e;
+        }
+        case AST_BINARY_OP: {
+            int base = push_spine(e);
+            ASTNode* inner = spine[spine_top - 1];
+            inner->binary.left = propagate(inner->binary.left, map, rewrite);
+            for (int i = spine_top - 1; i >= base; i--) {
+                spine[i]->binary.right = propagate(spine[i]->binary.right, map, rewrite);
+            }
+            spine_top = base;
+            return e;
+        }
+        case AST_FUNCTION_CALL:
+            for (int i = 0; i < e->function_call.arg_count; i++) {
+                e->function_call.args[i] = propagate(e->function_call.args[i], map, rewrite);
+            }
+            if (find_function(e->function_call.name) >= 0) kill_global_copies(map);
+            return e;
+        case AST_ARRAY:
+            for (int i = 0; i < e->array.count; i++) {
+                e->array.elements[i] = propagate(e->array.elements[i], map, rewrite);
+            }
+            return e;
+        case AST_INDEX:
+        case AST_INDEX_ASSIGNMENT:
+            e->index.array = propagate(e->index.array, map, rewrite);
+            e->index.index = propagate(e->index.index, map, rewrite);
+            if (e->index.value) e->index.value = propagate(e->index.value, map, rewrite);
+            return e;
+        default:
+            return e;
+    }
+}
+
+// Runs b from its copies_in; with rewrite set, also replaces reads, refolds
+// and turns branches the analysis decided into jumps
+void propagate_block(Block* b, ASTNode** map, int rewrite) {
+    memcpy(map, b->copies_in, sizeof(ASTNode*) * copy_count);
+    for (int i = 0; i < b->statements.count; i++) {
+        ASTNode* stmt = b->statements.items[i];
+        if (stmt->type == AST_ASSIGNMENT) {
+            ASTNode* value = stmt->assignment.value;
+            ASTNode* source = has_call(value) ? NULL : evaluate(value, map);
+            value = propagate(value, map, rewrite);
+            stmt->assignment.value = rewrite ? refold_expression(value) : value;
+            int id = variable_id(stmt->assignment.name);
+            kill_copies_of(map, id);
+            if (source && !reads_variable(source, id)) map[copy_index[id]] = source;
+        } else {
+            stmt = propagate(stmt, map, rewrite);
+            b->statements.items[i] = rewrite ? refold_expression(stmt) : stmt;
+        }
+    }
+    if (b->exit == EXIT_BRANCH) {
+        b->taken = evaluate_truth(b->value, map);
+        if (rewrite && b->taken >= 0) {
+            // Known conditions are free of calls and cannot fail
+            b->exit = EXIT_JUMP;
+            b->succ[0] = b->succ[b->taken ? 0 : 1];
+            b->value = NULL;
+        } else if (rewrite) {
+            b->value = refold_expression(propagate(b->value, map, rewrite));
+        } else {
+            propagate(b->value, map, rewrite);
+        }
+    } else if (b->exit == EXIT_RETURN) {
+        ASTNode* value = propagate(b->value->return_stmt.value, map, rewrite);
+        b->value->return_stmt.value = rewrite ? refold_expression(value) : value;
+    }
+}
+
+// Whether pred passes its copies to b: not along a branch edge it never takes
+int edge_taken(Block* pred, Block* b) {
+    if (pred->exit != EXIT_BRANCH || pred->taken < 0) return 1;
+    return pred->succ[pred->taken ? 0 : 1] == b;
+}
+
+// Returns how many reads were replaced
+int propagate_copies(Graph* g) {
+    copy_index = malloc(sizeof(int) * 2 * MAX_VARS);
+    for (int id = 0; id < 2 * MAX_VARS; id++) copy_index[id] = -1;
+    copy_count = 0;
+    for (int i = 0; i < g->blocks.count; i++) {
+        Block* b = BLOCK(g, i);
+        for (int s = 0; s < b->statements.count; s++) {
+            ASTNode* stmt = b->statements.items[s];
+            if (stmt->type != AST_ASSIGNMENT) continue;
+            int id = variable_id(stmt->assignment.name);
+            if (copy_index[id] < 0) copy_index[id] = copy_count++;
+        }
+    }
+    if (copy_count == 0) {
+        free(copy_index);
+        return 0;
+    }
+
+    // Entry starts with nothing known and every other block optimistically
+    // with everything; the meet keeps what all taken incoming edges agree on
+    for (int i = 0; i < g->blocks.count; i++) {
+        Block* b = BLOCK(g, i);
+        b->taken = -1;
+        b->copies_in = arena_alloc(&cfg_arena, sizeof(ASTNode*) * copy_count);
+        b->copies_out = arena_alloc(&cfg_arena, sizeof(ASTNode*) * copy_count);
+        for (int k = 0; k < copy_count; k++) {
+            b->copies_in[k] = i == 0 ? NULL : &copy_unknown;
+            b->copies_out[k] = &copy_unknown;
+        }
+    }
+    ASTNode** map = malloc(sizeof(ASTNode*) * copy_count);
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < g->blocks.count; i++) {
+            Block* b = BLOCK(g, i);
+            if (!b->reachable) continue;
+            if (i > 0) {
+                for (int k = 0; k < copy_count; k++) {
+                    ASTNode* in = &copy_unknown;
+                    for (int p = 0; p < b->preds.count; p++) {
+                        Block* pred = b->preds.items[p];
+                        ASTNode* out = pred->copies_out[k];
+                        if (out == &copy_unknown || !edge_taken(pred, b)) continue;
+                        in = in == &copy_unknown || same_source(in, out) ? out : NULL;
+                    }
+                    b->copies_in[k] = in;
+                }
+            }
+            // Blocks no taken edge reaches yet have nothing to pass on
+            int unknown = i > 0 && b->copies_in[0] == &copy_unknown;
+            if (unknown) continue;
+            propagate_block(b, map, 0);
+            for (int k = 0; k < copy_count; k++) {
+                if (!same_source(map[k], b->copies_out[k])) {
+                    b->copies_out[k] = map[k];
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    int before = cfg_stats[CFG_COPIES];
+    for (int i = 0; i < g->blocks.count; i++) {
+        Block* b = BLOCK(g, i);
+        if (!b->reachable) continue;
+        if (i > 0 && b->copies_in[0] == &copy_unknown) {
+            b->taken = -1;
+            continue;   // never entered along a taken edge; lowering drops it
+        }
+        for (int k = 0; k < copy_count; k++) {
+            if (b->copies_in[k] == &copy_unknown) b->copies_in[k] = NULL;
+        }
+        propagate_block(b, map, 1);
+    }
+    free(map);
+    free(copy_index);
+    return cfg_stats[CFG_COPIES] - before;
+}
+
+// Int analysis: forward, which variables certainly hold an int. Variables
+// start as nil and user calls may store anything into globals.
+
+void int_transfer(ASTNode* stmt, VarSet* ints) {
+    if (calls_user_function(stmt)) {
+        VarSet globals = globals_set();
+        for (int w = 0; w < VAR_WORDS; w++) ints->bits[w] &= ~globals.bits[w];
+    }
+    if (stmt->type == AST_ASSIGNMENT) {
+        int id = variable_id(stmt->assignment.name);
+        if (yields_int(stmt->assignment.value, ints)) {
+            set_add(ints, id);
+        } else {
+            set_remove(ints, id);
+        }
+    }
+}
+
+void analyze_ints(Graph* g) {
+    for (int i = 0; i < g->blocks.count; i++) {
+        Block* b = BLOCK(g, i);
+        memset(&b->int_in, i == 0 ? 0 : 0xFF, sizeof(VarSet));
+        memset(&b->int_out, 0xFF, sizeof(VarSet));
+    }
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < g->blocks.count; i++) {
+            Block* b = BLOCK(g, i);
+            if (!b->reachable) continue;
+            if (i > 0) {
+                memset(&b->int_in, 0xFF, sizeof(VarSet));
+                for (int p = 0; p < b->preds.count; p++) {
+                    Block* pred = b->preds.items[p];
+                    for (int w = 0; w < VAR_WORDS; w++) b->int_in.bits[w] &= pred->int_out.bits[w];
+                }
+            }
+            VarSet ints = b->int_in;
+            for (int s = 0; s < b->statements.count; s++) int_transfer(b->statements.items[s], &ints);
+            if (memcmp(&ints, &b->int_out, sizeof(VarSet)) != 0) {
+                b->int_out = ints;
+                changed = 1;
+            }
+        }
+    }
+}
+
+// Liveness: backward, which variables may still be read. Globals stay live
+// across user calls and out of functions; nothing is live after HALT.
+
+void add_uses(ASTNode* e, VarSet* live) {
+    while (e->type == AST_BINARY_OP) {
+        add_uses(e->binary.right, live);
+        e = e->binary.left;
+    }
+    switch (e->type) {
+        case AST_VARIABLE:
+            set_add(live, variable_id(e->name));
+            break;
+        case AST_FUNCTION_CALL:
+            if (find_function(e->function_call.name) >= 0) {
+                VarSet globals = globals_set();
+                for (int w = 0; w < VAR_WORDS; w++) live->bits[w] |= globals.bits[w];
+            }
+            for (int i = 0; i < e->function_call.arg_count; i++) add_uses(e->function_call.args[i], live);
+            break;
+        case AST_ASSIGNMENT:
+            add_uses(e->assignment.value, live);
+            break;
+        case AST_RETURN:
+            add_uses(e->return_stmt.value, live);
+            break;
+        case AST_ARRAY:
+            for (int i = 0; i < e->array.count; i++) add_uses(e->array.elements[i], live);
+            break;
+        case AST_INDEX:
+        case AST_INDEX_ASSIGNMENT:
+            add_uses(e->index.array, live);
+            add_uses(e->index.index, live);
+            if (e->index.value) add_uses(e->index.value, live);
+            break;
+        default:
+            break;
+    }
+}
+
+VarSet live_at_exit(Graph* g, Block* b) {
+    VarSet live;
+    memset(&live, 0, sizeof(live));
+    if (b->exit == EXIT_JUMP || b->exit == EXIT_BRANCH) {
+        int succ_count = b->exit == EXIT_BRANCH ? 2 : 1;
+        for (int s = 0; s < succ_count; s++) {
+            for (int w = 0; w < VAR_WORDS; w++) live.bits[w] |= b->succ[s]->live_in.bits[w];
+        }
+        if (b->exit == EXIT_BRANCH) add_uses(b->value, &live);
+    } else if (g->function >= 0) {
+        live = globals_set();
+        if (b->exit == EXIT_RETURN) add_uses(b->value, &live);
+    }
+    return live;
+}
+
+void live_transfer(ASTNode* stmt, VarSet* live) {
+    if (stmt->type == AST_ASSIGNMENT) set_remove(live, variable_id(stmt->assignment.name));
+    add_uses(stmt, live);
+}
+
+void analyze_liveness(Graph* g) {
+    for (int i = 0; i < g->blocks.count; i++) memset(&BLOCK(g, i)->live_in, 0, sizeof(VarSet));
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = g->blocks.count - 1; i >= 0; i--) {
+            Block* b = BLOCK(g, i);
+            if (!b->reachable) continue;
+            b->live_out = live_at_exit(g, b);
+            VarSet live = b->live_out;
+            for (int s = b->statements.count - 1; s >= 0; s--) live_transfer(b->statements.items[s], &live);
+            if (memcmp(&live, &b->live_in, sizeof(VarSet)) != 0) {
+                b->live_in = live;
+                changed = 1;
+            }
+        }
+    }
+}
+
+// A store nobody reads keeps only its value, as an expression statement
+void remove_dead_stores(Graph* g) {
+    for (int i = 0; i < g->blocks.count; i++) {
+        Block* b = BLOCK(g, i);
+        if (!b->reachable) continue;
+        VarSet live = b->live_out;
+        for (int s = b->statements.count - 1; s >= 0; s--) {
+            ASTNode* stmt = b->statements.items[s];
+            if (stmt->type == AST_ASSIGNMENT && !set_has(&live, variable_id(stmt->assignment.name))) {
+                b->statements.items[s] = stmt->assignment.value;
+                cfg_stats[CFG_DEAD_STORES]++;
+                stmt = b->statements.items[s];
+            }
+            live_transfer(stmt, &live);
+        }
+    }
+}
+
+// Drops expression statements whose value is unused and that cannot fail
+void remove_dead_expressions(Graph* g) {
+    for (int i = 0; i < g->blocks.count; i++) {
+        Block* b = BLOCK(g, i);
+        if (!b->reachable) continue;
+        VarSet ints = b->int_in;
+        int out = 0;
+        for (int s = 0; s < b->statements.count; s++) {
+            ASTNode* stmt = b->statements.items[s];
+            if (stmt->type != AST_ASSIGNMENT && cannot_fail(stmt, &ints)) {
+                cfg_stats[CFG_DEAD_EXPRESSIONS]++;
+                continue;
+            }
+            int_transfer(stmt, &ints);
+            b->statements.items[out++] = stmt;
+        }
+        b->statements.count = out;
+    }
+}
+
+// Loop-invariant code motion. An expression is hoisted when it reads no
+// variable the loop assigns, and it cannot fail, so computing it once in
+// the preheader is safe even if the body never runs.
+
+int is_invariant(ASTNode* e, VarSet* assigned) {
+    while (e->type == AST_BINARY_OP) {
+        if (!is_invariant(e->binary.right, assigned)) return 0;
+        e = e->binary.left;
+    }
+    switch (e->type) {
+        case AST_NUMBER:
+        case AST_STRING:
+            return 1;
+        case AST_VARIABLE:
+            return !set_has(assigned, variable_id(e->name));
+        default:
+            return 0;
+    }
+}
+
+// Computes *slot into a new temporary in the preheader and reads that instead
+void hoist_into_temporary(ASTNode** slot, Loop* loop) {
+    ASTNode* e = *slot;
+    const char* name = new_temporary();
+    if (!name) return;
+    Token at = {.line = e->line, .column = e->column};
+    ASTNode* store = new_node(AST_ASSIGNMENT, at);
+    store->assignment.name = name;
+    store->assignment.value = e;
+    vec_push(&cfg_arena, &loop->preheader->statements, store);
+    ASTNode* read = new_node(AST_VARIABLE, at);
+    read->name = name;
+    *slot = read;
+    cfg_stats[CFG_HOISTED]++;
+}
+
+// Hoists the largest invariant, safe binary subexpressions of *slot
+void hoist(ASTNode** slot, Loop* loop, VarSet* assigned, VarSet* ints) {
+    ASTNode* e = *slot;
+    switch (e->type) {
+        case AST_BINARY_OP: {
+            // Which nodes of the chain could go, innermost first, then the
+            // outermost of those goes whole and the rest is searched in
+            // evaluation order: its left operand, then each right one
+            int base = push_spine(e);
+            int count = spine_top - base;
+            char* safe = malloc(count);
+            spine_cannot_fail(base, ints, safe);
+            int invariant = is_invariant(spine[spine_top - 1]->binary.left, assigned);
+            for (int i = spine_top - 1; i >= base; i--) {
+                invariant = invariant && is_invariant(spine[i]->binary.right, assigned);
+                safe[i - base] = safe[i - base] && invariant;
+            }
+            int k = base;
+            while (k < spine_top && !safe[k - base]) k++;
+            free(safe);
+            if (k < spine_top) {
+                hoist_into_temporary(k == base ? slot : &spine[k - 1]->binary.left, loop);
+            } else {
+                hoist(&spine[spine_top - 1]->binary.left, loop, assigned, ints);
+            }
+            for (int i = k - 1; i >= base; i--) hoist(&spine[i]->binary.right, loop, assigned, ints);
+            spine_top = base;
+            break;
+        }
+        case AST_FUNCTION_CALL:
+            for (int i = 0; i < e->function_call.arg_count; i++) hoist(&e->function_call.args[i], loop, assigned, ints);
+            break;
+        case AST_ASSIGNMENT:
+            hoist(&e->assignment.value, loop, assigned, ints);
+            break;
+        case AST_RETURN:
+            hoist(&e->return_stmt.value, loop, assigned, ints);
+            break;
+        case AST_ARRAY:
+            for (int i = 0; i < e->array.count; i++) hoist(&e->array.elements[i], loop, assigned, ints);
+            break;
+        case AST_INDEX:
+        case AST_INDEX_ASSIGNMENT:
+            hoist(&e->index.array, loop, assigned, ints);
+            hoist(&e->index.index, loop, assigned, ints);
+            if (e->index.value) hoist(&e->index.value, loop, assigned, ints);
+            break;
+        default:
+            break;
+    }
+}
+
+void hoist_invariants(Graph* g) {
+    for (int l = 0; l < g->loops.count; l++) {
+        Loop* loop = g->loops.items[l];
+        if (!loop->preheader->reachable || !loop->header->reachable) continue;
+
+        VarSet assigned;
+        memset(&assigned, 0, sizeof(assigned));
+        for (int i = loop->header->id; i <= loop->last; i++) {
+            Block* b = BLOCK(g, i);
+            if (!b->reachable) continue;
+            int user_call = b->exit == EXIT_BRANCH && calls_user_function(b->value);
+            for (int s = 0; s < b->statements.count; s++) {
+                ASTNode* stmt = b->statements.items[s];
+                if (stmt->type == AST_ASSIGNMENT) set_add(&assigned, variable_id(stmt->assignment.name));
+                user_call |= calls_user_function(stmt);
+            }
+            if (user_call) {
+                VarSet globals = globals_set();
+                for (int w = 0; w < VAR_WORDS; w++) assigned.bits[w] |= globals.bits[w];
+            }
+        }
+
+        // Unassigned variables keep the types they had entering the loop
+        VarSet ints = loop->preheader->int_in;
+        for (int s = 0; s < loop->preheader->statements.count; s++) {
+            int_transfer(loop->preheader->statements.items[s], &ints);
+        }
+        for (int i = loop->header->id; i <= loop->last; i++) {
+            Block* b = BLOCK(g, i);
+            if (!b->reachable) continue;
+            for (int s = 0; s < b->statements.count; s++) {
+                hoist((ASTNode**)&b->statements.items[s], loop, &assigned, &ints);
+            }
+            if (b->exit == EXIT_BRANCH) hoist(&b->value, loop, &assigned, &ints);
+            if (b->exit == EXIT_RETURN) hoist(&b->value, loop, &assigned, &ints);
+        }
+    }
+}
+
+// Lowering
+
+// Skips blocks that hold nothing but a jump
+Block* jump_target(Graph* g, Block* b) {
+    for (int steps = 0; steps < g->blocks.count && b->statements.count == 0 && b->exit == EXIT_JUMP; steps++) {
+        b = b->succ[0];
+    }
+    return b;
+}
+
+Block* next_reachable(Graph* g, int i) {
+    for (i++; i < g->blocks.count; i++) {
+        if (BLOCK(g, i)->reachable) return BLOCK(g, i);
+    }
+    return NULL;
+}
+
+int block_label(Block* b) {
+    if (b->label < 0) b->label = new_label();
+    return b->label;
+}
+
+void lower_graph(Graph* g, IRBuffer* ir) {
+    for (int i = 0; i < g->blocks.count; i++) {
+        Block* b = BLOCK(g, i);
+        if (b->exit == EXIT_JUMP) b->succ[0] = jump_target(g, b->succ[0]);
+        if (b->exit == EXIT_BRANCH) {
+            b->succ[0] = jump_target(g, b->succ[0]);
+            b->succ[1] = jump_target(g, b->succ[1]);
+        }
+    }
+    find_reachable(g);
+
+    // Labels first, so backward and forward jumps both find them
+    for (int i = 0; i < g->blocks.count; i++) {
+        Block* b = BLOCK(g, i);
+        if (!b->reachable) continue;
+        Block* next = next_reachable(g, i);
+        if (b->exit == EXIT_JUMP && b->succ[0] != next) block_label(b->succ[0]);
+        if (b->exit == EXIT_BRANCH) {
+            block_label(b->succ[1]);
+            if (b->succ[0] != next) block_label(b->succ[0]);
+        }
+    }
+
+    int saved_line = emit_line;
+    int saved_column = emit_column;
+    for (int i = 0; i < g->blocks.count; i++) {
+        Block* b = BLOCK(g, i);
+        if (!b->reachable) {
+            cfg_stats[CFG_UNREACHABLE]++;
+            continue;
+        }
+        if (b->label >= 0) emit(ir, (Instruction){.opcode = OP_LABEL, .int_value = b->label, .operand_type = 'l'});
+        for (int s = 0; s < b->statements.count; s++) {
+            ASTNode* stmt = b->statements.items[s];
+            emit_node(stmt, ir);
+            if (is_expression(stmt)) emit(ir, (Instruction){.opcode = OP_POP});
+        }
+
+        if (b->line) {
+            emit_line = b->line;
+            emit_column = b->column;
+        }
+        Block* next = next_reachable(g, i);
+        switch (b->exit) {
+            case EXIT_JUMP:
+                if (b->succ[0] != next) {
+                    emit(ir, (Instruction){.opcode = OP_JMP, .int_value = block_label(b->succ[0]), .operand_type = 'l'});
+                }
+                break;
+            case EXIT_BRANCH:
+                emit_node(b->value, ir);
+                emit(ir, (Instruction){.opcode = OP_JMP_IF_FALSE, .int_value = block_label(b->succ[1]), .operand_type = 'l'});
+                if (b->succ[0] != next) {
+                    emit(ir, (Instruction){.opcode = OP_JMP, .int_value = block_label(b->succ[0]), .operand_type = 'l'});
+                }
+                break;
+            case EXIT_RETURN:
+                emit_node(b->value, ir);
+                break;
+            case EXIT_END:
+                emit_end(ir, g->function);
+                break;
+        }
+        emit_line = saved_line;
+        emit_column = saved_column;
+    }
+}
+
+void emit_cfg(ASTNode* body, IRBuffer* ir, int function) {
+    if (function < 0) memset(cfg_stats, 0, sizeof(cfg_stats));
+    enter_scope(function);
+
+    Graph g;
+    build_graph(&g, body, function);
+    find_reachable(&g);
+    // Folding after a rewrite can turn more assignments into copies and
+    // branches into jumps, which the next round sees
+    for (int round = 0; round < 4 && propagate_copies(&g) > 0; round++) {
+        find_reachable(&g);
+    }
+    analyze_ints(&g);
+    analyze_liveness(&g);
+    remove_dead_stores(&g);
+    analyze_ints(&g);     // removed stores no longer define anything
+    remove_dead_expressions(&g);
+    hoist_invariants(&g);
+    lower_graph(&g, ir);
+
+    arena_release(&cfg_arena);
+}
+
+void print_cfg_stats() {
+    printf("%-22s %s\n", "cfg", "count");
+    for (int i = 0; i < CFG_STAT_COUNT; i++) {
+        printf("%-22s %d\n", cfg_stat_names[i], cfg_stats[i]);
+    }
+}
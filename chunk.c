@@ -0,0 +1,197 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Constant pool
+
+unsigned int hash_constant(char type, int64_t int_value, const char* str_value) {
+    unsigned int h = 2166136261u;
+    if (type == 's') {
+        for (const char* p = str_value; *p; p++) {
+            h = (h ^ (unsigned char)*p) * 16777619u;
+        }
+    } else {
+        h = (h ^ (uint32_t)int_value) * 16777619u;
+        h = (h ^ (uint32_t)((uint64_t)int_value >> 32)) * 16777619u;
+    }
+    return h ^ (unsigned char)type;
+}
+
+void init_pool(ConstantPool* pool) {
+    pool->items = NULL;
+    pool->count = 0;
+    pool->capacity = 0;
+    pool->buckets = NULL;
+    pool->bucket_count = 0;
+}
+
+int constants_equal(Constant* c, char type, int64_t int_value, const char* str_value) {
+    if (c->type != type) return 0;
+    if (type == 's') return strcmp(c->str_value, str_value) == 0;
+    return c->int_value == int_value;
+}
+
+void rehash_pool(ConstantPool* pool, int bucket_count) {
+    free(pool->buckets);
+    pool->buckets = malloc(sizeof(int) * bucket_count);
+    pool->bucket_count = bucket_count;
+    for (int i = 0; i < bucket_count; i++) pool->buckets[i] = -1;
+
+    for (int i = 0; i < pool->count; i++) {
+        Constant* c = &pool->items[i];
+        unsigned int b = hash_constant(c->type, c->int_value, c->str_value) & (bucket_count - 1);
+        while (pool->buckets[b] != -1) b = (b + 1) & (bucket_count - 1);
+        pool->buckets[b] = i;
+    }
+}
+
+// Returns the index of an equal constant, adding it if it is new
+int intern_constant(ConstantPool* pool, char type, int64_t int_value, const char* str_value) {
+    if (pool->count * 2 >= pool->bucket_count) {
+        rehash_pool(pool, pool->bucket_count ? pool->bucket_count * 2 : 64);
+    }
+
+    unsigned int mask = pool->bucket_count - 1;
+    unsigned int b = hash_constant(type, int_value, str_value) & mask;
+    while (pool->buckets[b] != -1) {
+        if (constants_equal(&pool->items[pool->buckets[b]], type, int_value, str_value)) {
+            return pool->buckets[b];
+        }
+        b = (b + 1) & mask;
+    }
+
+    if (pool->count > 0xFFFF) {
+        printf("COMPILER ERROR: Too many constants (max %d)\n", 0xFFFF + 1);
+        exit(1);
+    }
+    if (pool->count == pool->capacity) {
+        pool->capacity = pool->capacity ? pool->capacity * 2 : 16;
+        pool->items = realloc(pool->items, sizeof(Constant) * pool->capacity);
+    }
+
+    Constant* c = &pool->items[pool->count];
+    c->type = type;
+    c->int_value = int_value;
+    c->str_value = NULL;
+    c->value = make_int(int_value);
+    if (type == 's') {
+        c->str_value = malloc(strlen(str_value) + 1);
+        strcpy(c->str_value, str_value);
+        c->value = make_string(intern_string(str_value, strlen(str_value)));
+    }
+    pool->buckets[b] = pool->count;
+    return pool->count++;
+}
+
+int add_int_constant(ConstantPool* pool, int64_t value) {
+    return intern_constant(pool, 'i', value, NULL);
+}
+
+int add_string_constant(ConstantPool* pool, const char* value) {
+    return intern_constant(pool, 's', 0, value);
+}
+
+// Bytecode buffer
+
+void init_chunk(Chunk* chunk) {
+    chunk->code = NULL;
+    chunk->count = 0;
+    chunk->capacity = 0;
+    init_pool(&chunk->constants);
+    chunk->functions = NULL;
+    chunk->function_count = 0;
+    chunk->lines = NULL;
+    chunk->line_count = 0;
+    chunk->image = NULL;
+    chunk->image_size = 0;
+}
+
+void write_byte(Chunk* chunk, uint8_t byte) {
+    if (chunk->count == chunk->capacity) {
+        chunk->capacity = chunk->capacity ? chunk->capacity * 2 : 256;
+        chunk->code = realloc(chunk->code, chunk->capacity);
+    }
+    chunk->code[chunk->count++] = byte;
+}
+
+void write_u16(Chunk* chunk, int value) {
+    write_byte(chunk, value & 0xFF);
+    write_byte(chunk, (value >> 8) & 0xFF);
+}
+
+void write_u32(Chunk* chunk, int value) {
+    for (int i = 0; i < 4; i++) {
+        write_byte(chunk, ((uint32_t)value >> (8 * i)) & 0xFF);
+    }
+}
+
+// Bytes that follow the opcode byte
+int operand_size(Opcode op) {
+    switch (op) {
+        case OP_LOAD_CONST:
+        case OP_LOAD_SLOT:
+        case OP_STORE_SLOT:
+        case OP_LOAD_LOCAL:
+        case OP_STORE_LOCAL:
+        case OP_CALL:
+        case OP_ARRAY:
+            return 2;
+        case OP_JMP:
+        case OP_JMP_IF_FALSE:
+        case OP_JMP_IF_NOT_EQ:
+        case OP_JMP_IF_NOT_NEQ:
+        case OP_JMP_IF_NOT_GT:
+        case OP_JMP_IF_NOT_LT:
+        case OP_JMP_IF_NOT_GTE:
+        case OP_JMP_IF_NOT_LTE:
+        case OP_ADD_SLOT_CONST:
+        case OP_SUB_SLOT_CONST:
+        case OP_LOAD_SLOT_ADD_CONST:
+        case OP_LOAD_SLOT_SUB_CONST:
+        case OP_LOAD_SLOT_CONST:
+        case OP_ADD_LOCAL_CONST:
+        case OP_SUB_LOCAL_CONST:
+        case OP_LOAD_LOCAL_ADD_CONST:
+        case OP_LOAD_LOCAL_SUB_CONST:
+        case OP_LOAD_LOCAL_CONST:
+        case OP_CALL_NATIVE:
+        case OP_CALL_BUILTIN:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+void free_chunk(Chunk* chunk) {
+    // A chunk loaded from the cache keeps its code, lines and strings in the image
+    if (chunk->image) {
+        release_image(chunk);
+    } else {
+        for (int i = 0; i < chunk->constants.count; i++) {
+            free(chunk->constants.items[i].str_value);
+        }
+        free(chunk->code);
+        free(chunk->lines);
+    }
+    free(chunk->constants.items);
+    free(chunk->constants.buckets);
+    free(chunk->functions);
+    init_chunk(chunk);
+}
+
+// Source position of the instruction containing offset; 0 when unknown
+LineInfo chunk_line(Chunk* chunk, int offset) {
+    LineInfo none = {offset, 0, 0};
+    int lo = 0, hi = chunk->line_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (chunk->lines[mid].offset <= offset) {
+            none = chunk->lines[mid];
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return none;
+}
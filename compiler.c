@@ -1,121 +1,629 @@
 #include "definitions.h"
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+
+// Variable name -> slot table, filled by resolve_symbols(). The VM only ever
+// sees slot numbers; names are kept for diagnostics and print_asm.
+char* slot_names[MAX_VARS];
+int slot_count = 0;
+
+// Functions are hoisted: resolve_symbols() registers every top-level
+// definition before looking at any call, so calls may precede definitions.
+Function functions[MAX_FUNCS];
+ASTNode* function_defs[MAX_FUNCS];
+int function_count = 0;
+
+// Names local to one function body; parameters come first
+typedef struct {
+    char* names[MAX_VARS];
+    int count;
+} Scope;
+
+Scope function_scopes[MAX_FUNCS];
+Scope* current_scope = NULL;   // NULL while compiling top-level code
+
+int find_slot(const char* name) {
+    for (int i = 0; i < slot_count; i++) {
+        if (strcmp(slot_names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+int define_slot(const char* name) {
+    int slot = find_slot(name);
+    if (slot >= 0) return slot;
+    if (slot_count >= MAX_VARS) {
+        printf("COMPILER ERROR: Too many variables (max %d)\n", MAX_VARS);
+        exit(1);
+    }
+    slot_names[slot_count] = malloc(strlen(name) + 1);
+    strcpy(slot_names[slot_count], name);
+    return slot_count++;
+}
+
+int find_local(Scope* scope, const char* name) {
+    if (!scope) return -1;
+    for (int i = 0; i < scope->count; i++) {
+        if (strcmp(scope->names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+int define_local(Scope* scope, const char* name) {
+    int local = find_local(scope, name);
+    if (local >= 0) return local;
+    if (scope->count >= MAX_VARS) {
+        printf("COMPILER ERROR: Too many locals in one function (max %d)\n", MAX_VARS);
+        exit(1);
+    }
+    scope->names[scope->count] = malloc(strlen(name) + 1);
+    strcpy(scope->names[scope->count], name);
+    return scope->count++;
+}
+
+int find_function(const char* name) {
+    for (int i = 0; i < function_count; i++) {
+        if (strcmp(functions[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+void declare_function(ASTNode* def) {
+    if (find_function(def->function_def.name) >= 0) {
+        printf("COMPILER ERROR: Function '%s' defined twice\n", def->function_def.name);
+        exit(1);
+    }
+    if (function_count >= MAX_FUNCS) {
+        printf("COMPILER ERROR: Too many functions (max %d)\n", MAX_FUNCS);
+        exit(1);
+    }
+    Function* f = &functions[function_count];
+    f->name = def->function_def.name;
+    f->param_count = def->function_def.param_count;
+    f->local_count = 0;
+    f->entry = -1;
+    function_defs[function_count++] = def;
+}
+
+// The parser builds a + b + c + ... as ((a + b) + c) + ..., so a long
+// generated expression is a chain of binary nodes down their left operands.
+// Passes walk such a chain with a loop over this stack instead of recursing
+// once per term: push_spine pushes the chain from the outermost node down,
+// so the entries from spine_top - 1 back to the returned base run in
+// evaluation order, and the pass pops back to base when it is done. Passes
+// hold indices, not pointers, since nested chains may grow the stack.
+ASTNode** spine = NULL;
+int spine_top = 0;
+int spine_capacity = 0;
+
+int push_spine(ASTNode* node) {
+    int base = spine_top;
+    while (node->type == AST_BINARY_OP) {
+        if (spine_top == spine_capacity) {
+            spine_capacity = spine_capacity ? spine_capacity * 2 : 256;
+            spine = realloc(spine, sizeof(ASTNode*) * spine_capacity);
+        }
+        spine[spine_top++] = node;
+        node = node->binary.left;
+    }
+    return base;
+}
+
+int resolve_depth = 0;
+
+// Walks the tree in source order, giving each assigned variable a slot and
+// rejecting reads of names that are never assigned before they are used.
+// Inside a function body, names resolve to locals first and globals second;
+// assigning a name that is not already a global creates a local.
+void resolve_node(ASTNode* node) {
+    if (!node) return;
+    // Every later pass recurses as deep as this one, so this is where too
+    // deep a program stops rather than overflowing the C stack
+    if (++resolve_depth > MAX_NESTING) {
+        printf("COMPILER ERROR: Code nested more than %d levels deep at line %u, column %u\n", MAX_NESTING,
+               node->line, node->column);
+        exit(1);
+    }
+    switch (node->type) {
+        case AST_VARIABLE:
+            if (find_local(current_scope, node->name) < 0 && find_slot(node->name) < 0) {
+                printf("COMPILER ERROR: Undefined variable '%s'\n", node->name);
+                exit(1);
+            }
+            break;
+        case AST_ASSIGNMENT:
+            resolve_node(node->assignment.value);
+            if (!current_scope) {
+                define_slot(node->assignment.name);
+            } else if (find_slot(node->assignment.name) < 0) {
+                define_local(current_scope, node->assignment.name);
+            }
+            break;
+        case AST_BINARY_OP: {
+            int base = push_spine(node);
+            resolve_node(spine[spine_top - 1]->binary.left);
+            for (int i = spine_top - 1; i >= base; i--) resolve_node(spine[i]->binary.right);
+            spine_top = base;
+            break;
+        }
+        case AST_IF:
+            resolve_node(node->if_stmt.condition);
+            resolve_node(node->if_stmt.then_branch);
+            resolve_node(node->if_stmt.else_branch);
+            break;
+        case AST_WHILE:
+            resolve_node(node->while_stmt.condition);
+            resolve_node(node->while_stmt.body);
+            break;
+        case AST_RETURN:
+            if (!current_scope) {
+                printf("COMPILER ERROR: 'return' outside of a function\n");
+                exit(1);
+            }
+            resolve_node(node->return_stmt.value);
+            break;
+        case AST_BLOCK:
+            for (int i = 0; i < node->block.count; i++) {
+                resolve_node(node->block.statements[i]);
+            }
+            break;
+        case AST_FUNCTION_CALL: {
+            int f = find_function(node->function_call.name);
+            if (f >= 0 && functions[f].param_count != node->function_call.arg_count) {
+                printf("COMPILER ERROR: '%s' takes %d arguments, %d given\n", node->function_call.name,
+                       functions[f].param_count, node->function_call.arg_count);
+                exit(1);
+            }
+            for (int i = 0; i < node->function_call.arg_count; i++) {
+                resolve_node(node->function_call.args[i]);
+            }
+            break;
+        }
+        case AST_ARRAY:
+            for (int i = 0; i < node->array.count; i++) {
+                resolve_node(node->array.elements[i]);
+            }
+            break;
+        case AST_INDEX:
+        case AST_INDEX_ASSIGNMENT:
+            resolve_node(node->index.array);
+            resolve_node(node->index.index);
+            resolve_node(node->index.value);
+            break;
+        case AST_FUNCTION_DEF:
+            // Bodies are resolved after all top-level code, see resolve_symbols.
+            // Only direct statements of the program block (depth 2) are
+            // declared there; a def nested in an if or while would never run.
+            if (current_scope || resolve_depth != 2) {
+                printf("COMPILER ERROR: Function '%s' must be defined at top level\n", node->function_def.name);
+                exit(1);
+            }
+            break;
+        default:
+            break;
+    }
+    resolve_depth--;
+}
+
+// Compiler-made variables are named $tN, which no script can spell
+int temporary_count = 0;
+
+// Forgets every slot, function and local so another program can be resolved
+void reset_symbols() {
+    for (int i = 0; i < slot_count; i++) free(slot_names[i]);
+    slot_count = 0;
+    for (int f = 0; f < function_count; f++) {
+        for (int i = 0; i < function_scopes[f].count; i++) free(function_scopes[f].names[i]);
+        function_scopes[f].count = 0;
+    }
+    function_count = 0;
+    current_scope = NULL;
+    temporary_count = 0;
+    resolve_depth = 0;
+}
+
+void resolve_symbols(ASTNode* program) {
+    reset_symbols();
+    if (program->type == AST_BLOCK) {
+        for (int i = 0; i < program->block.count; i++) {
+            if (program->block.statements[i]->type == AST_FUNCTION_DEF) {
+                declare_function(program->block.statements[i]);
+            }
+        }
+    }
+
+    current_scope = NULL;
+    resolve_node(program);
+
+    // Every global is known by now, so bodies can refer to ones assigned later
+    for (int i = 0; i < function_count; i++) {
+        ASTNode* def = function_defs[i];
+        current_scope = &function_scopes[i];
+        for (int p = 0; p < def->function_def.param_count; p++) {
+            if (find_local(current_scope, def->function_def.params[p]) >= 0) {
+                printf("COMPILER ERROR: Duplicate parameter '%s' in '%s'\n",
+                       def->function_def.params[p], def->function_def.name);
+                exit(1);
+            }
+            define_local(current_scope, def->function_def.params[p]);
+        }
+        resolve_node(def->function_def.body);
+        functions[i].local_count = current_scope->count;
+    }
+    current_scope = NULL;
+}
+
+int slot_of(const char* name) {
+    int slot = find_slot(name);
+    if (slot < 0) {
+        printf("COMPILER ERROR: Variable '%s' has no slot, run resolve_symbols first\n", name);
+        exit(1);
+    }
+    return slot;
+}
+
+// Scope names resolve in from here on: a function index, or -1 for top-level code
+void enter_scope(int function) {
+    current_scope = function >= 0 ? &function_scopes[function] : NULL;
+}
+
+// Dense id of a resolved name: locals of the current function are
+// 0..MAX_VARS-1, globals are MAX_VARS + slot
+int variable_id(const char* name) {
+    int local = find_local(current_scope, name);
+    return local >= 0 ? local : MAX_VARS + slot_of(name);
+}
+
+// Adds a compiler-only variable to the current scope: a local inside a
+// function, a global slot at top level. NULL when the scope is full.
+const char* new_temporary() {
+    char name[16];
+    int length = snprintf(name, sizeof(name), "$t%d", temporary_count++);
+    const char* interned = intern_string(name, length)->chars;
+    if (current_scope) {
+        if (current_scope->count >= MAX_VARS) return NULL;
+        define_local(current_scope, interned);
+        functions[current_scope - function_scopes].local_count = current_scope->count;
+    } else {
+        if (slot_count >= MAX_VARS) return NULL;
+        define_slot(interned);
+    }
+    return interned;
+}
+
+void init_ir(IRBuffer* ir) {
+    ir->code = NULL;
+    ir->count = 0;
+    ir->capacity = 0;
+    init_pool(&ir->constants);
+    ir->functions = NULL;
+    ir->function_count = 0;
+}
+
+// Source position stamped on emitted instructions; emit_node() keeps it on
+// the node being compiled so the line table can map offsets back to source
+int emit_line = 0;
+int emit_column = 0;
+
+void emit(IRBuffer* ir, Instruction instr) {
+    if (!instr.line) {
+        instr.line = emit_line;
+        instr.column = emit_column;
+    }
+    if (ir->count == ir->capacity) {
+        ir->capacity = ir->capacity ? ir->capacity * 2 : 256;
+        ir->code = realloc(ir->code, sizeof(Instruction) * ir->capacity);
+    }
+    ir->code[ir->count++] = instr;
+}
+
+// Labels are symbolic until link_program() turns them into real offsets
+int label_count = 0;
+
+int new_label() {
+    return label_count++;
+}
+
+void emit_load(IRBuffer* ir, const char* name) {
+    int local = find_local(current_scope, name);
+    if (local >= 0) {
+        emit(ir, (Instruction){.opcode = OP_LOAD_LOCAL, .int_value = local, .operand_type = 'v'});
+    } else {
+        emit(ir, (Instruction){.opcode = OP_LOAD_SLOT, .int_value = slot_of(name), .operand_type = 'v'});
+    }
+}
+
+void emit_store(IRBuffer* ir, const char* name) {
+    int local = find_local(current_scope, name);
+    if (local >= 0) {
+        emit(ir, (Instruction){.opcode = OP_STORE_LOCAL, .int_value = local, .operand_type = 'v'});
+    } else {
+        emit(ir, (Instruction){.opcode = OP_STORE_SLOT, .int_value = slot_of(name), .operand_type = 'v'});
+    }
+}
+
+// Expressions used as statements leave their value on the stack
+int is_expression(ASTNode* node) {
+    switch (node->type) {
+        case AST_NUMBER:
+        case AST_STRING:
+        case AST_VARIABLE:
+        case AST_BINARY_OP:
+        case AST_FUNCTION_CALL:
+        case AST_ARRAY:
+        case AST_INDEX:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+Opcode binary_opcode(char op) {
+    switch (op) {
+        case '+': return OP_ADD;
+        case '-': return OP_SUB;
+        case '*': return OP_MUL;
+        case '/': return OP_DIV;
+        case '>': return OP_GT;
+        case '<': return OP_LT;
+        case '=': return OP_EQ;
+        case '!': return OP_NEQ;
+        case 'G': return OP_GTE;
+        case 'L': return OP_LTE;
+    }
+    printf("COMPILER ERROR: Unknown binary operator '%c'\n", op);
+    exit(1);
+}
+
+void emit_node(ASTNode* node, IRBuffer* ir) {
+    int saved_line = emit_line;
+    int saved_column = emit_column;
+    if (node->line) {
+        emit_line = node->line;
+        emit_column = node->column;
+    }
 
-void emit_node(ASTNode* node, Instruction* code, int* ip) {
     switch (node->type) {
         case AST_NUMBER:
-            code[(*ip)++] = (Instruction){OP_LOAD_CONST, .int_value = node->number, .operand_type = 'i'};
+            emit(ir, (Instruction){.opcode = OP_LOAD_CONST, .int_value = add_int_constant(&ir->constants, node->number), .operand_type = 'k'});
             break;
 
         case AST_VARIABLE:
-            code[(*ip)++] = (Instruction){OP_LOAD_VAR, .str_value = "", .operand_type = 'v'};
-            strcpy(code[*ip - 1].str_value, node->name);
+            emit_load(ir, node->name);
             break;
 
         case AST_ASSIGNMENT:
-            emit_node(node->assignment.value, code, ip);
-            code[(*ip)++] = (Instruction){OP_STORE_VAR, .str_value = "", .operand_type = 'v'};
-            strcpy(code[*ip - 1].str_value, node->assignment.name);
+            emit_node(node->assignment.value, ir);
+            emit_store(ir, node->assignment.name);
             break;
 
-        case AST_BINARY_OP:
-            emit_node(node->binary.left, code, ip);
-            emit_node(node->binary.right, code, ip);
-            switch (node->binary.op) {
-                case '+': code[(*ip)++] = (Instruction){OP_ADD}; break;
-                case '-': code[(*ip)++] = (Instruction){OP_SUB}; break;
-                case '*': code[(*ip)++] = (Instruction){OP_MUL}; break;
-                case '/': code[(*ip)++] = (Instruction){OP_DIV}; break;
-                case '>': code[(*ip)++] = (Instruction){OP_GT}; break;
-                case '<': code[(*ip)++] = (Instruction){OP_LT}; break;
-                case '=': code[(*ip)++] = (Instruction){OP_EQ}; break;
-                case '!': code[(*ip)++] = (Instruction){OP_NEQ}; break;
+        case AST_BINARY_OP: {
+            int base = push_spine(node);
+            emit_node(spine[spine_top - 1]->binary.left, ir);
+            for (int i = spine_top - 1; i >= base; i--) {
+                ASTNode* op = spine[i];
+                emit_node(op->binary.right, ir);
+                if (op->line) {
+                    emit_line = op->line;
+                    emit_column = op->column;
+                }
+                emit(ir, (Instruction){.opcode = binary_opcode(op->binary.op)});
             }
+            spine_top = base;
             break;
+        }
 
         case AST_IF: {
-            int label_id = (*ip);
-            emit_node(node->if_stmt.condition, code, ip);
-            code[(*ip)++] = (Instruction){OP_JMP_IF_FALSE, .int_value = label_id + 100, .operand_type = 'i'};
-            emit_node(node->if_stmt.then_branch, code, ip);
+            int label_else = new_label();
+            emit_node(node->if_stmt.condition, ir);
+            emit(ir, (Instruction){.opcode = OP_JMP_IF_FALSE, .int_value = label_else, .operand_type = 'l'});
+            emit_node(node->if_stmt.then_branch, ir);
             if (node->if_stmt.else_branch) {
-                code[(*ip)++] = (Instruction){OP_JMP, .int_value = label_id + 200, .operand_type = 'i'};
-                code[(*ip)++] = (Instruction){OP_LABEL, .int_value = label_id + 100, .operand_type = 'i'};
-                emit_node(node->if_stmt.else_branch, code, ip);
-                code[(*ip)++] = (Instruction){OP_LABEL, .int_value = label_id + 200, .operand_type = 'i'};
+                int label_end = new_label();
+                emit(ir, (Instruction){.opcode = OP_JMP, .int_value = label_end, .operand_type = 'l'});
+                emit(ir, (Instruction){.opcode = OP_LABEL, .int_value = label_else, .operand_type = 'l'});
+                emit_node(node->if_stmt.else_branch, ir);
+                emit(ir, (Instruction){.opcode = OP_LABEL, .int_value = label_end, .operand_type = 'l'});
             } else {
-                code[(*ip)++] = (Instruction){OP_LABEL, .int_value = label_id + 100, .operand_type = 'i'};
+                emit(ir, (Instruction){.opcode = OP_LABEL, .int_value = label_else, .operand_type = 'l'});
             }
             break;
         }
 
         case AST_WHILE: {
-            int label_start = (*ip);
-            int label_end = label_start + 100;
-            code[(*ip)++] = (Instruction){OP_LABEL, .int_value = label_start, .operand_type = 'i'};
-            emit_node(node->while_stmt.condition, code, ip);
-            code[(*ip)++] = (Instruction){OP_JMP_IF_FALSE, .int_value = label_end, .operand_type = 'i'};
-            emit_node(node->while_stmt.body, code, ip);
-            code[(*ip)++] = (Instruction){OP_JMP, .int_value = label_start, .operand_type = 'i'};
-            code[(*ip)++] = (Instruction){OP_LABEL, .int_value = label_end, .operand_type = 'i'};
+            int label_start = new_label();
+            int label_end = new_label();
+            emit(ir, (Instruction){.opcode = OP_LABEL, .int_value = label_start, .operand_type = 'l'});
+            emit_node(node->while_stmt.condition, ir);
+            emit(ir, (Instruction){.opcode = OP_JMP_IF_FALSE, .int_value = label_end, .operand_type = 'l'});
+            emit_node(node->while_stmt.body, ir);
+            emit(ir, (Instruction){.opcode = OP_JMP, .int_value = label_start, .operand_type = 'l'});
+            emit(ir, (Instruction){.opcode = OP_LABEL, .int_value = label_end, .operand_type = 'l'});
             break;
         }
 
         case AST_RETURN:
-            emit_node(node->return_stmt.value, code, ip);
-            code[(*ip)++] = (Instruction){OP_RET};
+            emit_node(node->return_stmt.value, ir);
+            emit(ir, (Instruction){.opcode = OP_RET});
             break;
 
         case AST_BLOCK:
             for (int i = 0; i < node->block.count; i++) {
-                emit_node(node->block.statements[i], code, ip);
+                emit_node(node->block.statements[i], ir);
+                if (is_expression(node->block.statements[i])) {
+                    emit(ir, (Instruction){.opcode = OP_POP});
+                }
             }
             break;
 
-        case AST_FUNCTION_CALL:
+        case AST_FUNCTION_CALL: {
+            // Arguments stay on the stack and become the callee's first locals
             for (int i = 0; i < node->function_call.arg_count; i++) {
-                emit_node(node->function_call.args[i], code, ip);  // Emit value (e.g., string)
-                code[(*ip)++] = (Instruction){OP_PUSH};            // Push it
+                emit_node(node->function_call.args[i], ir);
+            }
+            int f = find_function(node->function_call.name);
+            int b = f < 0 ? resolve_builtin(node->function_call.name, node->function_call.arg_count) : -1;
+            if (f >= 0) {
+                emit(ir, (Instruction){.opcode = OP_CALL, .int_value = f, .operand_type = 'f'});
+            } else if (b >= 0) {
+                emit(ir, (Instruction){.opcode = OP_CALL_BUILTIN, .int_value = b,
+                    .extra_value = node->function_call.arg_count, .operand_type = 'b'});
+            } else {
+                // Unknown names compile to a call that reports them when reached
+                emit(ir, (Instruction){.opcode = OP_CALL_NATIVE,
+                    .int_value = add_string_constant(&ir->constants, node->function_call.name),
+                    .extra_value = node->function_call.arg_count, .operand_type = 'k'});
             }
-            code[(*ip)++] = (Instruction){OP_CALL, .operand_type = 's'};
-            strcpy(code[*ip - 1].str_value, node->function_call.name);
             break;
-                
+        }
+
         case AST_STRING:
-            code[(*ip)++] = (Instruction){
-                OP_LOAD_CONST,
-                .operand_type = 's'
-            };
-            strcpy(code[*ip - 1].str_value, node->string);
+            emit(ir, (Instruction){.opcode = OP_LOAD_CONST, .int_value = add_string_constant(&ir->constants, node->string), .operand_type = 'k'});
+            break;
+
+        case AST_ARRAY:
+            if (node->array.count > 0xFFFF) {
+                printf("COMPILER ERROR: Array literal has %d elements, at most 65535 are allowed\n", node->array.count);
+                exit(1);
+            }
+            for (int i = 0; i < node->array.count; i++) {
+                emit_node(node->array.elements[i], ir);
+            }
+            emit(ir, (Instruction){.opcode = OP_ARRAY, .int_value = node->array.count});
+            break;
+
+        case AST_INDEX:
+            emit_node(node->index.array, ir);
+            emit_node(node->index.index, ir);
+            emit(ir, (Instruction){.opcode = OP_INDEX});
+            break;
+
+        case AST_INDEX_ASSIGNMENT:
+            emit_node(node->index.array, ir);
+            emit_node(node->index.index, ir);
+            emit_node(node->index.value, ir);
+            emit(ir, (Instruction){.opcode = OP_STORE_INDEX});
+            break;
+
+        case AST_FUNCTION_DEF:
+            // Emitted out of line by emit_program
             break;
 
         default:
             // Handle other types as needed
             break;
     }
+
+    emit_line = saved_line;
+    emit_column = saved_column;
+}
+
+// What ends a body: OP_HALT for top-level code (function -1); falling off
+// the end of a function returns 0
+void emit_end(IRBuffer* ir, int function) {
+    if (function < 0) {
+        emit(ir, (Instruction){.opcode = OP_HALT});
+    } else {
+        emit(ir, (Instruction){.opcode = OP_LOAD_CONST, .int_value = add_int_constant(&ir->constants, 0), .operand_type = 'k'});
+        emit(ir, (Instruction){.opcode = OP_RET});
+    }
+}
+
+// Bodies go through the basic-block optimizer (cfg.c) unless it is off
+int use_cfg = 1;
+
+void emit_body(ASTNode* body, IRBuffer* ir, int function) {
+    if (use_cfg) {
+        emit_cfg(body, ir, function);
+    } else {
+        emit_node(body, ir);
+        emit_end(ir, function);
+    }
+}
+
+// Emits top-level code, an OP_HALT, then every function body. Each body
+// starts at a label that link_program() turns into the function's entry.
+void emit_program(ASTNode* program, IRBuffer* ir) {
+    current_scope = NULL;
+    emit_body(program, ir, -1);
+
+    for (int i = 0; i < function_count; i++) {
+        int entry = new_label();
+        functions[i].entry = entry;
+        current_scope = &function_scopes[i];
+        emit_line = function_defs[i]->line;
+        emit_column = function_defs[i]->column;
+        emit(ir, (Instruction){.opcode = OP_LABEL, .int_value = entry, .operand_type = 'l'});
+        emit_body(function_defs[i]->function_def.body, ir, i);
+    }
+    current_scope = NULL;
+
+    ir->function_count = function_count;
+    ir->functions = malloc(sizeof(Function) * (function_count > 0 ? function_count : 1));
+    memcpy(ir->functions, functions, sizeof(Function) * function_count);
+}
+
+
+
+void print_constant(Constant* c) {
+    if (c->type == 's') {
+        printf("\"%s\"", c->str_value);
+    } else {
+        printf("%lld", (long long)c->int_value);
+    }
 }
 
+const char* opcode_names[] = {
+    [OP_LOAD_CONST] = "LOAD_CONST", [OP_LOAD_SLOT] = "LOAD_SLOT", [OP_STORE_SLOT] = "STORE_SLOT",
+    [OP_ADD] = "ADD", [OP_SUB] = "SUB", [OP_MUL] = "MUL", [OP_DIV] = "DIV",
+    [OP_JMP] = "JMP", [OP_JMP_IF_FALSE] = "JMP_IF_FALSE", [OP_LABEL] = "LABEL",
+    [OP_CALL] = "CALL", [OP_RET] = "RET", [OP_POP] = "POP", [OP_PUSH] = "PUSH",
+    [OP_EQ] = "EQ", [OP_NEQ] = "NEQ", [OP_GT] = "GT", [OP_LT] = "LT", [OP_GTE] = "GTE", [OP_LTE] = "LTE",
+    [OP_PRINT] = "PRINT", [OP_LOAD_LOCAL] = "LOAD_LOCAL", [OP_STORE_LOCAL] = "STORE_LOCAL",
+    [OP_CALL_NATIVE] = "CALL_NATIVE", [OP_CALL_BUILTIN] = "CALL_BUILTIN", [OP_HALT] = "HALT",
+    [OP_ARRAY] = "ARRAY", [OP_INDEX] = "INDEX", [OP_STORE_INDEX] = "STORE_INDEX",
+    [OP_ADD_SLOT_CONST] = "ADD_SLOT_CONST", [OP_SUB_SLOT_CONST] = "SUB_SLOT_CONST",
+    [OP_LOAD_SLOT_ADD_CONST] = "LOAD_SLOT_ADD_CONST", [OP_LOAD_SLOT_SUB_CONST] = "LOAD_SLOT_SUB_CONST",
+    [OP_LOAD_SLOT_CONST] = "LOAD_SLOT_CONST",
+    [OP_ADD_LOCAL_CONST] = "ADD_LOCAL_CONST", [OP_SUB_LOCAL_CONST] = "SUB_LOCAL_CONST",
+    [OP_LOAD_LOCAL_ADD_CONST] = "LOAD_LOCAL_ADD_CONST", [OP_LOAD_LOCAL_SUB_CONST] = "LOAD_LOCAL_SUB_CONST",
+    [OP_LOAD_LOCAL_CONST] = "LOAD_LOCAL_CONST",
+    [OP_JMP_IF_NOT_EQ] = "JMP_IF_NOT_EQ", [OP_JMP_IF_NOT_NEQ] = "JMP_IF_NOT_NEQ",
+    [OP_JMP_IF_NOT_GT] = "JMP_IF_NOT_GT", [OP_JMP_IF_NOT_LT] = "JMP_IF_NOT_LT",
+    [OP_JMP_IF_NOT_GTE] = "JMP_IF_NOT_GTE", [OP_JMP_IF_NOT_LTE] = "JMP_IF_NOT_LTE",
+};
 
+// Disassembles a bytecode chunk; addresses are byte offsets
+void print_asm(Chunk* chunk) {
+    printf("; %d bytes, %d constants\n", chunk->count, chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        printf(";   #%d = ", i);
+        print_constant(&chunk->constants.items[i]);
+        printf("\n");
+    }
+    for (int i = 0; i < chunk->function_count; i++) {
+        Function* f = &chunk->functions[i];
+        printf(";   func %s: entry %04d, %d params, %d locals\n", f->name, f->entry, f->param_count, f->local_count);
+    }
 
-void print_asm(Instruction* program, int count) {
-    for (int i = 0; i < count; i++) {
-        Instruction instr = program[i];
-        printf("%04d: ", i);  // Instruction index
+    int ip = 0;
+    while (ip < chunk->count) {
+        Opcode op = chunk->code[ip];
+        const uint8_t* operand = chunk->code + ip + 1;
+        printf("%04d: ", ip);  // Byte offset
 
-        switch (instr.opcode) {
+        switch (op) {
             case OP_LOAD_CONST:
-                if (instr.operand_type == 'i') {
-                    printf("LOAD_CONST %d\n", instr.int_value);
-                } else if (instr.operand_type == 's') {
-                    printf("LOAD_CONST \"%s\"\n", instr.str_value);
-                }
+                printf("LOAD_CONST #%d ", read_u16(operand));
+                print_constant(&chunk->constants.items[read_u16(operand)]);
+                printf("\n");
                 break;
-            case OP_LOAD_VAR:
-                printf("LOAD_VAR %s\n", instr.str_value);
+            case OP_LOAD_SLOT:
+                printf("LOAD_SLOT %d (%s)\n", read_u16(operand), slot_names[read_u16(operand)]);
                 break;
-            case OP_STORE_VAR:
-                printf("STORE_VAR %s\n", instr.str_value);
+            case OP_STORE_SLOT:
+                printf("STORE_SLOT %d (%s)\n", read_u16(operand), slot_names[read_u16(operand)]);
                 break;
             case OP_ADD:
                 printf("ADD\n");
@@ -148,16 +656,39 @@ void print_asm(Instruction* program, int count) {
                 printf("LTE\n");
                 break;
             case OP_JMP:
-                printf("JMP %d\n", instr.int_value);
+                printf("JMP %04d\n", read_u32(operand));
                 break;
             case OP_JMP_IF_FALSE:
-                printf("JMP_IF_FALSE %d\n", instr.int_value);
-                break;
-            case OP_LABEL:
-                printf("LABEL %d\n", instr.int_value);
+                printf("JMP_IF_FALSE %04d\n", read_u32(operand));
                 break;
             case OP_CALL:
-                printf("CALL %s\n", instr.str_value);
+                printf("CALL %s (#%d)\n", chunk->functions[read_u16(operand)].name, read_u16(operand));
+                break;
+            case OP_CALL_NATIVE:
+                printf("CALL_NATIVE %s, %d args\n", chunk->constants.items[read_u16(operand)].str_value,
+                       read_u16(operand + 2));
+                break;
+            case OP_CALL_BUILTIN:
+                printf("CALL_BUILTIN %s (#%d), %d args\n", builtins[read_u16(operand)].name, read_u16(operand),
+                       read_u16(operand + 2));
+                break;
+            case OP_LOAD_LOCAL:
+                printf("LOAD_LOCAL %d\n", read_u16(operand));
+                break;
+            case OP_STORE_LOCAL:
+                printf("STORE_LOCAL %d\n", read_u16(operand));
+                break;
+            case OP_HALT:
+                printf("HALT\n");
+                break;
+            case OP_ARRAY:
+                printf("ARRAY %d\n", read_u16(operand));
+                break;
+            case OP_INDEX:
+                printf("INDEX\n");
+                break;
+            case OP_STORE_INDEX:
+                printf("STORE_INDEX\n");
                 break;
             case OP_RET:
                 printf("RET\n");
@@ -171,10 +702,48 @@ void print_asm(Instruction* program, int count) {
             case OP_PRINT:
                 printf("PRINT\n");
                 break;
+            case OP_ADD_SLOT_CONST:
+            case OP_SUB_SLOT_CONST:
+            case OP_LOAD_SLOT_ADD_CONST:
+            case OP_LOAD_SLOT_SUB_CONST:
+            case OP_LOAD_SLOT_CONST:
+                printf("%s %d (%s), #%d ", opcode_names[op], read_u16(operand), slot_names[read_u16(operand)],
+                       read_u16(operand + 2));
+                print_constant(&chunk->constants.items[read_u16(operand + 2)]);
+                printf("\n");
+                break;
+            case OP_ADD_LOCAL_CONST:
+            case OP_SUB_LOCAL_CONST:
+            case OP_LOAD_LOCAL_ADD_CONST:
+            case OP_LOAD_LOCAL_SUB_CONST:
+            case OP_LOAD_LOCAL_CONST:
+                printf("%s %d, #%d ", opcode_names[op], read_u16(operand), read_u16(operand + 2));
+                print_constant(&chunk->constants.items[read_u16(operand + 2)]);
+                printf("\n");
+                break;
+            case OP_JMP_IF_NOT_EQ:
+                printf("JMP_IF_NOT_EQ %04d\n", read_u32(operand));
+                break;
+            case OP_JMP_IF_NOT_NEQ:
+                printf("JMP_IF_NOT_NEQ %04d\n", read_u32(operand));
+                break;
+            case OP_JMP_IF_NOT_GT:
+                printf("JMP_IF_NOT_GT %04d\n", read_u32(operand));
+                break;
+            case OP_JMP_IF_NOT_LT:
+                printf("JMP_IF_NOT_LT %04d\n", read_u32(operand));
+                break;
+            case OP_JMP_IF_NOT_GTE:
+                printf("JMP_IF_NOT_GTE %04d\n", read_u32(operand));
+                break;
+            case OP_JMP_IF_NOT_LTE:
+                printf("JMP_IF_NOT_LTE %04d\n", read_u32(operand));
+                break;
             default:
-                printf("UNKNOWN OPCODE\n");
+                printf("UNKNOWN OPCODE %d\n", op);
                 break;
         }
+        ip += 1 + operand_size(op);
     }
 }
 
@@ -199,10 +768,12 @@ void print_asm(Instruction* program, int count) {
     };
 
     // Emit and print
-    Instruction program[32];
-    int ip = 0;
-    emit_node(&assignment, program, &ip);
-    print_asm(program, ip);
+    IRBuffer ir;
+    Chunk chunk;
+    init_ir(&ir);
+    emit_node(&assignment, &ir);
+    assemble_program(&ir, &chunk);
+    print_asm(&chunk);
     return 0;
 }
 */
\ No newline at end of file
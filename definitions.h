@@ -1,4 +1,5 @@
-#define MAX_TOKENS 1000
+#include <stdint.h>
+#include <stddef.h>
 
 void tokenize(const char* input);
 
@@ -28,18 +29,59 @@ typedef enum {
     TOKEN_STRING, //type 19
     TOKEN_EOF, //type 20
     TOKEN_COMMA, //type 21, for func call arg
-    TOKEN_KEYWORD_RETURN // type 22, for func return
+    TOKEN_KEYWORD_RETURN, // type 22, for func return
+    TOKEN_BRACKET_OPEN, // type 23, array literal and index
+    TOKEN_BRACKET_CLOSE // type 24
 } TokenType;
 
+// 16 bytes: the lexeme is source[start, start + length); string tokens
+// cover the raw text between the quotes, escapes still encoded
 typedef struct {
-    TokenType type;
-    char lexeme[32];
-    int value;
+    uint8_t type;      // TokenType
     char op;
-    int line;     // ✅ NEW: line number
-    int column;   // ✅ NEW: character position in line
+    uint16_t column;   // character position in line, saturates at 65535
+    uint32_t start;
+    uint32_t length;
+    uint32_t line;
 } Token;
 
+extern const char* token_source;
+const char* token_text(Token t);
+const char* token_name(Token t);
+int64_t token_number(Token t);
+const char* token_string(Token t);
+
+typedef struct {
+    const char* input;
+    int length;   // bytes before the terminating NUL
+    int pos;
+    int line;
+    int column;
+} Lexer;
+
+void init_lexer(Lexer* lx, const char* input);
+Token scan_token(Lexer* lx);
+Token scan_token_reference(Lexer* lx);
+
+// The parser reads tokens through token_at(): from the array tokenize()
+// filled, or scanned on demand after begin_token_stream()
+extern int token_stream;
+void begin_token_stream(const char* input);
+Token token_at(int index);
+int tokens_remaining(int index);
+
+// Script input: mapped from a file (or from stdin when path is "-" and stdin
+// is redirected from one), otherwise read into memory. text is always
+// NUL-terminated, which the lexer relies on.
+typedef struct {
+    const char* text;
+    size_t size;
+    int mapped;
+} Source;
+
+Source load_source(const char* path);
+void release_source(Source* source);
+
 typedef enum {
     AST_NUMBER,
     AST_STRING,
@@ -51,22 +93,31 @@ typedef enum {
     AST_FUNCTION_DEF,
     AST_FUNCTION_CALL,
     AST_BLOCK,
-    AST_RETURN
+    AST_RETURN,
+    AST_ARRAY,              // [a, b, c]
+    AST_INDEX,              // array[index]
+    AST_INDEX_ASSIGNMENT    // array[index] = value
 } ASTNodeType;
 typedef struct ASTNode ASTNode;
+
+// Nodes live in the parse arena and are only as large as their kind needs
+// (see new_node in ast.c); names and strings are interned and not owned by
+// the tree. The lists are ArenaVecs in the same arena.
 typedef struct ASTNode {
-    ASTNodeType type;
+    uint8_t type;       // ASTNodeType
+    uint16_t column;    // source position of the token the node starts at
+    uint32_t line;
     union {
-        int number;
-        char string[256];
-        char name[32];
+        int64_t number;    // always within INT_VALUE_MIN..INT_VALUE_MAX
+        const char* string;
+        const char* name;
         struct {
             char op;
             struct ASTNode* left;
             struct ASTNode* right;
         } binary;
         struct {
-            char name[32];
+            const char* name;
             struct ASTNode* value;
         } assignment;
         struct {
@@ -79,13 +130,13 @@ typedef struct ASTNode {
             struct ASTNode* body;
         } while_stmt;
         struct {
-            char name[32];
-            char** params;           // array of parameter names
+            const char* name;
+            const char** params;     // array of parameter names
             int param_count;
             struct ASTNode* body;
         } function_def;
         struct {
-            char name[32];
+            const char* name;
             struct ASTNode** args;  // array of arguments
             int arg_count;
         } function_call;
@@ -96,34 +147,76 @@ typedef struct ASTNode {
         struct {
             struct ASTNode* value;
         } return_stmt;
+        struct {
+            struct ASTNode** elements;
+            int count;
+        } array;
+        struct {
+            struct ASTNode* array;
+            struct ASTNode* index;
+            struct ASTNode* value;  // only for AST_INDEX_ASSIGNMENT
+        } index;
     };
 } ASTNode;
 
-extern Token tokens[];
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* head;   // newest block; allocations come from here
+    size_t used;        // bytes handed out, for statistics
+} Arena;
+
+void init_arena(Arena* arena);
+void* arena_alloc(Arena* arena, size_t size);
+void arena_release(Arena* arena);
+
+// Growable list of pointers kept in an arena. Outgrown storage is left
+// behind and reclaimed with the arena, unless the list is the arena's most
+// recent allocation, in which case it is extended in place.
+typedef struct {
+    void** items;
+    int count;
+    int capacity;
+} ArenaVec;
+
+void vec_init(Arena* arena, ArenaVec* vec, int capacity);
+void vec_push(Arena* arena, ArenaVec* vec, void* item);
+
+extern Arena ast_arena;
+ASTNode* new_node(ASTNodeType type, Token at);
+void release_ast();
+
+extern Token* tokens;
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #define MAX_VARS 256
 #define MAX_FUNCS 64
+#define STACK_SIZE 65536
+#define CALL_STACK_SIZE 4096   // call frames, in both VMs
+// Deepest nesting the compiler passes accept; they recurse on it (left-nested
+// chains like a + b + c + ... do not count, see push_spine)
+#define MAX_NESTING 10000
 
 typedef struct {
-    char name[32];
-    int value;
-} Variable;
-
-typedef struct {
-    char name[32];
-    struct ASTNode* body;
-    char** params;
+    const char* name;   // interned
+    int entry;          // IR label until linked, then the body's byte offset
     int param_count;
+    int local_count;    // parameters first, then locals assigned in the body
 } Function;
 
 typedef enum {
     OP_LOAD_CONST,     // Load constant into register or stack
-    OP_LOAD_VAR,       // Load variable value
-    OP_STORE_VAR,      // Store value into variable
+    OP_LOAD_SLOT,      // Load variable from its resolved slot
+    OP_STORE_SLOT,     // Store value into a resolved slot
     OP_ADD,            // Add top two values
     OP_SUB,            // Subtract
     OP_MUL,            // Multiply
@@ -131,7 +224,7 @@ typedef enum {
     OP_JMP,            // Unconditional jump
     OP_JMP_IF_FALSE,   // Jump if top of stack is false
     OP_LABEL,          // Label marker
-    OP_CALL,           // Call function
+    OP_CALL,           // Call user function by index into the function table
     OP_RET,            // Return from function
     OP_POP,            // Pop top of stack
     OP_PUSH,           // Push value onto stack
@@ -142,18 +235,435 @@ typedef enum {
     OP_GTE,            // Greater or equal
     OP_LTE,            // Less or equal
     OP_PRINT,          // Debug print
+    OP_LOAD_LOCAL,     // Load local relative to the current frame base
+    OP_STORE_LOCAL,    // Store local relative to the current frame base
+    OP_CALL_NATIVE,    // Call an unresolved builtin by name constant; reports the unknown name
+    OP_CALL_BUILTIN,   // Call builtin by index into builtins[] with an argument count
+    OP_HALT,           // End of top-level code; function bodies follow
+    OP_ARRAY,          // Pop count values into a new array
+    OP_INDEX,          // pop index, array; push array[index]
+    OP_STORE_INDEX,    // pop value, index, array; array[index] = value
+    // Superinstructions produced by the peephole pass (peephole.c)
+    OP_ADD_SLOT_CONST,      // slot += constant (x = x + k)
+    OP_SUB_SLOT_CONST,      // slot -= constant (x = x - k)
+    OP_LOAD_SLOT_ADD_CONST, // push slot + constant
+    OP_LOAD_SLOT_SUB_CONST, // push slot - constant
+    OP_LOAD_SLOT_CONST,     // push slot, then push constant
+    OP_ADD_LOCAL_CONST,     // the same five for locals of the running frame
+    OP_SUB_LOCAL_CONST,
+    OP_LOAD_LOCAL_ADD_CONST,
+    OP_LOAD_LOCAL_SUB_CONST,
+    OP_LOAD_LOCAL_CONST,
+    OP_JMP_IF_NOT_EQ,       // pop b, a; jump unless a == b
+    OP_JMP_IF_NOT_NEQ,
+    OP_JMP_IF_NOT_GT,
+    OP_JMP_IF_NOT_LT,
+    OP_JMP_IF_NOT_GTE,
+    OP_JMP_IF_NOT_LTE,
+    OPCODE_COUNT
 } Opcode;
 
+// Compiler IR: one entry per operation, still carrying symbolic labels.
+// link_program() resolves them and assemble_program() encodes the result.
 typedef struct {
     Opcode opcode;
-    union {
-        int int_value;
-        char str_value[32];
-    };
-    char operand_type; // 'i' for int, 's' for string, 'v' for variable
+    int int_value;     // constant index, slot, label id or jump target
+    int extra_value;   // second operand of fused instructions (constant index)
+    char operand_type; // 'k' for constant, 'v' for variable slot, 'f' for function, 'b' for builtin, 'l' for unresolved label, 'i' for resolved target
+    int line;          // source position of the AST node that produced it
+    int column;
 } Instruction;
 
-void emit_node(ASTNode* node, Instruction* code, int* ip);
-void print_asm(Instruction* program, int count);
-void run_vm(Instruction* code, int count);
-#define MAX_IR 1024
\ No newline at end of file
+// Runtime values are 8 bytes with the type in the low bits:
+//   ...xxx1  63-bit integer, stored shifted left by one
+//   ...x000  pointer to an interned String (heap objects are 8-byte aligned)
+//   ...x010  immediates: nil, false, true
+//   ...x100  pointer to a Rope, an unflattened string built by +
+//   ...x110  pointer to an Array
+typedef uint64_t Value;
+
+// Range of an int Value: 63 bits, two's complement
+#define INT_VALUE_MAX ((int64_t)0x3FFFFFFFFFFFFFFF)
+#define INT_VALUE_MIN (-INT_VALUE_MAX - 1)
+
+typedef struct {
+    uint32_t length;
+    uint32_t hash;
+    char chars[];      // NUL-terminated
+} String;
+
+// Concatenation node. + on strings builds these instead of copying, so a
+// loop that appends stays linear; the text is assembled and interned the
+// first time something needs it (printing, comparing) and kept in flat.
+typedef struct {
+    uint32_t length;
+    Value left;        // String or Rope
+    Value right;
+    String* flat;      // NULL until flattened
+} Rope;
+
+#define ROPE_TAG 4
+#define ARRAY_TAG 6
+
+// Fixed-length array of ints, stored unboxed (array.c)
+typedef struct {
+    int64_t length;
+    int64_t* items;    // 64-byte aligned; every element fits the 63-bit int range
+} Array;
+// Concatenations up to this long are copied into an interned String right
+// away; a rope node would be bigger than the text it saves copying
+#define SHORT_STRING_LENGTH 32
+
+#define VAL_NIL   ((Value)0x02)
+#define VAL_FALSE ((Value)0x0A)
+#define VAL_TRUE  ((Value)0x12)
+
+static inline int is_int(Value v) { return (int)(v & 1); }
+static inline Value make_int(int64_t i) { return ((uint64_t)i << 1) | 1; }
+static inline int64_t as_int(Value v) { return (int64_t)v >> 1; }
+static inline int is_string(Value v) { return (v & 7) == 0 && v != 0; }
+static inline String* as_string(Value v) { return (String*)(uintptr_t)v; }
+static inline Value make_string(String* s) { return (Value)(uintptr_t)s; }
+static inline Value make_bool(int b) { return b ? VAL_TRUE : VAL_FALSE; }
+static inline int both_ints(Value a, Value b) { return (int)(a & b & 1); }
+static inline int is_falsey(Value v) { return v == VAL_FALSE || v == VAL_NIL || v == make_int(0); }
+static inline int is_rope(Value v) { return (v & 7) == ROPE_TAG; }
+static inline Rope* as_rope(Value v) { return (Rope*)(uintptr_t)(v - ROPE_TAG); }
+static inline int is_text(Value v) { return is_string(v) || is_rope(v); }
+static inline int is_array(Value v) { return (v & 7) == ARRAY_TAG; }
+static inline Array* as_array(Value v) { return (Array*)(uintptr_t)(v - ARRAY_TAG); }
+static inline Value make_array(Array* a) { return (Value)(uintptr_t)a + ARRAY_TAG; }
+
+String* intern_string(const char* chars, int length);
+String* flatten(Value v);
+Value concat_strings(Value a, Value b);
+int strings_equal(Value a, Value b);
+uint32_t text_length(Value v);
+
+Array* new_array(int64_t length);
+int64_t element_int(Value v);
+Value array_literal(Value* items, int count);
+Value index_array(Value array, Value index);
+void store_index(Value array, Value index, Value value);
+int64_t array_sum(Array* a);
+int64_t array_dot(Array* a, Array* b);
+int64_t array_extreme(Array* a, int want_max);
+void array_fill(Array* a, int64_t value);
+void array_combine(Array* a, const int64_t* b_items, int64_t b, char op);
+void print_array(Array* a);
+void print_value(Value v);
+const char* value_type_name(Value v);
+
+// Arithmetic and ordered comparison on Values. The int/int case is inlined;
+// anything else goes to a slow path in value.c that reports the type error.
+Value binary_slow(Opcode op, Value a, Value b);
+Value divide(Value a, Value b);
+void compare_slow(Value a, Value b);
+
+// Builtins (builtins.c). Call sites are resolved to an index into builtins[]
+// at compile time, so no builtin is looked up by name while a script runs.
+// Builtins get their arguments in call order and return the call's value.
+typedef Value (*BuiltinFn)(Value* args, int arg_count);
+typedef struct {
+    const char* name;
+    int min_args;
+    int max_args;      // -1 when any number of arguments is accepted
+    BuiltinFn call;
+} Builtin;
+
+extern Builtin builtins[];
+int find_builtin(const char* name);
+int resolve_builtin(const char* name, int arg_count);
+Value builtin_print(Value* args, int arg_count);
+void unknown_builtin(const char* name);
+
+// Buffered script output (output.c); flush_output() before printing anything
+// else that must come after it
+void output_bytes(const char* data, size_t size);
+void output_char(char c);
+void output_int(int64_t value);
+void flush_output();
+
+#define VALUE_ADD(a, b) (both_ints(a, b) ? (a) + (b) - 1 : binary_slow(OP_ADD, a, b))
+#define VALUE_SUB(a, b) (both_ints(a, b) ? (a) - (b) + 1 : binary_slow(OP_SUB, a, b))
+#define VALUE_MUL(a, b) (both_ints(a, b) ? make_int(as_int(a) * as_int(b)) : binary_slow(OP_MUL, a, b))
+// Interned strings are equal only when identical; a rope has to be flattened first
+#define VALUE_EQ(a, b) ((a) == (b) || ((is_rope(a) || is_rope(b)) && strings_equal(a, b)))
+// Tagged ints order the same way as the numbers they hold
+#define VALUE_CMP(a, op, b) (both_ints(a, b) ? (int64_t)(a) op (int64_t)(b) : (compare_slow(a, b), 0))
+
+typedef struct {
+    char type;         // 'i' for int, 's' for string
+    int64_t int_value;
+    char* str_value;
+    Value value;       // what the VM pushes: a tagged int or an interned string
+} Constant;
+
+typedef struct {
+    Constant* items;
+    int count;
+    int capacity;
+    int* buckets;      // open-addressed index into items, -1 when empty
+    int bucket_count;
+} ConstantPool;
+
+typedef struct {
+    Instruction* code;
+    int count;
+    int capacity;
+    ConstantPool constants;
+    Function* functions;
+    int function_count;
+} IRBuffer;
+
+// Executable bytecode: 1-byte opcodes followed by little-endian operands.
+// Constant, slot and call operands are u16; jump targets are u32 byte offsets.
+// Fused slot/constant instructions carry a u16 slot (or local) followed by a u16 constant,
+// OP_CALL_NATIVE a u16 name constant and OP_CALL_BUILTIN a u16 builtin index,
+// each followed by a u16 argument count. OP_ARRAY carries a u16 element count.
+
+// Line table entry: the instruction starting at offset came from line:column
+typedef struct {
+    int offset;
+    int line;
+    int column;
+} LineInfo;
+
+typedef struct {
+    uint8_t* code;
+    int count;
+    int capacity;
+    ConstantPool constants;
+    Function* functions;
+    int function_count;
+    LineInfo* lines;    // one entry per instruction, ordered by offset
+    int line_count;
+    void* image;        // mapped cache image holding code and lines, or NULL
+    size_t image_size;
+} Chunk;
+
+static inline int read_u16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static inline int read_u32(const uint8_t* p) {
+    return (int)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+void init_pool(ConstantPool* pool);
+int add_int_constant(ConstantPool* pool, int64_t value);
+int add_string_constant(ConstantPool* pool, const char* value);
+void init_chunk(Chunk* chunk);
+void write_byte(Chunk* chunk, uint8_t byte);
+void write_u16(Chunk* chunk, int value);
+void write_u32(Chunk* chunk, int value);
+int operand_size(Opcode op);
+void free_chunk(Chunk* chunk);
+LineInfo chunk_line(Chunk* chunk, int offset);
+
+// Bytecode cache (cache.c). Bump BYTECODE_VERSION whenever the encoding of
+// instructions, constants or the line table changes.
+#define BYTECODE_VERSION 6
+#define CACHE_PEEPHOLE 1   // options the cached code was compiled with
+#define CACHE_FOLD     2
+#define CACHE_CFG      4
+uint64_t hash_source(const char* text, size_t size);
+char* cache_path(const char* script_path);
+int load_cached_chunk(const char* path, uint64_t source_hash, uint32_t options, Chunk* chunk);
+void save_cached_chunk(const char* path, uint64_t source_hash, uint32_t options, Chunk* chunk);
+void release_image(Chunk* chunk);
+
+extern char* slot_names[];
+extern int slot_count;
+
+void reset_symbols();
+int define_slot(const char* name);
+
+void init_ir(IRBuffer* ir);
+void emit(IRBuffer* ir, Instruction instr);
+void resolve_symbols(ASTNode* node);
+extern ASTNode** spine;
+extern int spine_top;
+int push_spine(ASTNode* node);
+int slot_of(const char* name);
+void emit_node(ASTNode* node, IRBuffer* ir);
+void emit_program(ASTNode* program, IRBuffer* ir);
+void emit_end(IRBuffer* ir, int function);
+int is_expression(ASTNode* node);
+int new_label();
+extern int emit_line;
+extern int emit_column;
+int find_function(const char* name);
+extern Function functions[];
+void enter_scope(int function);
+int variable_id(const char* name);
+const char* new_temporary();
+
+// Basic-block optimizer (cfg.c): builds a control-flow graph per body,
+// optimizes it and lowers it back to IR. emit_program() uses it unless
+// use_cfg is cleared.
+extern int use_cfg;
+void emit_cfg(ASTNode* body, IRBuffer* ir, int function);
+typedef enum {
+    CFG_BLOCKS,
+    CFG_UNREACHABLE,
+    CFG_COPIES,
+    CFG_DEAD_STORES,
+    CFG_DEAD_EXPRESSIONS,
+    CFG_HOISTED,
+    CFG_STAT_COUNT
+} CfgStat;
+// Counts for the last program compiled, reset at its top-level body
+extern int cfg_stats[CFG_STAT_COUNT];
+extern const char* cfg_stat_names[];
+void print_cfg_stats();
+int calls_user_function(ASTNode* e);
+extern const char* opcode_names[];
+void print_asm(Chunk* chunk);
+int is_jump(Opcode op);
+void link_program(IRBuffer* ir);
+void assemble_program(IRBuffer* ir, Chunk* chunk);
+// AST constant folding (fold.c); runs after resolve_symbols()
+void fold_program(ASTNode* program);
+ASTNode* fold_expression(ASTNode* node);
+ASTNode* refold_expression(ASTNode* node);
+int constant_truth(ASTNode* cond);
+void print_fold_stats();
+
+// Template JIT for hot loops (jit.c), used by run_vm() when use_jit is set.
+// Native code is only generated on x86-64 with mmap; elsewhere the
+// interpreter runs everything.
+#if defined(__x86_64__) && !defined(_WIN32)
+#define PENGUIN_JIT
+#endif
+extern int use_jit;
+extern int jit_loops_compiled;
+extern int jit_loops_rejected;
+extern unsigned long long jit_entries;
+void jit_begin(Chunk* chunk);
+void jit_end();
+int jit_loop(int header, int end, int base);
+void print_jit_stats();
+
+// C backend (aot.c): writes the program as C and builds it with gcc -O2
+void compile_c(ASTNode* program, FILE* out);
+int build_native(ASTNode* program, const char* exe_path);
+
+void peephole_optimize(IRBuffer* ir);
+void print_peephole_stats();
+// Threaded dispatch needs GCC's labels-as-values; build with
+// -DPENGUIN_SWITCH_DISPATCH to force the portable switch loop
+#if defined(__GNUC__) && !defined(PENGUIN_SWITCH_DISPATCH)
+#define PENGUIN_THREADED
+#endif
+
+// Bench builds count every dispatch; normal builds compile this away
+#ifdef PENGUIN_COUNT_OPS
+extern unsigned long long vm_op_count;
+#define COUNT_OP() (vm_op_count++)
+#else
+#define COUNT_OP() ((void)0)
+#endif
+
+// Profiling builds (-DPENGUIN_PROFILE) time every dispatch and charge it to
+// the instruction's byte offset; normal builds compile this away too
+#ifdef PENGUIN_PROFILE
+extern uint64_t* profile_counts;
+extern uint64_t* profile_cycles;
+extern int profile_last;
+extern uint64_t profile_stamp;
+uint64_t profile_clock();
+
+static inline void profile_tick(int offset) {
+    uint64_t now = profile_clock();
+    if (profile_last >= 0) profile_cycles[profile_last] += now - profile_stamp;
+    profile_counts[offset]++;
+    profile_last = offset;
+    profile_stamp = now;
+}
+
+void profile_begin(Chunk* chunk);
+void profile_end();
+void print_profile(Chunk* chunk);
+#define PROFILE_OP(offset) profile_tick(offset)
+#else
+#define PROFILE_OP(offset) ((void)0)
+#endif
+
+void reset_vm();
+void run_vm_switch(Chunk* chunk);
+#ifdef PENGUIN_THREADED
+void run_vm_threaded(Chunk* chunk);
+#endif
+void run_vm(Chunk* chunk);
+
+// Register backend (regvm.c): three-address code over a stack of register
+// frames. Top-level code runs in the bottom frame, whose first registers are
+// the global slots; every operand is a plain index into the running frame.
+typedef enum {
+    R_MOVE,            // R[a] = R[b]
+    R_ADD,             // R[a] = R[b] + R[c]
+    R_SUB,
+    R_MUL,
+    R_DIV,
+    R_EQ,              // R[a] = R[b] == R[c]
+    R_NEQ,
+    R_GT,
+    R_LT,
+    R_GTE,
+    R_LTE,
+    R_JMP,             // pc = target
+    R_JMP_IF_FALSE,    // if (!R[a]) pc = target
+    R_JMP_NOT_EQ,      // if (!(R[b] == R[c])) pc = target, fused compare + branch
+    R_JMP_NOT_NEQ,
+    R_JMP_NOT_GT,
+    R_JMP_NOT_LT,
+    R_JMP_NOT_GTE,
+    R_JMP_NOT_LTE,
+    R_CALL,            // call unresolved name constant c: reports the unknown name
+    R_CALL_BUILTIN,    // call builtins[c] with b args starting at R[a]
+    R_HALT,
+    R_ARRAY,           // R[a] = [R[a], ..., R[a+b-1]]
+    R_INDEX,           // R[a] = R[b][R[c]]
+    R_STORE_INDEX,     // R[a][R[b]] = R[c]
+    R_CALL_FUNC,       // call functions[c]; its frame starts at R[a], where the b args are
+    R_RETURN,          // return R[a] into the caller's call register
+    R_GET_GLOBAL,      // R[a] = global slot b (function bodies only)
+    R_SET_GLOBAL,      // global slot a = R[b]
+} RegOpcode;
+
+typedef struct {
+    uint8_t op;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+    int32_t target;    // jump destination (instruction index)
+} RegInstr;
+
+// One body's register window. Operands index the running frame: locals
+// (the global slots for top-level code) first, then the constants the body
+// uses, copied in on entry, then temporaries. A call's frame starts at the
+// caller's argument registers, so arguments become parameters in place.
+typedef struct {
+    const char* name;
+    int entry;            // instruction index of the body
+    int param_count;
+    int local_count;
+    int constant_count;
+    int* constants;       // pool index of each constant register
+    int frame_size;       // locals + constants + temporaries
+} RegFunction;
+
+typedef struct {
+    RegInstr* code;
+    int count;
+    int capacity;
+    ConstantPool constants;
+    RegFunction main;         // top-level code
+    RegFunction* functions;   // indexed like functions[] in compiler.c
+    int function_count;
+} RegChunk;
+
+void compile_register(ASTNode* program, RegChunk* chunk);
+void print_reg_asm(RegChunk* chunk);
+void run_regvm(RegChunk* chunk);
@@ -0,0 +1,264 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Constant folding over the AST. It runs after resolve_symbols(), so dropping
+// a dead branch never changes which names have slots, and it only visits code
+// that can still run: a division by zero in a removed branch is not an error.
+
+typedef enum {
+    FOLD_CONSTANT,       // literal op literal
+    FOLD_IDENTITY,       // x + 0, x - 0, x * 1, x / 1, 0 + x, 1 * x
+    FOLD_BRANCH,         // if with a constant condition
+    FOLD_LOOP,           // while with a false condition
+    FOLD_KIND_COUNT
+} FoldKind;
+
+const char* fold_kind_names[] = {
+    "constant",
+    "identity",
+    "branch",
+    "dead loop",
+};
+
+int fold_hits[FOLD_KIND_COUNT];
+
+// Set while cfg.c refolds expressions its copy propagation rewrote: a
+// division by zero that only appears then is left for the VM to report
+int refolding = 0;
+
+int is_literal(ASTNode* node) {
+    return node->type == AST_NUMBER || node->type == AST_STRING;
+}
+
+// Whether node can only produce an int. -, * and / fail on anything else;
+// + needs both sides to be ints, since it may not stay int-only.
+int is_int_valued(ASTNode* node) {
+    // Down a + chain one term at a time
+    while (node->type == AST_BINARY_OP && node->binary.op == '+') {
+        if (!is_int_valued(node->binary.right)) return 0;
+        node = node->binary.left;
+    }
+    if (node->type == AST_NUMBER || node->type == AST_INDEX) return 1;   // arrays only hold ints
+    if (node->type != AST_BINARY_OP) return 0;
+    switch (node->binary.op) {
+        case '-': case '*': case '/': return 1;
+        default: return 0;
+    }
+}
+
+int is_number(ASTNode* node, int64_t value) {
+    return node->type == AST_NUMBER && node->number == value;
+}
+
+ASTNode* make_number(ASTNode* at, int64_t value) {
+    at->type = AST_NUMBER;
+    at->number = value;
+    fold_hits[FOLD_CONSTANT]++;
+    return at;
+}
+
+// Folds two int literals; leaves the node alone when the result does not
+// fit an int Value, so the VM computes (and wraps) it exactly as before.
+// Literals are 63-bit, so only * can overflow int64_t on the way.
+ASTNode* fold_arithmetic(ASTNode* node) {
+    int64_t a = node->binary.left->number;
+    int64_t b = node->binary.right->number;
+    int64_t r;
+    switch (node->binary.op) {
+        case '+': r = a + b; break;
+        case '-': r = a - b; break;
+        case '*':
+            if (__builtin_mul_overflow(a, b, &r)) return node;
+            break;
+        case '/':
+            if (b == 0) {
+                if (refolding) return node;
+                printf("COMPILER ERROR: Division by zero in constant expression at line %u, column %u\n",
+                       node->line, node->column);
+                exit(1);
+            }
+            r = a / b;
+            break;
+        default: return node;
+    }
+    if (r < INT_VALUE_MIN || r > INT_VALUE_MAX) return node;
+    return make_number(node, r);
+}
+
+// Drops the operand that cannot change an int-valued other side
+ASTNode* fold_identity(ASTNode* node) {
+    ASTNode* left = node->binary.left;
+    ASTNode* right = node->binary.right;
+    ASTNode* kept = NULL;
+    switch (node->binary.op) {
+        case '+':
+            if (is_number(right, 0) && is_int_valued(left)) kept = left;
+            else if (is_number(left, 0) && is_int_valued(right)) kept = right;
+            break;
+        case '-':
+            if (is_number(right, 0) && is_int_valued(left)) kept = left;
+            break;
+        case '*':
+            if (is_number(right, 1) && is_int_valued(left)) kept = left;
+            else if (is_number(left, 1) && is_int_valued(right)) kept = right;
+            break;
+        case '/':
+            if (is_number(right, 1) && is_int_valued(left)) kept = left;
+            break;
+    }
+    if (!kept) return node;
+    fold_hits[FOLD_IDENTITY]++;
+    return kept;
+}
+
+// Folds a binary node whose operands are already folded
+ASTNode* fold_binary(ASTNode* node) {
+    if (node->binary.left->type == AST_NUMBER && node->binary.right->type == AST_NUMBER) {
+        return fold_arithmetic(node);
+    }
+    return fold_identity(node);
+}
+
+ASTNode* fold_expression(ASTNode* node) {
+    switch (node->type) {
+        case AST_BINARY_OP: {
+            // Innermost node of a left-nested chain first (see push_spine)
+            int base = push_spine(node);
+            ASTNode* folded = fold_expression(spine[spine_top - 1]->binary.left);
+            for (int i = spine_top - 1; i >= base; i--) {
+                ASTNode* op = spine[i];
+                op->binary.left = folded;
+                op->binary.right = fold_expression(op->binary.right);
+                folded = fold_binary(op);
+            }
+            spine_top = base;
+            return folded;
+        }
+        case AST_FUNCTION_CALL:
+            for (int i = 0; i < node->function_call.arg_count; i++) {
+                node->function_call.args[i] = fold_expression(node->function_call.args[i]);
+            }
+            return node;
+        case AST_ARRAY:
+            for (int i = 0; i < node->array.count; i++) {
+                node->array.elements[i] = fold_expression(node->array.elements[i]);
+            }
+            return node;
+        case AST_INDEX:
+        case AST_INDEX_ASSIGNMENT:
+            node->index.array = fold_expression(node->index.array);
+            node->index.index = fold_expression(node->index.index);
+            if (node->index.value) node->index.value = fold_expression(node->index.value);
+            return node;
+        default:
+            return node;
+    }
+}
+
+ASTNode* refold_expression(ASTNode* node) {
+    refolding = 1;
+    node = fold_expression(node);
+    refolding = 0;
+    return node;
+}
+
+// Truth of a literal condition, or -1 when it is only known at run time.
+// Comparisons have no literal form, so they only fold where just their
+// truth is used.
+int constant_truth(ASTNode* cond) {
+    if (cond->type == AST_NUMBER) return cond->number != 0;
+    if (cond->type == AST_STRING) return 1;
+    if (cond->type != AST_BINARY_OP || !is_literal(cond->binary.left) || !is_literal(cond->binary.right)) {
+        return -1;
+    }
+    ASTNode* a = cond->binary.left;
+    ASTNode* b = cond->binary.right;
+    int same_type = a->type == b->type;
+    int equal = same_type && (a->type == AST_NUMBER ? a->number == b->number : strcmp(a->string, b->string) == 0);
+    switch (cond->binary.op) {
+        case '=': return equal;
+        case '!': return !equal;
+    }
+    if (a->type != AST_NUMBER || b->type != AST_NUMBER) return -1;  // the VM reports these
+    switch (cond->binary.op) {
+        case '>': return a->number > b->number;
+        case '<': return a->number < b->number;
+        case 'G': return a->number >= b->number;
+        case 'L': return a->number <= b->number;
+    }
+    return -1;
+}
+
+// Stands in for a branch or loop body whose statements were all removed
+ASTNode* empty_block(ASTNode* at) {
+    ASTNode* block = new_node(AST_BLOCK, (Token){.line = at->line, .column = at->column});
+    block->block.statements = NULL;
+    block->block.count = 0;
+    return block;
+}
+
+// Returns the folded statement, or NULL when it no longer does anything
+ASTNode* fold_statement(ASTNode* node) {
+    if (!node) return NULL;
+    switch (node->type) {
+        case AST_ASSIGNMENT:
+            node->assignment.value = fold_expression(node->assignment.value);
+            return node;
+        case AST_RETURN:
+            node->return_stmt.value = fold_expression(node->return_stmt.value);
+            return node;
+        case AST_IF: {
+            node->if_stmt.condition = fold_expression(node->if_stmt.condition);
+            int truth = constant_truth(node->if_stmt.condition);
+            if (truth >= 0) {
+                fold_hits[FOLD_BRANCH]++;
+                return fold_statement(truth ? node->if_stmt.then_branch : node->if_stmt.else_branch);
+            }
+            node->if_stmt.then_branch = fold_statement(node->if_stmt.then_branch);
+            node->if_stmt.else_branch = fold_statement(node->if_stmt.else_branch);
+            if (!node->if_stmt.then_branch) {
+                node->if_stmt.then_branch = empty_block(node);
+            }
+            return node;
+        }
+        case AST_WHILE:
+            node->while_stmt.condition = fold_expression(node->while_stmt.condition);
+            if (constant_truth(node->while_stmt.condition) == 0) {
+                fold_hits[FOLD_LOOP]++;
+                return NULL;
+            }
+            node->while_stmt.body = fold_statement(node->while_stmt.body);
+            if (!node->while_stmt.body) node->while_stmt.body = empty_block(node);
+            return node;
+        case AST_FUNCTION_DEF:
+            fold_statement(node->function_def.body);
+            return node;
+        case AST_BLOCK: {
+            int out = 0;
+            for (int i = 0; i < node->block.count; i++) {
+                ASTNode* stmt = fold_statement(node->block.statements[i]);
+                if (stmt) node->block.statements[out++] = stmt;
+            }
+            node->block.count = out;
+            return node;
+        }
+        default:
+            return fold_expression(node);
+    }
+}
+
+// Folds program in place; it stays a block even if every statement goes
+void fold_program(ASTNode* program) {
+    memset(fold_hits, 0, sizeof(fold_hits));
+    fold_statement(program);
+}
+
+void print_fold_stats() {
+    printf("%-22s %s\n", "fold", "hits");
+    for (int i = 0; i < FOLD_KIND_COUNT; i++) {
+        printf("%-22s %d\n", fold_kind_names[i], fold_hits[i]);
+    }
+}
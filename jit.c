@@ -0,0 +1,588 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Template JIT for hot loops. The switch engine reports every taken backward
+// jump; once a loop header has been reached that way JIT_THRESHOLD times, the
+// bytecode from the header up to the jump is translated instruction by
+// instruction into x86-64 and run from then on whenever the loop is entered.
+//
+// Native code works on the VM's own stack and slots, so leaving it is just
+// returning the byte offset to resume at. It leaves:
+//   - at instructions it has no template for (calls, builtins, print, ...)
+//   - before an instruction whose operands fail the fast path (ints, or an
+//     int index inside an array), so the interpreter takes the slow path or
+//     reports the error itself
+//   - at jumps out of the loop
+
+int use_jit = 0;
+int jit_loops_compiled = 0;
+int jit_loops_rejected = 0;
+unsigned long long jit_entries = 0;
+
+#ifdef PENGUIN_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 1000   // backward jumps to a header before it is compiled
+#endif
+
+extern Value stack[];
+extern int sp;
+extern Value slots[];
+
+// Returns the byte offset to resume at; *top is the stack's next free slot
+typedef int (*NativeLoop)(Value* slots, Value* frame, Value** top);
+
+typedef struct {
+    int compiled;      // tried already; entry is NULL if the loop was rejected
+    NativeLoop entry;
+    size_t size;       // of the mapping holding entry
+    int min_depth;     // lowest stack depth reached, relative to the header
+    int max_depth;
+} JitLoop;
+
+Chunk* jit_chunk;
+JitLoop* jit_loops;    // indexed by header byte offset
+int* jit_counts;
+
+typedef struct {
+    uint8_t* code;
+    int count;
+    int capacity;
+} Asm;
+
+void asm_byte(Asm* a, uint8_t byte) {
+    if (a->count == a->capacity) {
+        a->capacity = a->capacity ? a->capacity * 2 : 1024;
+        a->code = realloc(a->code, a->capacity);
+    }
+    a->code[a->count++] = byte;
+}
+
+void asm_bytes(Asm* a, const char* bytes, int n) {
+    for (int i = 0; i < n; i++) asm_byte(a, (uint8_t)bytes[i]);
+}
+
+void asm_u32(Asm* a, uint32_t value) {
+    for (int i = 0; i < 4; i++) asm_byte(a, value >> (8 * i));
+}
+
+void asm_u64(Asm* a, uint64_t value) {
+    for (int i = 0; i < 8; i++) asm_byte(a, value >> (8 * i));
+}
+
+void patch_u32(Asm* a, int at, uint32_t value) {
+    for (int i = 0; i < 4; i++) a->code[at + i] = value >> (8 * i);
+}
+
+// Register use: rbx = next free stack slot, r12 = slots, r13 = frame base,
+// r14 = where to store rbx on exit, rax/rcx/rdx = scratch
+#define PUSH_RAX(a)    asm_bytes(a, "\x48\x89\x03\x48\x83\xC3\x08", 7)   // mov [rbx], rax; add rbx, 8
+#define POP_RAX(a)     asm_bytes(a, "\x48\x8B\x43\xF8\x48\x83\xEB\x08", 8) // mov rax, [rbx-8]; sub rbx, 8
+#define LOAD_OPERANDS(a) asm_bytes(a, "\x48\x8B\x43\xF0\x48\x8B\x4B\xF8", 8) // rax = a, rcx = b
+#define STORE_RESULT(a) asm_bytes(a, "\x48\x89\x43\xF0\x48\x83\xEB\x08", 8) // replace a, drop b
+
+void mov_rax_imm(Asm* a, uint64_t value) {
+    asm_bytes(a, "\x48\xB8", 2);
+    asm_u64(a, value);
+}
+
+void mov_rcx_imm(Asm* a, uint64_t value) {
+    asm_bytes(a, "\x48\xB9", 2);
+    asm_u64(a, value);
+}
+
+// mov rax, [r12 + slot*8] / [r13 + local*8], and the matching stores
+void load_variable(Asm* a, int local, int index) {
+    asm_bytes(a, local ? "\x49\x8B\x85" : "\x49\x8B\x84\x24", local ? 3 : 4);
+    asm_u32(a, index * 8);
+}
+
+void store_variable(Asm* a, int local, int index) {
+    asm_bytes(a, local ? "\x49\x89\x85" : "\x49\x89\x84\x24", local ? 3 : 4);
+    asm_u32(a, index * 8);
+}
+
+typedef struct {
+    int at;            // rel32 to patch
+    int target;        // instruction index, or -1 - byte offset for an exit
+} Fixup;
+
+typedef struct {
+    Asm a;
+    Fixup* fixups;
+    int fixup_count;
+    int fixup_capacity;
+} Emitter;
+
+// Emits the rel32 of a jump to instruction index target, or to an exit
+// resuming the interpreter at byte offset ip when target is negative
+void jump_to(Emitter* e, int target) {
+    if (e->fixup_count == e->fixup_capacity) {
+        e->fixup_capacity = e->fixup_capacity ? e->fixup_capacity * 2 : 64;
+        e->fixups = realloc(e->fixups, sizeof(Fixup) * e->fixup_capacity);
+    }
+    e->fixups[e->fixup_count++] = (Fixup){e->a.count, target};
+    asm_u32(&e->a, 0);
+}
+
+#define EXIT_AT(ip) (-1 - (ip))
+
+void emit_jmp(Emitter* e, int target) {
+    asm_byte(&e->a, 0xE9);
+    jump_to(e, target);
+}
+
+void emit_jcc(Emitter* e, uint8_t cc, int target) {
+    asm_byte(&e->a, 0x0F);
+    asm_byte(&e->a, 0x80 | cc);
+    jump_to(e, target);
+}
+
+#define CC_AE 0x3
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_L  0xC
+#define CC_GE 0xD
+#define CC_LE 0xE
+#define CC_G  0xF
+
+// Leaves to the interpreter at ip unless rax and rcx are both ints
+void check_ints(Emitter* e, int ip) {
+    asm_bytes(&e->a, "\x89\xC2\x21\xCA\xF6\xC2\x01", 7);   // mov edx, eax; and edx, ecx; test dl, 1
+    emit_jcc(e, CC_E, EXIT_AT(ip));
+}
+
+// Equality is a plain compare unless one side is a rope, which the
+// interpreter has to flatten first
+void check_no_ropes(Emitter* e, int ip) {
+    asm_bytes(&e->a, "\x89\xC2\x83\xE2\x07\x83\xFA\x04", 8);   // mov edx, eax; and edx, 7; cmp edx, ROPE_TAG
+    emit_jcc(e, CC_E, EXIT_AT(ip));
+    asm_bytes(&e->a, "\x89\xCA\x83\xE2\x07\x83\xFA\x04", 8);   // mov edx, ecx; and edx, 7; cmp edx, ROPE_TAG
+    emit_jcc(e, CC_E, EXIT_AT(ip));
+}
+
+// Leaves to the interpreter at ip unless rax is an array and rcx an int
+// index inside it; then rcx is the untagged index and rax the items pointer.
+// The unsigned compare also sends negative indexes to the interpreter.
+void check_array_index(Emitter* e, int ip) {
+    asm_bytes(&e->a, "\x89\xC2\x83\xE2\x07\x83\xFA\x06", 8);   // mov edx, eax; and edx, 7; cmp edx, ARRAY_TAG
+    emit_jcc(e, CC_NE, EXIT_AT(ip));
+    asm_bytes(&e->a, "\xF6\xC1\x01", 3);                         // test cl, 1
+    emit_jcc(e, CC_E, EXIT_AT(ip));
+    asm_bytes(&e->a, "\x48\xD1\xF9\x48\x3B\x48\xFA", 7);        // sar rcx, 1; cmp rcx, [rax-6] (length)
+    emit_jcc(e, CC_AE, EXIT_AT(ip));
+    asm_bytes(&e->a, "\x48\x8B\x40\x02", 4);                     // mov rax, [rax+2] (items)
+}
+
+// cmp rax, rcx; rax = cc ? true : false
+void compare_to_bool(Asm* a, uint8_t cc) {
+    asm_bytes(a, "\x48\x39\xC8", 3);
+    asm_byte(a, 0xB8);
+    asm_u32(a, (uint32_t)VAL_FALSE);
+    asm_byte(a, 0xBA);
+    asm_u32(a, (uint32_t)VAL_TRUE);
+    asm_bytes(a, "\x48\x0F", 2);
+    asm_byte(a, 0x40 | cc);
+    asm_byte(a, 0xC2);
+}
+
+uint8_t condition_of(Opcode op) {
+    switch (op) {
+        case OP_EQ: case OP_JMP_IF_NOT_EQ: return CC_E;
+        case OP_NEQ: case OP_JMP_IF_NOT_NEQ: return CC_NE;
+        case OP_GT: case OP_JMP_IF_NOT_GT: return CC_G;
+        case OP_LT: case OP_JMP_IF_NOT_LT: return CC_L;
+        case OP_GTE: case OP_JMP_IF_NOT_GTE: return CC_GE;
+        default: return CC_LE;
+    }
+}
+
+// Stack effect of the instructions with a template; 0 for the rest
+int has_template(Opcode op, int* pops, int* pushes) {
+    *pops = 0;
+    *pushes = 0;
+    switch (op) {
+        case OP_LOAD_CONST: case OP_PUSH: case OP_LOAD_SLOT: case OP_LOAD_LOCAL:
+        case OP_LOAD_SLOT_ADD_CONST: case OP_LOAD_SLOT_SUB_CONST:
+        case OP_LOAD_LOCAL_ADD_CONST: case OP_LOAD_LOCAL_SUB_CONST:
+            *pushes = 1;
+            return 1;
+        case OP_LOAD_SLOT_CONST: case OP_LOAD_LOCAL_CONST:
+            *pushes = 2;
+            return 1;
+        case OP_POP: case OP_STORE_SLOT: case OP_STORE_LOCAL: case OP_JMP_IF_FALSE:
+            *pops = 1;
+            return 1;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        case OP_EQ: case OP_NEQ: case OP_GT: case OP_LT: case OP_GTE: case OP_LTE:
+            *pops = 2;
+            *pushes = 1;
+            return 1;
+        case OP_JMP_IF_NOT_EQ: case OP_JMP_IF_NOT_NEQ: case OP_JMP_IF_NOT_GT:
+        case OP_JMP_IF_NOT_LT: case OP_JMP_IF_NOT_GTE: case OP_JMP_IF_NOT_LTE:
+            *pops = 2;
+            return 1;
+        case OP_INDEX:
+            *pops = 2;
+            *pushes = 1;
+            return 1;
+        case OP_STORE_INDEX:
+            *pops = 3;
+            return 1;
+        case OP_JMP: case OP_ADD_SLOT_CONST: case OP_SUB_SLOT_CONST:
+        case OP_ADD_LOCAL_CONST: case OP_SUB_LOCAL_CONST:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// rax += int constant (rax -= with subtract set); leaves if rax does not
+// hold an int
+void add_constant(Emitter* e, Value constant, int subtract, int ip) {
+    asm_bytes(&e->a, "\xA8\x01", 2);                 // test al, 1
+    emit_jcc(e, CC_E, EXIT_AT(ip));
+    mov_rcx_imm(&e->a, constant - 1);
+    if (subtract) {
+        asm_bytes(&e->a, "\x48\x29\xC8", 3);         // sub rax, rcx
+    } else {
+        asm_bytes(&e->a, "\x48\x01\xC8", 3);         // add rax, rcx
+    }
+}
+
+void emit_instruction(Emitter* e, Chunk* chunk, int ip, int* index_at) {
+    const uint8_t* code = chunk->code;
+    Constant* constants = chunk->constants.items;
+    Asm* a = &e->a;
+    Opcode op = code[ip];
+    switch (op) {
+        case OP_LOAD_CONST:
+            mov_rax_imm(a, constants[read_u16(code + ip + 1)].value);
+            PUSH_RAX(a);
+            break;
+        case OP_PUSH:
+            mov_rax_imm(a, VAL_NIL);
+            PUSH_RAX(a);
+            break;
+        case OP_POP:
+            asm_bytes(a, "\x48\x83\xEB\x08", 4);     // sub rbx, 8
+            break;
+        case OP_LOAD_SLOT:
+        case OP_LOAD_LOCAL:
+            load_variable(a, op == OP_LOAD_LOCAL, read_u16(code + ip + 1));
+            PUSH_RAX(a);
+            break;
+        case OP_STORE_SLOT:
+        case OP_STORE_LOCAL:
+            POP_RAX(a);
+            store_variable(a, op == OP_STORE_LOCAL, read_u16(code + ip + 1));
+            break;
+        case OP_ADD:
+            LOAD_OPERANDS(a);
+            check_ints(e, ip);
+            asm_bytes(a, "\x48\x8D\x44\x08\xFF", 5); // lea rax, [rax+rcx-1]
+            STORE_RESULT(a);
+            break;
+        case OP_SUB:
+            LOAD_OPERANDS(a);
+            check_ints(e, ip);
+            asm_bytes(a, "\x48\x29\xC8\x48\x83\xC0\x01", 7); // sub rax, rcx; add rax, 1
+            STORE_RESULT(a);
+            break;
+        case OP_MUL:
+            LOAD_OPERANDS(a);
+            check_ints(e, ip);
+            // sar rax, 1; sar rcx, 1; imul rax, rcx; lea rax, [rax+rax+1]
+            asm_bytes(a, "\x48\xD1\xF8\x48\xD1\xF9\x48\x0F\xAF\xC1\x48\x8D\x44\x00\x01", 15);
+            STORE_RESULT(a);
+            break;
+        case OP_DIV:
+            LOAD_OPERANDS(a);
+            check_ints(e, ip);
+            asm_bytes(a, "\x48\xD1\xF9", 3);         // sar rcx, 1
+            emit_jcc(e, CC_E, EXIT_AT(ip));          // division by zero is the interpreter's to report
+            // sar rax, 1; cqo; idiv rcx; lea rax, [rax+rax+1]
+            asm_bytes(a, "\x48\xD1\xF8\x48\x99\x48\xF7\xF9\x48\x8D\x44\x00\x01", 13);
+            STORE_RESULT(a);
+            break;
+        case OP_EQ:
+        case OP_NEQ:
+            LOAD_OPERANDS(a);
+            check_no_ropes(e, ip);
+            compare_to_bool(a, condition_of(op));
+            STORE_RESULT(a);
+            break;
+        case OP_GT:
+        case OP_LT:
+        case OP_GTE:
+        case OP_LTE:
+            LOAD_OPERANDS(a);
+            check_ints(e, ip);
+            compare_to_bool(a, condition_of(op));
+            STORE_RESULT(a);
+            break;
+        case OP_INDEX:
+            LOAD_OPERANDS(a);
+            check_array_index(e, ip);
+            // mov rax, [rax+rcx*8]; lea rax, [rax+rax+1]
+            asm_bytes(a, "\x48\x8B\x04\xC8\x48\x8D\x44\x00\x01", 9);
+            STORE_RESULT(a);
+            break;
+        case OP_STORE_INDEX:
+            // array, index and value are the top three; only an int value is stored natively
+            asm_bytes(a, "\x48\x8B\x53\xF8\xF6\xC2\x01", 7);   // mov rdx, [rbx-8]; test dl, 1
+            emit_jcc(e, CC_E, EXIT_AT(ip));
+            asm_bytes(a, "\x48\x8B\x43\xE8\x48\x8B\x4B\xF0", 8); // mov rax, [rbx-24]; mov rcx, [rbx-16]
+            check_array_index(e, ip);
+            // mov rdx, [rbx-8]; sar rdx, 1; mov [rax+rcx*8], rdx; sub rbx, 24
+            asm_bytes(a, "\x48\x8B\x53\xF8\x48\xD1\xFA\x48\x89\x14\xC8\x48\x83\xEB\x18", 15);
+            break;
+        case OP_ADD_SLOT_CONST: case OP_SUB_SLOT_CONST:
+        case OP_ADD_LOCAL_CONST: case OP_SUB_LOCAL_CONST:
+        case OP_LOAD_SLOT_ADD_CONST: case OP_LOAD_SLOT_SUB_CONST:
+        case OP_LOAD_LOCAL_ADD_CONST: case OP_LOAD_LOCAL_SUB_CONST: {
+            int var = read_u16(code + ip + 1);
+            Value constant = constants[read_u16(code + ip + 3)].value;
+            int local = op == OP_ADD_LOCAL_CONST || op == OP_SUB_LOCAL_CONST ||
+                        op == OP_LOAD_LOCAL_ADD_CONST || op == OP_LOAD_LOCAL_SUB_CONST;
+            int subtract = op == OP_SUB_SLOT_CONST || op == OP_SUB_LOCAL_CONST ||
+                           op == OP_LOAD_SLOT_SUB_CONST || op == OP_LOAD_LOCAL_SUB_CONST;
+            if (!is_int(constant)) {
+                emit_jmp(e, EXIT_AT(ip));            // always the slow path
+                break;
+            }
+            load_variable(a, local, var);
+            add_constant(e, constant, subtract, ip);
+            if (op == OP_ADD_SLOT_CONST || op == OP_SUB_SLOT_CONST || op == OP_ADD_LOCAL_CONST || op == OP_SUB_LOCAL_CONST) {
+                store_variable(a, local, var);
+            } else {
+                PUSH_RAX(a);
+            }
+            break;
+        }
+        case OP_LOAD_SLOT_CONST:
+        case OP_LOAD_LOCAL_CONST:
+            load_variable(a, op == OP_LOAD_LOCAL_CONST, read_u16(code + ip + 1));
+            PUSH_RAX(a);
+            mov_rax_imm(a, constants[read_u16(code + ip + 3)].value);
+            PUSH_RAX(a);
+            break;
+        case OP_JMP_IF_NOT_EQ:
+        case OP_JMP_IF_NOT_NEQ:
+        case OP_JMP_IF_NOT_GT:
+        case OP_JMP_IF_NOT_LT:
+        case OP_JMP_IF_NOT_GTE:
+        case OP_JMP_IF_NOT_LTE: {
+            int target = index_at[read_u32(code + ip + 1)];
+            LOAD_OPERANDS(a);
+            if (op != OP_JMP_IF_NOT_EQ && op != OP_JMP_IF_NOT_NEQ) {
+                check_ints(e, ip);
+            } else {
+                check_no_ropes(e, ip);
+            }
+            asm_bytes(a, "\x48\x83\xEB\x10\x48\x39\xC8", 7); // sub rbx, 16; cmp rax, rcx
+            emit_jcc(e, condition_of(op) ^ 1, target);       // x86 pairs each condition with its negation
+            break;
+        }
+        case OP_JMP_IF_FALSE: {
+            int target = index_at[read_u32(code + ip + 1)];
+            POP_RAX(a);
+            // Falsey values are int 0, nil and false
+            asm_bytes(a, "\x48\x83\xF8\x01", 4);
+            emit_jcc(e, CC_E, target);
+            asm_bytes(a, "\x48\x83\xF8\x02", 4);
+            emit_jcc(e, CC_E, target);
+            asm_bytes(a, "\x48\x83\xF8\x0A", 4);
+            emit_jcc(e, CC_E, target);
+            break;
+        }
+        case OP_JMP:
+            emit_jmp(e, index_at[read_u32(code + ip + 1)]);
+            break;
+        default:
+            emit_jmp(e, EXIT_AT(ip));
+            break;
+    }
+}
+
+// Translates the loop [header, end) and maps it executable; NULL when the
+// stack depth at some instruction depends on the path taken to it
+NativeLoop compile_loop(Chunk* chunk, int header, int end, JitLoop* loop) {
+    const uint8_t* code = chunk->code;
+    int span = end - header;
+
+    // Instruction boundaries; index_at maps byte offsets in the loop to
+    // instruction indexes and everything else to exits
+    int* offsets = malloc(sizeof(int) * (span + 1));
+    int* index_at = malloc(sizeof(int) * (chunk->count + 1));
+    for (int ip = 0; ip <= chunk->count; ip++) index_at[ip] = EXIT_AT(ip);
+    int count = 0;
+    int ip = header;
+    while (ip < end) {
+        if (code[ip] >= OPCODE_COUNT) break;
+        index_at[ip] = count;
+        offsets[count++] = ip;
+        ip += 1 + operand_size(code[ip]);
+    }
+    NativeLoop entry = NULL;
+    int* depth = malloc(sizeof(int) * (count + 1));
+    int* worklist = malloc(sizeof(int) * (count + 1));
+    Emitter e = {{NULL, 0, 0}, NULL, 0, 0};
+    int* native_at = malloc(sizeof(int) * (count + 1));
+    if (ip != end) goto done;
+    for (int ip = header; ip < end; ip += 1 + operand_size(code[ip])) {
+        if (is_jump(code[ip])) {
+            int target = read_u32(code + ip + 1);
+            if (target < 0 || target > chunk->count) goto done;
+        }
+    }
+
+    // Stack depth before each reachable instruction, relative to the header
+    for (int i = 0; i < count; i++) depth[i] = INT32_MIN;
+    depth[0] = 0;
+    worklist[0] = 0;
+    int pending = 1;
+    loop->min_depth = 0;
+    loop->max_depth = 0;
+    while (pending > 0) {
+        int i = worklist[--pending];
+        Opcode op = code[offsets[i]];
+        int pops, pushes;
+        if (!has_template(op, &pops, &pushes)) continue;   // leaves the loop
+        int after = depth[i] - pops + pushes;
+        if (depth[i] - pops < loop->min_depth) loop->min_depth = depth[i] - pops;
+        if (depth[i] - pops + pushes > loop->max_depth) loop->max_depth = depth[i] - pops + pushes;
+        int successors[2];
+        int successor_count = 0;
+        if (op != OP_JMP && i + 1 < count) successors[successor_count++] = i + 1;
+        if (is_jump(op)) successors[successor_count++] = index_at[read_u32(code + offsets[i] + 1)];
+        for (int s = 0; s < successor_count; s++) {
+            int j = successors[s];
+            if (j < 0) continue;
+            if (depth[j] == INT32_MIN) {
+                depth[j] = after;
+                worklist[pending++] = j;
+            } else if (depth[j] != after) {
+                goto done;
+            }
+        }
+    }
+
+    // Prologue: push rbx, r12, r13, r14; mov r12, rdi; mov r13, rsi; mov r14, rdx; mov rbx, [rdx]
+    asm_bytes(&e.a, "\x53\x41\x54\x41\x55\x41\x56\x49\x89\xFC\x49\x89\xF5\x49\x89\xD6\x48\x8B\x1A", 19);
+    for (int i = 0; i < count; i++) {
+        native_at[i] = e.a.count;
+        if (depth[i] == INT32_MIN) continue;   // only reached through the interpreter
+        emit_instruction(&e, chunk, offsets[i], index_at);
+        Opcode op = code[offsets[i]];
+        int pops, pushes;
+        // The next instruction has no code of its own if only the interpreter reaches it
+        if (has_template(op, &pops, &pushes) && op != OP_JMP && (i + 1 == count || depth[i + 1] == INT32_MIN)) {
+            emit_jmp(&e, i + 1 < count ? EXIT_AT(offsets[i + 1]) : EXIT_AT(end));
+        }
+    }
+
+    // Exits: mov eax, ip; then the shared epilogue
+    int fixup_count = e.fixup_count;
+    int epilogue_at = -1;
+    for (int f = 0; f < fixup_count; f++) {
+        Fixup fixup = e.fixups[f];
+        int target;
+        if (fixup.target >= 0) {
+            target = native_at[fixup.target];
+        } else {
+            target = e.a.count;
+            asm_byte(&e.a, 0xB8);
+            asm_u32(&e.a, -1 - fixup.target);
+            if (epilogue_at < 0) {
+                epilogue_at = e.a.count;
+                // mov [r14], rbx; pop r14; pop r13; pop r12; pop rbx; ret
+                asm_bytes(&e.a, "\x49\x89\x1E\x41\x5E\x41\x5D\x41\x5C\x5B\xC3", 11);
+            } else {
+                asm_byte(&e.a, 0xE9);
+                asm_u32(&e.a, epilogue_at - (e.a.count + 4));
+            }
+        }
+        patch_u32(&e.a, fixup.at, target - (fixup.at + 4));
+    }
+
+    // Written while writable, then flipped to executable
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = (e.a.count + page - 1) / page * page;
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) goto done;
+    memcpy(memory, e.a.code, e.a.count);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        goto done;
+    }
+    loop->size = size;
+    entry = (NativeLoop)memory;
+
+done:
+    free(offsets);
+    free(index_at);
+    free(depth);
+    free(worklist);
+    free(native_at);
+    free(e.a.code);
+    free(e.fixups);
+    return entry;
+}
+
+void jit_begin(Chunk* chunk) {
+    jit_chunk = chunk;
+    jit_loops = calloc(chunk->count + 1, sizeof(JitLoop));
+    jit_counts = calloc(chunk->count + 1, sizeof(int));
+    jit_loops_compiled = 0;
+    jit_loops_rejected = 0;
+    jit_entries = 0;
+}
+
+void jit_end() {
+    for (int ip = 0; ip <= jit_chunk->count; ip++) {
+        if (jit_loops[ip].entry) munmap((void*)jit_loops[ip].entry, jit_loops[ip].size);
+    }
+    free(jit_loops);
+    free(jit_counts);
+    jit_loops = NULL;
+    jit_counts = NULL;
+}
+
+// Called on a taken backward jump from end to header with the interpreter's
+// stack in place; returns the byte offset the interpreter continues at
+int jit_loop(int header, int end, int base) {
+    if (jit_counts[header] < JIT_THRESHOLD) {
+        jit_counts[header]++;
+        return header;
+    }
+    JitLoop* loop = &jit_loops[header];
+    if (!loop->compiled) {
+        loop->compiled = 1;
+        loop->entry = compile_loop(jit_chunk, header, end, loop);
+        if (loop->entry) {
+            jit_loops_compiled++;
+        } else {
+            jit_loops_rejected++;
+        }
+    }
+    // The interpreter's push and pop check bounds; native code relies on this instead
+    if (!loop->entry || sp + 1 + loop->min_depth < 0 || sp + loop->max_depth >= STACK_SIZE - 1) return header;
+    jit_entries++;
+    Value* top = stack + sp + 1;
+    int ip = loop->entry(slots, stack + base, &top);
+    sp = (int)(top - stack) - 1;
+    return ip;
+}
+
+#endif
+
+void print_jit_stats() {
+    printf("%-22s %d\n", "loops compiled", jit_loops_compiled);
+    printf("%-22s %d\n", "loops rejected", jit_loops_rejected);
+    printf("%-22s %llu\n", "native entries", jit_entries);
+}
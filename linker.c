@@ -0,0 +1,161 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+extern int label_count;
+
+int is_jump(Opcode op) {
+    switch (op) {
+        case OP_JMP:
+        case OP_JMP_IF_FALSE:
+        case OP_JMP_IF_NOT_EQ:
+        case OP_JMP_IF_NOT_NEQ:
+        case OP_JMP_IF_NOT_GT:
+        case OP_JMP_IF_NOT_LT:
+        case OP_JMP_IF_NOT_GTE:
+        case OP_JMP_IF_NOT_LTE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Resolves every label to the offset of the instruction that follows it,
+// drops the OP_LABEL pseudo-instructions and rewrites jump operands and
+// function entries in place.
+void link_program(IRBuffer* ir) {
+    Instruction* code = ir->code;
+    int count = ir->count;
+    int* offsets = malloc(sizeof(int) * (label_count > 0 ? label_count : 1));
+    for (int i = 0; i < label_count; i++) offsets[i] = -1;
+
+    // Pass 1: final offset of each label once labels are gone
+    int out = 0;
+    for (int i = 0; i < count; i++) {
+        if (code[i].opcode != OP_LABEL) {
+            out++;
+            continue;
+        }
+        int id = code[i].int_value;
+        if (id < 0 || id >= label_count) {
+            printf("LINKER ERROR: Label L%d out of range\n", id);
+            exit(1);
+        }
+        if (offsets[id] != -1) {
+            printf("LINKER ERROR: Label L%d defined twice\n", id);
+            exit(1);
+        }
+        offsets[id] = out;
+    }
+    int linked_count = out;
+
+    // Pass 2: compact the stream and patch jump targets
+    out = 0;
+    for (int i = 0; i < count; i++) {
+        Instruction instr = code[i];
+        if (instr.opcode == OP_LABEL) continue;
+
+        if (is_jump(instr.opcode)) {
+            int id = instr.int_value;
+            if (instr.operand_type != 'l' || id < 0 || id >= label_count || offsets[id] == -1) {
+                printf("LINKER ERROR: Jump at %04d targets undefined label L%d\n", i, id);
+                exit(1);
+            }
+            instr.int_value = offsets[id];
+            instr.operand_type = 'i';
+        }
+        code[out++] = instr;
+    }
+
+    // A target equal to linked_count is the program end and halts the VM
+    for (int i = 0; i < linked_count; i++) {
+        if (is_jump(code[i].opcode) && (code[i].int_value < 0 || code[i].int_value > linked_count)) {
+            printf("LINKER ERROR: Jump at %04d targets %d, outside 0..%d\n", i, code[i].int_value, linked_count);
+            exit(1);
+        }
+    }
+
+    // Function entries become instruction indexes, so OP_CALL needs no lookup
+    for (int f = 0; f < ir->function_count; f++) {
+        int id = ir->functions[f].entry;
+        if (id < 0 || id >= label_count || offsets[id] == -1) {
+            printf("LINKER ERROR: Function '%s' has no entry label\n", ir->functions[f].name);
+            exit(1);
+        }
+        ir->functions[f].entry = offsets[id];
+    }
+    for (int i = 0; i < linked_count; i++) {
+        if (code[i].opcode == OP_CALL && (code[i].int_value < 0 || code[i].int_value >= ir->function_count)) {
+            printf("LINKER ERROR: Call at %04d to unknown function #%d\n", i, code[i].int_value);
+            exit(1);
+        }
+    }
+
+    free(offsets);
+    ir->count = linked_count;
+}
+
+void check_u16(int value, int index) {
+    if (value < 0 || value > 0xFFFF) {
+        printf("LINKER ERROR: Operand %d at %04d does not fit in 16 bits\n", value, index);
+        exit(1);
+    }
+}
+
+// Encodes linked IR into a dense bytecode chunk. Jump targets become byte
+// offsets and the constant pool moves from the IR buffer into the chunk.
+void assemble_program(IRBuffer* ir, Chunk* chunk) {
+    int* offsets = malloc(sizeof(int) * (ir->count + 1));
+    int size = 0;
+    for (int i = 0; i < ir->count; i++) {
+        offsets[i] = size;
+        size += 1 + operand_size(ir->code[i].opcode);
+    }
+    offsets[ir->count] = size;
+
+    init_chunk(chunk);
+    chunk->code = malloc(size > 0 ? size : 1);
+    chunk->capacity = size;
+    chunk->lines = malloc(sizeof(LineInfo) * (ir->count > 0 ? ir->count : 1));
+
+    for (int i = 0; i < ir->count; i++) {
+        Instruction instr = ir->code[i];
+        if (instr.opcode == OP_LABEL) {
+            printf("LINKER ERROR: Label L%d reached the assembler, run link_program first\n", instr.int_value);
+            exit(1);
+        }
+
+        chunk->lines[chunk->line_count++] = (LineInfo){chunk->count, instr.line, instr.column};
+        write_byte(chunk, instr.opcode);
+        if (is_jump(instr.opcode)) {
+            // Instruction index -> byte offset
+            write_u32(chunk, offsets[instr.int_value]);
+            continue;
+        }
+        switch (operand_size(instr.opcode)) {
+            case 2:
+                check_u16(instr.int_value, i);
+                write_u16(chunk, instr.int_value);
+                break;
+            case 4:
+                // Fused slot + constant
+                check_u16(instr.int_value, i);
+                check_u16(instr.extra_value, i);
+                write_u16(chunk, instr.int_value);
+                write_u16(chunk, instr.extra_value);
+                break;
+        }
+    }
+
+    for (int f = 0; f < ir->function_count; f++) {
+        ir->functions[f].entry = offsets[ir->functions[f].entry];
+    }
+
+    chunk->constants = ir->constants;
+    chunk->functions = ir->functions;
+    chunk->function_count = ir->function_count;
+    init_pool(&ir->constants);
+    ir->functions = NULL;
+    ir->function_count = 0;
+    free(offsets);
+}
@@ -0,0 +1,83 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Script output. Everything print produces is formatted into one large
+// buffer that goes out with a single write when it fills. The VM flushes it
+// when it halts and before it reports a VM ERROR, so the error still comes
+// after the output it interrupted.
+
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+char output_buffer[OUTPUT_BUFFER_SIZE];
+int output_used = 0;
+
+// "00" through "99", so integers are converted two digits at a time
+const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+void write_output(const char* data, size_t size) {
+    // Anything printf'd before this output has to reach the terminal first
+    fflush(stdout);
+#ifndef _WIN32
+    while (size > 0) {
+        ssize_t n = write(1, data, size);
+        if (n <= 0) return;
+        data += n;
+        size -= n;
+    }
+#else
+    fwrite(data, 1, size, stdout);
+    fflush(stdout);
+#endif
+}
+
+void flush_output() {
+    if (output_used == 0) return;
+    write_output(output_buffer, output_used);
+    output_used = 0;
+}
+
+void output_bytes(const char* data, size_t size) {
+    if (size > (size_t)(OUTPUT_BUFFER_SIZE - output_used)) {
+        flush_output();
+        // Too big to be worth copying
+        if (size >= OUTPUT_BUFFER_SIZE) {
+            write_output(data, size);
+            return;
+        }
+    }
+    memcpy(output_buffer + output_used, data, size);
+    output_used += size;
+}
+
+void output_char(char c) {
+    if (output_used == OUTPUT_BUFFER_SIZE) flush_output();
+    output_buffer[output_used++] = c;
+}
+
+void output_int(int64_t value) {
+    char text[20];
+    int start = sizeof(text);
+    uint64_t n = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    while (n >= 100) {
+        int pair = (n % 100) * 2;
+        n /= 100;
+        text[--start] = digit_pairs[pair + 1];
+        text[--start] = digit_pairs[pair];
+    }
+    if (n >= 10) {
+        text[--start] = digit_pairs[n * 2 + 1];
+        text[--start] = digit_pairs[n * 2];
+    } else {
+        text[--start] = '0' + n;
+    }
+    if (value < 0) text[--start] = '-';
+    output_bytes(text + start, sizeof(text) - start);
+}
@@ -0,0 +1,135 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Peephole pass over the compiler IR. It runs before link_program(), so
+// OP_LABEL entries are still in the stream and no pattern can fuse across
+// a jump target.
+
+typedef enum {
+    PEEP_ADD_SLOT_CONST,      // LOAD_SLOT x; LOAD_CONST k; ADD|SUB; STORE_SLOT x
+    PEEP_COMPARE_BRANCH,      // EQ|NEQ|GT|LT|GTE|LTE; JMP_IF_FALSE
+    PEEP_LOAD_SLOT_ADD_CONST, // LOAD_SLOT x; LOAD_CONST k; ADD|SUB
+    PEEP_LOAD_SLOT_CONST,     // LOAD_SLOT x; LOAD_CONST k
+    // The slot patterns also match locals (LOAD_LOCAL, STORE_LOCAL)
+    PEEP_PATTERN_COUNT
+} PeepholePattern;
+
+const char* peephole_pattern_names[] = {
+    "add-slot-const",
+    "compare-branch",
+    "load-slot-add-const",
+    "load-slot-const",
+};
+
+int peephole_hits[PEEP_PATTERN_COUNT];
+int peephole_removed = 0;
+
+int is_int_constant(IRBuffer* ir, Instruction instr) {
+    return instr.opcode == OP_LOAD_CONST && ir->constants.items[instr.int_value].type == 'i';
+}
+
+// Fused forms of the slot patterns, for globals and for locals. Adding and
+// subtracting keep separate opcodes so a type error names the right operator.
+typedef struct {
+    Opcode load;
+    Opcode store;
+    Opcode add_in_place;
+    Opcode sub_in_place;
+    Opcode load_add;
+    Opcode load_sub;
+    Opcode load_const;
+} VariableOps;
+
+const VariableOps variable_ops[] = {
+    {OP_LOAD_SLOT, OP_STORE_SLOT, OP_ADD_SLOT_CONST, OP_SUB_SLOT_CONST,
+     OP_LOAD_SLOT_ADD_CONST, OP_LOAD_SLOT_SUB_CONST, OP_LOAD_SLOT_CONST},
+    {OP_LOAD_LOCAL, OP_STORE_LOCAL, OP_ADD_LOCAL_CONST, OP_SUB_LOCAL_CONST,
+     OP_LOAD_LOCAL_ADD_CONST, OP_LOAD_LOCAL_SUB_CONST, OP_LOAD_LOCAL_CONST},
+};
+
+const VariableOps* variable_load(Opcode op) {
+    for (int i = 0; i < 2; i++) {
+        if (variable_ops[i].load == op) return &variable_ops[i];
+    }
+    return NULL;
+}
+
+int is_add_or_sub(Opcode op) {
+    return op == OP_ADD || op == OP_SUB;
+}
+
+Opcode fused_branch(Opcode compare) {
+    switch (compare) {
+        case OP_EQ: return OP_JMP_IF_NOT_EQ;
+        case OP_NEQ: return OP_JMP_IF_NOT_NEQ;
+        case OP_GT: return OP_JMP_IF_NOT_GT;
+        case OP_LT: return OP_JMP_IF_NOT_LT;
+        case OP_GTE: return OP_JMP_IF_NOT_GTE;
+        case OP_LTE: return OP_JMP_IF_NOT_LTE;
+        default: return OP_LABEL;
+    }
+}
+
+// Rewrites ir->code in place, trying longer patterns first at each position
+void peephole_optimize(IRBuffer* ir) {
+    Instruction* code = ir->code;
+    int count = ir->count;
+    int out = 0;
+    int i = 0;
+
+    while (i < count) {
+        Instruction a = code[i];
+        int left = count - i;
+        const VariableOps* var = variable_load(a.opcode);
+
+        if (var && left >= 4 && is_int_constant(ir, code[i + 1]) && is_add_or_sub(code[i + 2].opcode) &&
+            code[i + 3].opcode == var->store && code[i + 3].int_value == a.int_value) {
+            Opcode fused = code[i + 2].opcode == OP_ADD ? var->add_in_place : var->sub_in_place;
+            code[out++] = (Instruction){.opcode = fused, .int_value = a.int_value, .extra_value = code[i + 1].int_value,
+                                        .operand_type = 'v', .line = a.line, .column = a.column};
+            peephole_hits[PEEP_ADD_SLOT_CONST]++;
+            i += 4;
+            continue;
+        }
+
+        if (left >= 2 && fused_branch(a.opcode) != OP_LABEL && code[i + 1].opcode == OP_JMP_IF_FALSE) {
+            code[out++] = (Instruction){.opcode = fused_branch(a.opcode), .int_value = code[i + 1].int_value, .operand_type = code[i + 1].operand_type,
+                                        .line = a.line, .column = a.column};
+            peephole_hits[PEEP_COMPARE_BRANCH]++;
+            i += 2;
+            continue;
+        }
+
+        if (var && left >= 3 && is_int_constant(ir, code[i + 1]) && is_add_or_sub(code[i + 2].opcode)) {
+            Opcode fused = code[i + 2].opcode == OP_ADD ? var->load_add : var->load_sub;
+            code[out++] = (Instruction){.opcode = fused, .int_value = a.int_value, .extra_value = code[i + 1].int_value,
+                                        .operand_type = 'v', .line = a.line, .column = a.column};
+            peephole_hits[PEEP_LOAD_SLOT_ADD_CONST]++;
+            i += 3;
+            continue;
+        }
+
+        if (var && left >= 2 && code[i + 1].opcode == OP_LOAD_CONST) {
+            code[out++] = (Instruction){.opcode = var->load_const, .int_value = a.int_value, .extra_value = code[i + 1].int_value, .operand_type = 'v',
+                                              .line = a.line, .column = a.column};
+            peephole_hits[PEEP_LOAD_SLOT_CONST]++;
+            i += 2;
+            continue;
+        }
+
+        code[out++] = a;
+        i++;
+    }
+
+    peephole_removed += count - out;
+    ir->count = out;
+}
+
+void print_peephole_stats() {
+    printf("%-22s %s\n", "pattern", "hits");
+    for (int i = 0; i < PEEP_PATTERN_COUNT; i++) {
+        printf("%-22s %d\n", peephole_pattern_names[i], peephole_hits[i]);
+    }
+    printf("%-22s %d\n", "instructions removed", peephole_removed);
+}
@@ -0,0 +1,111 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#ifdef PENGUIN_PROFILE
+
+// Per byte offset execution counts and time. Each dispatch charges the time
+// since the previous dispatch to the previous instruction, so an entry's time
+// includes its handler and the dispatch that follows it.
+uint64_t* profile_counts = NULL;
+uint64_t* profile_cycles = NULL;
+int profile_last = -1;
+uint64_t profile_stamp = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_UNIT "cycles"
+
+uint64_t profile_clock() {
+    return __rdtsc();
+}
+#else
+#include <time.h>
+#define PROFILE_UNIT "ns"
+
+uint64_t profile_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+#endif
+
+#define HOT_SPOTS 10
+
+void profile_begin(Chunk* chunk) {
+    // One extra entry for the threaded engine's implicit halt at the end
+    free(profile_counts);
+    free(profile_cycles);
+    profile_counts = calloc(chunk->count + 1, sizeof(uint64_t));
+    profile_cycles = calloc(chunk->count + 1, sizeof(uint64_t));
+    profile_last = -1;
+    profile_stamp = profile_clock();
+}
+
+void profile_end() {
+    if (profile_last >= 0) profile_cycles[profile_last] += profile_clock() - profile_stamp;
+    profile_last = -1;
+}
+
+void print_profile_row(const char* name, uint64_t count, uint64_t cycles, uint64_t total) {
+    printf("%-20s %12" PRIu64 " %14" PRIu64 " %6.2f%%", name, count, cycles,
+           total ? 100.0 * cycles / total : 0.0);
+}
+
+// Per-opcode totals, then the hottest instructions with their source position
+void print_profile(Chunk* chunk) {
+    uint64_t op_counts[OPCODE_COUNT] = {0};
+    uint64_t op_cycles[OPCODE_COUNT] = {0};
+    uint64_t total = 0;
+    int op_count = 0;
+    for (int ip = 0; ip < chunk->count; ip += 1 + operand_size(chunk->code[ip])) {
+        Opcode op = chunk->code[ip];
+        op_counts[op] += profile_counts[ip];
+        op_cycles[op] += profile_cycles[ip];
+        total += profile_cycles[ip];
+        op_count++;
+    }
+
+    int order[OPCODE_COUNT];
+    for (int i = 0; i < OPCODE_COUNT; i++) order[i] = i;
+    for (int i = 1; i < OPCODE_COUNT; i++) {
+        for (int j = i; j > 0 && op_cycles[order[j]] > op_cycles[order[j - 1]]; j--) {
+            int t = order[j]; order[j] = order[j - 1]; order[j - 1] = t;
+        }
+    }
+
+    printf("%-20s %12s %14s %7s\n", "opcode", "count", PROFILE_UNIT, "time");
+    for (int i = 0; i < OPCODE_COUNT; i++) {
+        Opcode op = order[i];
+        if (!op_counts[op]) continue;
+        print_profile_row(opcode_names[op], op_counts[op], op_cycles[op], total);
+        printf("\n");
+    }
+
+    // Hottest addresses, by time
+    int* hot = malloc(sizeof(int) * (op_count > 0 ? op_count : 1));
+    int hot_count = 0;
+    for (int ip = 0; ip < chunk->count; ip += 1 + operand_size(chunk->code[ip])) {
+        if (!profile_counts[ip]) continue;
+        int j = hot_count++;
+        for (; j > 0 && profile_cycles[ip] > profile_cycles[hot[j - 1]]; j--) hot[j] = hot[j - 1];
+        hot[j] = ip;
+    }
+
+    printf("\n%-4s  %-20s %12s %14s %7s  %s\n", "addr", "opcode", "count", PROFILE_UNIT, "time", "source");
+    for (int i = 0; i < hot_count && i < HOT_SPOTS; i++) {
+        int ip = hot[i];
+        LineInfo pos = chunk_line(chunk, ip);
+        printf("%04d  ", ip);
+        print_profile_row(opcode_names[chunk->code[ip]], profile_counts[ip], profile_cycles[ip], total);
+        if (pos.line) {
+            printf("  %d:%d\n", pos.line, pos.column);
+        } else {
+            printf("  -\n");
+        }
+    }
+    free(hot);
+}
+
+#endif
@@ -0,0 +1,649 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Operands are tagged as constants while compiling, because the final
+// register count (and so the start of the constant area) is only known
+// once the whole program has been generated.
+#define REG_CONST_FLAG 0x8000
+#define REG_LIMIT 0x7FFF
+
+int reg_next_temp = 0;
+int reg_frame_size = 0;    // registers the body being compiled needs so far
+int reg_function = -1;     // function being compiled, -1 for top-level code
+
+void emit_reg(RegChunk* chunk, RegInstr instr) {
+    if (chunk->count == chunk->capacity) {
+        chunk->capacity = chunk->capacity ? chunk->capacity * 2 : 256;
+        chunk->code = realloc(chunk->code, sizeof(RegInstr) * chunk->capacity);
+    }
+    chunk->code[chunk->count++] = instr;
+}
+
+int alloc_temp() {
+    int reg = reg_next_temp++;
+    if (reg >= REG_LIMIT) {
+        printf("COMPILER ERROR: Expression needs more than %d registers\n", REG_LIMIT);
+        exit(1);
+    }
+    if (reg_next_temp > reg_frame_size) reg_frame_size = reg_next_temp;
+    return reg;
+}
+
+void reg_expr_to(ASTNode* node, RegChunk* chunk, int dst);
+
+// Operand for constant pool entry index, placed in the frame by reg_fix_frame
+int reg_constant(int index) {
+    if (index >= REG_LIMIT) {
+        printf("COMPILER ERROR: Program has more than %d constants\n", REG_LIMIT);
+        exit(1);
+    }
+    return REG_CONST_FLAG | index;
+}
+
+// Returns a register holding the value of node. Locals, top-level
+// variables and literals cost no instruction at all; anything else
+// (including a global read from a function body) is computed into a
+// temporary.
+int reg_operand(ASTNode* node, RegChunk* chunk) {
+    switch (node->type) {
+        case AST_VARIABLE: {
+            int id = variable_id(node->name);
+            if (id < MAX_VARS) return id;
+            if (reg_function < 0) return id - MAX_VARS;
+            int tmp = alloc_temp();
+            emit_reg(chunk, (RegInstr){.op = R_GET_GLOBAL, .a = tmp, .b = id - MAX_VARS});
+            return tmp;
+        }
+        case AST_NUMBER:
+            return reg_constant(add_int_constant(&chunk->constants, node->number));
+        case AST_STRING:
+            return reg_constant(add_string_constant(&chunk->constants, node->string));
+        default: {
+            int tmp = alloc_temp();
+            reg_expr_to(node, chunk, tmp);
+            return tmp;
+        }
+    }
+}
+
+// Like reg_operand, but the register must still hold the value after later
+// is evaluated: a top-level variable is read in place, so it is copied
+// first when later calls a function that could assign it
+int reg_operand_before(ASTNode* node, ASTNode* later, RegChunk* chunk) {
+    int reg = reg_operand(node, chunk);
+    if (node->type == AST_VARIABLE && reg_function < 0 && calls_user_function(later)) {
+        int tmp = alloc_temp();
+        emit_reg(chunk, (RegInstr){.op = R_MOVE, .a = tmp, .b = reg});
+        return tmp;
+    }
+    return reg;
+}
+
+RegOpcode reg_binary_opcode(char op) {
+    switch (op) {
+        case '+': return R_ADD;
+        case '-': return R_SUB;
+        case '*': return R_MUL;
+        case '/': return R_DIV;
+        case '>': return R_GT;
+        case '<': return R_LT;
+        case '=': return R_EQ;
+        case '!': return R_NEQ;
+        case 'G': return R_GTE;
+        case 'L': return R_LTE;
+    }
+    printf("COMPILER ERROR: Unknown binary operator '%c'\n", op);
+    exit(1);
+}
+
+void reg_call(ASTNode* node, RegChunk* chunk) {
+    // Arguments sit in consecutive registers; the first doubles as the
+    // result register, so one is reserved even for calls without arguments
+    int base = alloc_temp();
+    for (int i = 1; i < node->function_call.arg_count; i++) {
+        alloc_temp();
+    }
+    for (int i = 0; i < node->function_call.arg_count; i++) {
+        reg_expr_to(node->function_call.args[i], chunk, base + i);
+    }
+    int f = find_function(node->function_call.name);
+    int builtin = f < 0 ? resolve_builtin(node->function_call.name, node->function_call.arg_count) : -1;
+    if (f >= 0) {
+        emit_reg(chunk, (RegInstr){.op = R_CALL_FUNC, .a = base, .b = node->function_call.arg_count, .c = f});
+    } else if (builtin >= 0) {
+        emit_reg(chunk, (RegInstr){.op = R_CALL_BUILTIN, .a = base, .b = node->function_call.arg_count, .c = builtin});
+    } else {
+        int name = add_string_constant(&chunk->constants, node->function_call.name);
+        emit_reg(chunk, (RegInstr){.op = R_CALL, .a = base, .b = node->function_call.arg_count, .c = name});
+    }
+}
+
+// Computes node straight into register dst
+void reg_expr_to(ASTNode* node, RegChunk* chunk, int dst) {
+    int mark = reg_next_temp;
+    switch (node->type) {
+        case AST_BINARY_OP: {
+            // A left-nested chain (see push_spine) keeps its running value in
+            // one temporary; only the outermost node writes dst
+            int base = push_spine(node);
+            int acc = spine_top - base > 1 ? alloc_temp() : dst;
+            int level = reg_next_temp;
+            ASTNode* inner = spine[spine_top - 1];
+            int b = reg_operand_before(inner->binary.left, inner->binary.right, chunk);
+            int c = reg_operand(inner->binary.right, chunk);
+            emit_reg(chunk, (RegInstr){.op = reg_binary_opcode(inner->binary.op), .a = acc, .b = b, .c = c});
+            for (int i = spine_top - 2; i >= base; i--) {
+                reg_next_temp = level;
+                c = reg_operand(spine[i]->binary.right, chunk);
+                emit_reg(chunk, (RegInstr){.op = reg_binary_opcode(spine[i]->binary.op), .a = i == base ? dst : acc, .b = acc, .c = c});
+            }
+            spine_top = base;
+            break;
+        }
+        case AST_FUNCTION_CALL:
+            reg_call(node, chunk);
+            emit_reg(chunk, (RegInstr){.op = R_MOVE, .a = dst, .b = mark});
+            break;
+        case AST_ARRAY: {
+            // Elements are gathered in consecutive registers, like arguments
+            int base = alloc_temp();
+            for (int i = 1; i < node->array.count; i++) {
+                alloc_temp();
+            }
+            for (int i = 0; i < node->array.count; i++) {
+                reg_expr_to(node->array.elements[i], chunk, base + i);
+            }
+            emit_reg(chunk, (RegInstr){.op = R_ARRAY, .a = base, .b = node->array.count});
+            emit_reg(chunk, (RegInstr){.op = R_MOVE, .a = dst, .b = base});
+            break;
+        }
+        case AST_INDEX: {
+            int b = reg_operand_before(node->index.array, node->index.index, chunk);
+            int c = reg_operand(node->index.index, chunk);
+            emit_reg(chunk, (RegInstr){.op = R_INDEX, .a = dst, .b = b, .c = c});
+            break;
+        }
+        default: {
+            int src = reg_operand(node, chunk);
+            if (src != dst) emit_reg(chunk, (RegInstr){.op = R_MOVE, .a = dst, .b = src});
+            break;
+        }
+    }
+    reg_next_temp = mark;
+}
+
+// Emits a jump taken when cond is false and returns its index for patching.
+// Comparisons fuse into a single compare-and-branch instruction.
+int reg_jump_if_false(ASTNode* cond, RegChunk* chunk) {
+    int mark = reg_next_temp;
+    if (cond->type == AST_BINARY_OP) {
+        RegOpcode fused = -1;
+        switch (cond->binary.op) {
+            case '=': fused = R_JMP_NOT_EQ; break;
+            case '!': fused = R_JMP_NOT_NEQ; break;
+            case '>': fused = R_JMP_NOT_GT; break;
+            case '<': fused = R_JMP_NOT_LT; break;
+            case 'G': fused = R_JMP_NOT_GTE; break;
+            case 'L': fused = R_JMP_NOT_LTE; break;
+        }
+        if ((int)fused != -1) {
+            int b = reg_operand_before(cond->binary.left, cond->binary.right, chunk);
+            int c = reg_operand(cond->binary.right, chunk);
+            emit_reg(chunk, (RegInstr){.op = fused, .b = b, .c = c, .target = -1});
+            reg_next_temp = mark;
+            return chunk->count - 1;
+        }
+    }
+    int a = reg_operand(cond, chunk);
+    emit_reg(chunk, (RegInstr){.op = R_JMP_IF_FALSE, .a = a, .target = -1});
+    reg_next_temp = mark;
+    return chunk->count - 1;
+}
+
+void reg_statement(ASTNode* node, RegChunk* chunk) {
+    int mark = reg_next_temp;
+    switch (node->type) {
+        case AST_ASSIGNMENT: {
+            int id = variable_id(node->assignment.name);
+            if (id < MAX_VARS) {
+                reg_expr_to(node->assignment.value, chunk, id);
+            } else if (reg_function < 0) {
+                reg_expr_to(node->assignment.value, chunk, id - MAX_VARS);
+            } else {
+                int value = reg_operand(node->assignment.value, chunk);
+                emit_reg(chunk, (RegInstr){.op = R_SET_GLOBAL, .a = id - MAX_VARS, .b = value});
+            }
+            break;
+        }
+
+        case AST_IF: {
+            int jump_else = reg_jump_if_false(node->if_stmt.condition, chunk);
+            reg_statement(node->if_stmt.then_branch, chunk);
+            if (node->if_stmt.else_branch) {
+                emit_reg(chunk, (RegInstr){.op = R_JMP, .target = -1});
+                int jump_end = chunk->count - 1;
+                chunk->code[jump_else].target = chunk->count;
+                reg_statement(node->if_stmt.else_branch, chunk);
+                chunk->code[jump_end].target = chunk->count;
+            } else {
+                chunk->code[jump_else].target = chunk->count;
+            }
+            break;
+        }
+
+        case AST_WHILE: {
+            int start = chunk->count;
+            int jump_end = reg_jump_if_false(node->while_stmt.condition, chunk);
+            reg_statement(node->while_stmt.body, chunk);
+            emit_reg(chunk, (RegInstr){.op = R_JMP, .target = start});
+            chunk->code[jump_end].target = chunk->count;
+            break;
+        }
+
+        case AST_BLOCK:
+            for (int i = 0; i < node->block.count; i++) {
+                reg_statement(node->block.statements[i], chunk);
+            }
+            break;
+
+        case AST_FUNCTION_CALL:
+            reg_call(node, chunk);
+            break;
+
+        case AST_INDEX_ASSIGNMENT: {
+            int a = reg_operand_before(node->index.array, node, chunk);
+            int b = reg_operand_before(node->index.index, node->index.value, chunk);
+            int c = reg_operand(node->index.value, chunk);
+            emit_reg(chunk, (RegInstr){.op = R_STORE_INDEX, .a = a, .b = b, .c = c});
+            break;
+        }
+
+        case AST_RETURN:
+            emit_reg(chunk, (RegInstr){.op = R_RETURN, .a = reg_operand(node->return_stmt.value, chunk)});
+            break;
+
+        case AST_FUNCTION_DEF:
+            // Compiled as a body of its own by compile_register
+            break;
+
+        default:
+            // Bare expression statement: evaluate for side effects only
+            reg_operand(node, chunk);
+            break;
+    }
+    reg_next_temp = mark;
+}
+
+// Which of a, b and c name registers (bits 1, 2 and 4); the others are
+// counts, slots, targets or table indices
+int reg_operand_fields(RegOpcode op) {
+    switch (op) {
+        case R_MOVE: return 3;
+        case R_JMP: case R_HALT: return 0;
+        case R_JMP_IF_FALSE: case R_CALL: case R_CALL_BUILTIN: case R_CALL_FUNC:
+        case R_ARRAY: case R_RETURN: case R_GET_GLOBAL:
+            return 1;
+        case R_JMP_NOT_EQ: case R_JMP_NOT_NEQ: case R_JMP_NOT_GT:
+        case R_JMP_NOT_LT: case R_JMP_NOT_GTE: case R_JMP_NOT_LTE:
+            return 6;
+        case R_SET_GLOBAL: return 2;
+        default: return 7;
+    }
+}
+
+// Lays out the frame of the body in code[start, end): the constants it
+// uses get registers right after the locals and the temporaries move up
+// past them
+void reg_fix_frame(RegChunk* chunk, int start, int end, RegFunction* body) {
+    int* position = malloc(sizeof(int) * (chunk->constants.count ? chunk->constants.count : 1));
+    for (int k = 0; k < chunk->constants.count; k++) position[k] = -1;
+    body->constants = malloc(sizeof(int) * (chunk->constants.count ? chunk->constants.count : 1));
+    body->constant_count = 0;
+    // The constant count has to be final before any temporary is moved
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = start; i < end; i++) {
+            RegInstr* instr = &chunk->code[i];
+            uint16_t* fields[3] = {&instr->a, &instr->b, &instr->c};
+            int mask = reg_operand_fields(instr->op);
+            for (int f = 0; f < 3; f++) {
+                if (!(mask & (1 << f))) continue;
+                int operand = *fields[f];
+                if (operand & REG_CONST_FLAG) {
+                    int k = operand & ~REG_CONST_FLAG;
+                    if (position[k] < 0) {
+                        position[k] = body->constant_count;
+                        body->constants[body->constant_count++] = k;
+                    }
+                    if (pass == 1) *fields[f] = body->local_count + position[k];
+                } else if (pass == 1 && operand >= body->local_count) {
+                    *fields[f] = operand + body->constant_count;
+                }
+            }
+        }
+    }
+    free(position);
+    body->frame_size = reg_frame_size + body->constant_count;
+    if (body->frame_size > 0xFFFF) {
+        printf("COMPILER ERROR: '%s' needs more than %d registers and constants\n", body->name, 0xFFFF);
+        exit(1);
+    }
+}
+
+// Compiles one body (function -1 is top-level code) into its own frame
+void reg_body(ASTNode* body, RegChunk* chunk, int function, RegFunction* out) {
+    enter_scope(function);
+    reg_function = function;
+    out->entry = chunk->count;
+    out->local_count = function < 0 ? slot_count : functions[function].local_count;
+    out->param_count = function < 0 ? 0 : functions[function].param_count;
+    out->name = function < 0 ? "<main>" : functions[function].name;
+    reg_next_temp = out->local_count;
+    reg_frame_size = out->local_count;
+
+    reg_statement(body, chunk);
+    if (function < 0) {
+        emit_reg(chunk, (RegInstr){.op = R_HALT});
+    } else {
+        // Falling off the end of a function returns 0, as in the stack VM
+        int zero = reg_constant(add_int_constant(&chunk->constants, 0));
+        emit_reg(chunk, (RegInstr){.op = R_RETURN, .a = zero});
+    }
+    reg_fix_frame(chunk, out->entry, chunk->count, out);
+}
+
+// Generates register code for the whole program: top-level code first,
+// then one body per function. Expects resolve_symbols() to have run so
+// that variables already own their slot and local numbers.
+void compile_register(ASTNode* program, RegChunk* chunk) {
+    chunk->code = NULL;
+    chunk->count = 0;
+    chunk->capacity = 0;
+    init_pool(&chunk->constants);
+    chunk->function_count = 0;
+    chunk->functions = malloc(sizeof(RegFunction) * MAX_FUNCS);
+
+    reg_body(program, chunk, -1, &chunk->main);
+    if (program->type == AST_BLOCK) {
+        for (int i = 0; i < program->block.count; i++) {
+            ASTNode* def = program->block.statements[i];
+            if (def->type != AST_FUNCTION_DEF) continue;
+            int f = find_function(def->function_def.name);
+            reg_body(def->function_def.body, chunk, f, &chunk->functions[f]);
+            if (f >= chunk->function_count) chunk->function_count = f + 1;
+        }
+    }
+    enter_scope(-1);
+    reg_function = -1;
+}
+
+const char* reg_opcode_names[] = {
+    "MOVE", "ADD", "SUB", "MUL", "DIV", "EQ", "NEQ", "GT", "LT", "GTE", "LTE",
+    "JMP", "JMP_IF_FALSE", "JMP_NOT_EQ", "JMP_NOT_NEQ", "JMP_NOT_GT",
+    "JMP_NOT_LT", "JMP_NOT_GTE", "JMP_NOT_LTE", "CALL", "CALL_BUILTIN", "HALT",
+    "ARRAY", "INDEX", "STORE_INDEX", "CALL_FUNC", "RETURN", "GET_GLOBAL", "SET_GLOBAL"
+};
+
+// Prints r<n> for registers (with the variable name for top-level slots)
+// and K<n> for the body's constant registers
+void print_reg_operand(RegChunk* chunk, RegFunction* body, int operand) {
+    int k = operand - body->local_count;
+    if (k >= 0 && k < body->constant_count) {
+        Constant* c = &chunk->constants.items[body->constants[k]];
+        printf("K%d(", body->constants[k]);
+        if (c->type == 's') printf("\"%s\"", c->str_value);
+        else printf("%lld", (long long)c->int_value);
+        printf(")");
+    } else if (body == &chunk->main && operand < slot_count) {
+        printf("r%d(%s)", operand, slot_names[operand]);
+    } else {
+        printf("r%d", operand);
+    }
+}
+
+void print_reg_asm(RegChunk* chunk) {
+    printf("; %d instructions, %d constants, %d registers at top level\n",
+           chunk->count, chunk->constants.count, chunk->main.frame_size);
+    RegFunction* body = &chunk->main;
+    for (int i = 0; i < chunk->count; i++) {
+        for (int f = 0; f < chunk->function_count; f++) {
+            RegFunction* fn = &chunk->functions[f];
+            if (fn->entry != i) continue;
+            body = fn;
+            printf("; func %s: %d params, %d locals, %d registers\n", fn->name, fn->param_count,
+                   fn->local_count, fn->frame_size);
+        }
+        RegInstr instr = chunk->code[i];
+        printf("%04d: %s ", i, reg_opcode_names[instr.op]);
+        switch (instr.op) {
+            case R_MOVE:
+                print_reg_operand(chunk, body, instr.a);
+                printf(", ");
+                print_reg_operand(chunk, body, instr.b);
+                break;
+            case R_JMP:
+                printf("%04d", instr.target);
+                break;
+            case R_JMP_IF_FALSE:
+                print_reg_operand(chunk, body, instr.a);
+                printf(", %04d", instr.target);
+                break;
+            case R_JMP_NOT_EQ: case R_JMP_NOT_NEQ: case R_JMP_NOT_GT:
+            case R_JMP_NOT_LT: case R_JMP_NOT_GTE: case R_JMP_NOT_LTE:
+                print_reg_operand(chunk, body, instr.b);
+                printf(", ");
+                print_reg_operand(chunk, body, instr.c);
+                printf(", %04d", instr.target);
+                break;
+            case R_CALL:
+                printf("%s, r%d, %d args", chunk->constants.items[instr.c].str_value, instr.a, instr.b);
+                break;
+            case R_CALL_BUILTIN:
+                printf("%s, r%d, %d args", builtins[instr.c].name, instr.a, instr.b);
+                break;
+            case R_CALL_FUNC:
+                printf("%s, r%d, %d args", chunk->functions[instr.c].name, instr.a, instr.b);
+                break;
+            case R_HALT:
+                break;
+            case R_RETURN:
+                print_reg_operand(chunk, body, instr.a);
+                break;
+            case R_GET_GLOBAL:
+                print_reg_operand(chunk, body, instr.a);
+                printf(", g%d(%s)", instr.b, slot_names[instr.b]);
+                break;
+            case R_SET_GLOBAL:
+                printf("g%d(%s), ", instr.a, slot_names[instr.a]);
+                print_reg_operand(chunk, body, instr.b);
+                break;
+            case R_ARRAY:
+                printf("r%d, %d items", instr.a, instr.b);
+                break;
+            default:
+                print_reg_operand(chunk, body, instr.a);
+                printf(", ");
+                print_reg_operand(chunk, body, instr.b);
+                printf(", ");
+                print_reg_operand(chunk, body, instr.c);
+                break;
+        }
+        printf("\n");
+    }
+}
+
+// A call remembers where to resume and the caller's frame
+typedef struct {
+    RegInstr* return_pc;
+    int base;
+} RegFrame;
+
+// Clears a body's locals (parameters excepted) and copies in its constants
+static void reg_enter(RegChunk* chunk, RegFunction* body, Value* R) {
+    for (int r = body->param_count; r < body->local_count; r++) R[r] = VAL_NIL;
+    for (int k = 0; k < body->constant_count; k++) {
+        R[body->local_count + k] = chunk->constants.items[body->constants[k]].value;
+    }
+}
+
+void run_regvm(RegChunk* chunk) {
+    // Frames are stacked in one register file that grows on demand
+    int capacity = chunk->main.frame_size > 1024 ? chunk->main.frame_size : 1024;
+    Value* registers = malloc(sizeof(Value) * capacity);
+    RegFrame* frames = malloc(sizeof(RegFrame) * CALL_STACK_SIZE);
+    int frame_count = 0;
+    int base = 0;
+    Value* R = registers;
+    reg_enter(chunk, &chunk->main, R);
+
+    RegInstr* code = chunk->code;
+    RegInstr* pc = code;
+    RegInstr* i;
+
+#ifdef PENGUIN_THREADED
+    static void* handlers[] = {
+        [R_MOVE] = &&do_move, [R_ADD] = &&do_add, [R_SUB] = &&do_sub,
+        [R_MUL] = &&do_mul, [R_DIV] = &&do_div, [R_EQ] = &&do_eq,
+        [R_NEQ] = &&do_neq, [R_GT] = &&do_gt, [R_LT] = &&do_lt,
+        [R_GTE] = &&do_gte, [R_LTE] = &&do_lte, [R_JMP] = &&do_jmp,
+        [R_JMP_IF_FALSE] = &&do_jmp_if_false, [R_JMP_NOT_EQ] = &&do_jmp_not_eq,
+        [R_JMP_NOT_NEQ] = &&do_jmp_not_neq, [R_JMP_NOT_GT] = &&do_jmp_not_gt,
+        [R_JMP_NOT_LT] = &&do_jmp_not_lt, [R_JMP_NOT_GTE] = &&do_jmp_not_gte,
+        [R_JMP_NOT_LTE] = &&do_jmp_not_lte, [R_CALL] = &&do_call,
+        [R_CALL_BUILTIN] = &&do_call_builtin, [R_HALT] = &&do_halt,
+        [R_ARRAY] = &&do_array, [R_INDEX] = &&do_index, [R_STORE_INDEX] = &&do_store_index,
+        [R_CALL_FUNC] = &&do_call_func, [R_RETURN] = &&do_return,
+        [R_GET_GLOBAL] = &&do_get_global, [R_SET_GLOBAL] = &&do_set_global,
+    };
+#define NEXT() do { COUNT_OP(); i = pc++; goto *handlers[i->op]; } while (0)
+#else
+#define NEXT() do { COUNT_OP(); i = pc++; goto dispatch; } while (0)
+#endif
+#define BINARY(expr) do { Value b = R[i->b]; Value c = R[i->c]; R[i->a] = (expr); NEXT(); } while (0)
+#define BRANCH_UNLESS(cond) do { if (!(cond)) pc = code + i->target; NEXT(); } while (0)
+
+    NEXT();
+
+#ifndef PENGUIN_THREADED
+dispatch:
+    switch (i->op) {
+        case R_MOVE: goto do_move;
+        case R_ADD: goto do_add;
+        case R_SUB: goto do_sub;
+        case R_MUL: goto do_mul;
+        case R_DIV: goto do_div;
+        case R_EQ: goto do_eq;
+        case R_NEQ: goto do_neq;
+        case R_GT: goto do_gt;
+        case R_LT: goto do_lt;
+        case R_GTE: goto do_gte;
+        case R_LTE: goto do_lte;
+        case R_JMP: goto do_jmp;
+        case R_JMP_IF_FALSE: goto do_jmp_if_false;
+        case R_JMP_NOT_EQ: goto do_jmp_not_eq;
+        case R_JMP_NOT_NEQ: goto do_jmp_not_neq;
+        case R_JMP_NOT_GT: goto do_jmp_not_gt;
+        case R_JMP_NOT_LT: goto do_jmp_not_lt;
+        case R_JMP_NOT_GTE: goto do_jmp_not_gte;
+        case R_JMP_NOT_LTE: goto do_jmp_not_lte;
+        case R_CALL: goto do_call;
+        case R_CALL_BUILTIN: goto do_call_builtin;
+        case R_HALT: goto do_halt;
+        case R_ARRAY: goto do_array;
+        case R_INDEX: goto do_index;
+        case R_STORE_INDEX: goto do_store_index;
+        case R_CALL_FUNC: goto do_call_func;
+        case R_RETURN: goto do_return;
+        case R_GET_GLOBAL: goto do_get_global;
+        case R_SET_GLOBAL: goto do_set_global;
+        default:
+            flush_output();
+            printf("VM ERROR: Unknown register opcode %d\n", i->op);
+            exit(1);
+    }
+#endif
+
+do_move:
+    R[i->a] = R[i->b];
+    NEXT();
+do_add: BINARY(VALUE_ADD(b, c));
+do_sub: BINARY(VALUE_SUB(b, c));
+do_mul: BINARY(VALUE_MUL(b, c));
+do_div: BINARY(divide(b, c));
+do_eq: BINARY(make_bool(VALUE_EQ(b, c)));
+do_neq: BINARY(make_bool(!VALUE_EQ(b, c)));
+do_gt: BINARY(make_bool(VALUE_CMP(b, >, c)));
+do_lt: BINARY(make_bool(VALUE_CMP(b, <, c)));
+do_gte: BINARY(make_bool(VALUE_CMP(b, >=, c)));
+do_lte: BINARY(make_bool(VALUE_CMP(b, <=, c)));
+do_jmp:
+    pc = code + i->target;
+    NEXT();
+do_jmp_if_false: BRANCH_UNLESS(!is_falsey(R[i->a]));
+do_jmp_not_eq: BRANCH_UNLESS(VALUE_EQ(R[i->b], R[i->c]));
+do_jmp_not_neq: BRANCH_UNLESS(!VALUE_EQ(R[i->b], R[i->c]));
+do_jmp_not_gt: BRANCH_UNLESS(VALUE_CMP(R[i->b], >, R[i->c]));
+do_jmp_not_lt: BRANCH_UNLESS(VALUE_CMP(R[i->b], <, R[i->c]));
+do_jmp_not_gte: BRANCH_UNLESS(VALUE_CMP(R[i->b], >=, R[i->c]));
+do_jmp_not_lte: BRANCH_UNLESS(VALUE_CMP(R[i->b], <=, R[i->c]));
+do_call_builtin:
+    // The result lands in the first argument register
+    R[i->a] = builtins[i->c].call(R + i->a, i->b);
+    NEXT();
+do_array:
+    R[i->a] = array_literal(R + i->a, i->b);
+    NEXT();
+do_index: BINARY(index_array(b, c));
+do_store_index:
+    store_index(R[i->a], R[i->b], R[i->c]);
+    NEXT();
+do_call_func: {
+    RegFunction* f = &chunk->functions[i->c];
+    if (frame_count >= CALL_STACK_SIZE) {
+        flush_output();
+        printf("VM ERROR: Call stack overflow in '%s'\n", f->name);
+        exit(1);
+    }
+    int callee = base + i->a;
+    if (callee + f->frame_size > capacity) {
+        while (callee + f->frame_size > capacity) capacity *= 2;
+        registers = realloc(registers, sizeof(Value) * capacity);
+    }
+    frames[frame_count].return_pc = pc;
+    frames[frame_count].base = base;
+    frame_count++;
+    base = callee;
+    R = registers + base;
+    reg_enter(chunk, f, R);
+    pc = code + f->entry;
+    NEXT();
+}
+do_return: {
+    // The callee's first register is the caller's call register
+    R[0] = R[i->a];
+    RegFrame frame = frames[--frame_count];
+    base = frame.base;
+    R = registers + base;
+    pc = frame.return_pc;
+    NEXT();
+}
+do_get_global:
+    R[i->a] = registers[i->b];
+    NEXT();
+do_set_global:
+    registers[i->a] = R[i->b];
+    NEXT();
+do_call:
+    flush_output();
+    printf("VM ERROR: Unknown function '%s'\n", chunk->constants.items[i->c].str_value);
+    exit(1);
+do_halt:
+    free(registers);
+    free(frames);
+    flush_output();
+
+#undef NEXT
+#undef BINARY
+#undef BRANCH_UNLESS
+}
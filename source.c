@@ -0,0 +1,99 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define READ_CHUNK 65536
+
+// Reads until EOF in fixed-size chunks, for pipes and other unmappable input
+char* read_all(FILE* f, size_t* size) {
+    size_t capacity = READ_CHUNK;
+    size_t count = 0;
+    char* text = malloc(capacity + 1);
+    size_t n;
+    while ((n = fread(text + count, 1, capacity - count, f)) > 0) {
+        count += n;
+        if (count == capacity) {
+            capacity *= 2;
+            text = realloc(text, capacity + 1);
+        }
+    }
+    text[count] = '\0';
+    *size = count;
+    return text;
+}
+
+#ifndef _WIN32
+// Maps a regular file followed by at least one zero byte, which the lexer
+// stops at. The mapping is placed over an anonymous reservation one byte
+// longer than the file, so the zero comes from the reservation when the
+// size is an exact multiple of the page size. Returns 0 when fd cannot be
+// mapped.
+int map_source(int fd, Source* source) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) return 0;
+    size_t size = st.st_size;
+    char* base = mmap(NULL, size + 1, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return 0;
+    if (mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, size + 1);
+        return 0;
+    }
+    source->text = base;
+    source->size = size;
+    source->mapped = 1;
+    return 1;
+}
+#endif
+
+Source load_source(const char* path) {
+    Source source = {NULL, 0, 0};
+    if (strcmp(path, "-") == 0) {
+        // Redirected from a file, stdin maps like one; a pipe has to be read
+        // into memory in full, since tokens are offsets into one buffer
+#ifndef _WIN32
+        if (map_source(0, &source)) return source;
+#endif
+        source.text = read_all(stdin, &source.size);
+        return source;
+    }
+
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("INPUT ERROR: Cannot open '%s'\n", path);
+        exit(1);
+    }
+    int mapped = map_source(fd, &source);
+    close(fd);
+    if (mapped) return source;
+#endif
+
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        printf("INPUT ERROR: Cannot open '%s'\n", path);
+        exit(1);
+    }
+    source.text = read_all(f, &source.size);
+    fclose(f);
+    return source;
+}
+
+void release_source(Source* source) {
+#ifndef _WIN32
+    if (source->mapped) {
+        munmap((void*)source->text, source->size + 1);
+        source->text = NULL;
+        return;
+    }
+#endif
+    free((void*)source->text);
+    source->text = NULL;
+}
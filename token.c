@@ -3,147 +3,171 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
-Token tokens[MAX_TOKENS];
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Tokens point into the source instead of copying their lexemes, so the
+// buffer passed to tokenize() must outlive parsing
+Token* tokens = NULL;
 int token_count = 0;
+int token_capacity = 0;
+const char* token_source = NULL;
 int column = 0;
 int line = 0;
 
-void add_token(TokenType type, const char* lexeme, int value, char op, int line, int column) {
+Token make_token(TokenType type, int start, int length, char op, int line, int column) {
     Token t;
     t.type = type;
-    strncpy(t.lexeme, lexeme, sizeof(t.lexeme));
-    t.lexeme[sizeof(t.lexeme) - 1] = '\0';  // Ensure null-termination
-    t.value = value;
     t.op = op;
+    t.column = column > 0xFFFF ? 0xFFFF : column;
+    t.start = start;
+    t.length = length;
     t.line = line;
-    t.column = column;
+    return t;
+}
+
+void add_token(Token t) {
+    if (token_count == token_capacity) {
+        token_capacity = token_capacity ? token_capacity * 2 : 64;
+        tokens = realloc(tokens, sizeof(Token) * token_capacity);
+    }
     tokens[token_count++] = t;
 }
 
-int is_keyword(const char* word) {
-    if (strcmp(word, "var") == 0) return TOKEN_KEYWORD_VAR; // ✅ handle var keyword
-    if (strcmp(word, "if") == 0) return TOKEN_KEYWORD_IF;
-    if (strcmp(word, "else") == 0) return TOKEN_KEYWORD_ELSE;
-    if (strcmp(word, "while") == 0) return TOKEN_KEYWORD_WHILE;
-    if (strcmp(word, "func") == 0) return TOKEN_KEYWORD_FUNC;
-    if (strcmp(word, "return") == 0) return TOKEN_KEYWORD_RETURN;  // ✅ Add this line
+int is_keyword(const char* word, int length) {
+#define KEYWORD(text, type) if (length == sizeof(text) - 1 && memcmp(word, text, length) == 0) return type
+    KEYWORD("var", TOKEN_KEYWORD_VAR);
+    KEYWORD("if", TOKEN_KEYWORD_IF);
+    KEYWORD("else", TOKEN_KEYWORD_ELSE);
+    KEYWORD("while", TOKEN_KEYWORD_WHILE);
+    KEYWORD("func", TOKEN_KEYWORD_FUNC);
+    KEYWORD("return", TOKEN_KEYWORD_RETURN);
+#undef KEYWORD
     return 0;
 }
 
-void tokenize(const char* input) {
-    int i = 0;
-    int line = 1;
-    int column = 1;
-
-    while (input[i] != '\0') {
-        // Handle newlines
-        if (input[i] == '\n') {
-            line++;
-            column = 1;
-            i++;
-            continue;
-        }
+const char* token_text(Token t) {
+    return token_source + t.start;
+}
 
-        // Skip whitespace
-        if (isspace(input[i])) {
-            column++;
-            i++;
-            continue;
-        }
+// Identifiers are interned, so equal names share one copy
+const char* token_name(Token t) {
+    return intern_string(token_text(t), t.length)->chars;
+}
 
-        // Numbers
-        if (isdigit(input[i])) {
-            int start = i;
-            int start_col = column;
-            while (isdigit(input[i])) {
-                i++;
-                column++;
-            }
-            char num[32];
-            strncpy(num, input + start, i - start);
-            num[i - start] = '\0';
-            add_token(TOKEN_NUMBER, num, atoi(num), 0, line, start_col);
-            continue;
+// A literal has to fit an int Value; a negative one is this negated, so the
+// most negative int is only reachable through arithmetic
+int64_t token_number(Token t) {
+    int64_t value = 0;
+    for (uint32_t i = 0; i < t.length; i++) {
+        int digit = token_text(t)[i] - '0';
+        if (value > (INT_VALUE_MAX - digit) / 10) {
+            printf("PARSER: Number '%.*s' is too large at line %d, column %d\n",
+                   (int)t.length, token_text(t), t.line, t.column);
+            exit(1);
         }
+        value = value * 10 + digit;
+    }
+    return value;
+}
 
-        // Identifiers or keywords
-        if (isalpha(input[i])) {
-            int start = i;
-            int start_col = column;
-            while (isalnum(input[i])) {
-                i++;
-                column++;
-            }
-            char id[32];
-            strncpy(id, input + start, i - start);
-            id[i - start] = '\0';
-
-            int kw = is_keyword(id);
-            if (kw) {
-                add_token(kw, id, 0, 0, line, start_col);
-            } else {
-                add_token(TOKEN_IDENTIFIER, id, 0, 0, line, start_col);
-            }
-            continue;
-        }
+// String tokens cover the text between the quotes; escapes are decoded only
+// when the parser asks for the value, then the result is interned
+char* string_scratch = NULL;
+uint32_t string_scratch_size = 0;
 
-        // Two-character operators
-        if (input[i] == '>' && input[i + 1] == '=') {
-            add_token(TOKEN_GTE, ">=", 0, 0, line, column);
-            i += 2;
-            column += 2;
-            continue;
-        }
-        if (input[i] == '<' && input[i + 1] == '=') {
-            add_token(TOKEN_LTE, "<=", 0, 0, line, column);
-            i += 2;
-            column += 2;
+const char* token_string(Token t) {
+    if (t.length + 1 > string_scratch_size) {
+        string_scratch_size = t.length + 1;
+        string_scratch = realloc(string_scratch, string_scratch_size);
+    }
+    const char* s = token_text(t);
+    int j = 0;
+    for (uint32_t i = 0; i < t.length; i++) {
+        if (s[i] != '\\') {
+            string_scratch[j++] = s[i];
             continue;
         }
-        if (input[i] == '=' && input[i + 1] == '=') {
-            add_token(TOKEN_EQ, "==", 0, 0, line, column);
-            i += 2;
-            column += 2;
-            continue;
+        switch (s[++i]) {
+            case 'n': string_scratch[j++] = '\n'; break;
+            case 't': string_scratch[j++] = '\t'; break;
+            default: string_scratch[j++] = s[i]; break;   // \\, \", \' and unknown escapes
         }
-        if (input[i] == '!' && input[i + 1] == '=') {
-            add_token(TOKEN_NEQ, "!=", 0, 0, line, column);
-            i += 2;
-            column += 2;
-            continue;
+    }
+    return intern_string(string_scratch, j)->chars;
+}
+
+// Reference scanner: plain ctype calls and keyword compares. scan_token()
+// below must produce exactly the same tokens; bench_suite --lexer checks.
+Token scan_token_reference(Lexer* lx) {
+    const char* input = lx->input;
+    int i = lx->pos;
+    int line = lx->line;
+    int column = lx->column;
+    Token t;
+
+    while (input[i] != '\0' && isspace(input[i])) {
+        // Handle newlines
+        if (input[i] == '\n') {
+            line++;
+            column = 1;
+        } else {
+            column++;
         }
+        i++;
+    }
 
-        // Single-character comparison operators
-        if (input[i] == '>') {
-            add_token(TOKEN_GT, ">", 0, 0, line, column);
+    if (input[i] == '\0') {
+        t = make_token(TOKEN_EOF, i, 0, 0, line, column);
+    } else if (isdigit(input[i])) {
+        // Numbers
+        int start = i;
+        int start_col = column;
+        while (isdigit(input[i])) {
             i++;
             column++;
-            continue;
         }
-        if (input[i] == '<') {
-            add_token(TOKEN_LT, "<", 0, 0, line, column);
+        t = make_token(TOKEN_NUMBER, start, i - start, 0, line, start_col);
+    } else if (isalpha(input[i])) {
+        // Identifiers or keywords
+        int start = i;
+        int start_col = column;
+        while (isalnum(input[i])) {
             i++;
             column++;
-            continue;
         }
 
+        int kw = is_keyword(input + start, i - start);
+        t = make_token(kw ? kw : TOKEN_IDENTIFIER, start, i - start, 0, line, start_col);
+    } else if (input[i + 1] == '=' && (input[i] == '>' || input[i] == '<' || input[i] == '=' || input[i] == '!')) {
+        // Two-character operators
+        switch (input[i]) {
+            case '>': t = make_token(TOKEN_GTE, i, 2, 'G', line, column); break;
+            case '<': t = make_token(TOKEN_LTE, i, 2, 'L', line, column); break;
+            case '=': t = make_token(TOKEN_EQ, i, 2, '=', line, column); break;
+            default: t = make_token(TOKEN_NEQ, i, 2, '!', line, column); break;
+        }
+        i += 2;
+        column += 2;
+    } else {
         // Single-character tokens
         char ch = input[i];
         switch (ch) {
+            case '>': t = make_token(TOKEN_GT, i, 1, '>', line, column); break;
+            case '<': t = make_token(TOKEN_LT, i, 1, '<', line, column); break;
             case '+': case '-': case '*': case '/':
-                add_token(TOKEN_OPERATOR, (char[]){ch, '\0'}, 0, ch, line, column);
-                i++; column++;
-                break;
-            case '=':
-                add_token(TOKEN_ASSIGN, "=", 0, '=', line, column);
-                i++; column++;
+                t = make_token(TOKEN_OPERATOR, i, 1, ch, line, column);
                 break;
-            case '(': add_token(TOKEN_PAREN_OPEN, "(", 0, 0, line, column); i++; column++; break;
-            case ')': add_token(TOKEN_PAREN_CLOSE, ")", 0, 0, line, column); i++; column++; break;
-            case '{': add_token(TOKEN_BRACE_OPEN, "{", 0, 0, line, column); i++; column++; break;
-            case '}': add_token(TOKEN_BRACE_CLOSE, "}", 0, 0, line, column); i++; column++; break;
-            case ';': add_token(TOKEN_SEMICOLON, ";", 0, 0, line, column); i++; column++; break;
-            case ',': add_token(TOKEN_COMMA, ",", 0, 0, line, column); i++; column++; break;
+            case '=': t = make_token(TOKEN_ASSIGN, i, 1, '=', line, column); break;
+            case '(': t = make_token(TOKEN_PAREN_OPEN, i, 1, 0, line, column); break;
+            case ')': t = make_token(TOKEN_PAREN_CLOSE, i, 1, 0, line, column); break;
+            case '{': t = make_token(TOKEN_BRACE_OPEN, i, 1, 0, line, column); break;
+            case '}': t = make_token(TOKEN_BRACE_CLOSE, i, 1, 0, line, column); break;
+            case ';': t = make_token(TOKEN_SEMICOLON, i, 1, 0, line, column); break;
+            case ',': t = make_token(TOKEN_COMMA, i, 1, 0, line, column); break;
+            case '[': t = make_token(TOKEN_BRACKET_OPEN, i, 1, 0, line, column); break;
+            case ']': t = make_token(TOKEN_BRACKET_CLOSE, i, 1, 0, line, column); break;
             case '!':
                 printf("TOKENIZER: Unexpected character '!' at line %d, column %d\n", line, column);
                 exit(1);
@@ -151,22 +175,11 @@ void tokenize(const char* input) {
             {
                 char quote = input[i++];
                 int start_col = column++;
-                char str[256];
-                int j = 0;
+                int start = i;
 
                 while (input[i] != '\0' && input[i] != quote) {
-                    if (input[i] == '\\') {
+                    if (input[i] == '\\' && input[i + 1] != '\0') {
                         i++; column++;
-                        switch (input[i]) {
-                            case 'n': str[j++] = '\n'; break;
-                            case 't': str[j++] = '\t'; break;
-                            case '\\': str[j++] = '\\'; break;
-                            case '"': str[j++] = '"'; break;
-                            case '\'': str[j++] = '\''; break;
-                            default: str[j++] = input[i]; break;
-                        }
-                    } else {
-                        str[j++] = input[i];
                     }
                     i++; column++;
                 }
@@ -176,18 +189,301 @@ void tokenize(const char* input) {
                     exit(1);
                 }
 
-                i++; column++;  // Skip closing quote
-                str[j] = '\0';
-                add_token(TOKEN_STRING, str, 0, 0, line, start_col);
-                break;  // ✅ This break is essential
+                // The closing quote is skipped with the other single characters below
+                t = make_token(TOKEN_STRING, start, i - start, 0, line, start_col);
+                break;
             }
             default:
                 printf("TOKENIZER: Unknown character '%c' at line %d, column %d\n", ch, line, column);
                 exit(1);
         }
+        i++;
+        column++;
+    }
+
+    lx->pos = i;
+    lx->line = line;
+    lx->column = column;
+    return t;
+}
+
+// Table-driven scanner
+
+#define CHAR_SPACE   1   // isspace() in the C locale
+#define CHAR_DIGIT   2
+#define CHAR_ALPHA   4   // starts an identifier
+#define CHAR_ALNUM   8   // continues one
+
+typedef struct {
+    uint8_t present;
+    uint8_t type;
+    char op;
+} TokenKind;
+
+uint8_t char_class[256];
+TokenKind single_tokens[256];   // tokens that are one character
+TokenKind pair_tokens[256];     // tokens that are this character followed by '='
+int char_tables_ready = 0;
+
+void init_char_tables() {
+    for (int c = 0; c < 256; c++) {
+        char_class[c] = 0;
+        if (c == ' ' || (c >= '\t' && c <= '\r')) char_class[c] |= CHAR_SPACE;
+        if (c >= '0' && c <= '9') char_class[c] |= CHAR_DIGIT | CHAR_ALNUM;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) char_class[c] |= CHAR_ALPHA | CHAR_ALNUM;
+    }
+#define SINGLE(c, t, o) single_tokens[(unsigned char)(c)] = (TokenKind){1, t, o}
+    SINGLE('>', TOKEN_GT, '>');
+    SINGLE('<', TOKEN_LT, '<');
+    SINGLE('+', TOKEN_OPERATOR, '+');
+    SINGLE('-', TOKEN_OPERATOR, '-');
+    SINGLE('*', TOKEN_OPERATOR, '*');
+    SINGLE('/', TOKEN_OPERATOR, '/');
+    SINGLE('=', TOKEN_ASSIGN, '=');
+    SINGLE('(', TOKEN_PAREN_OPEN, 0);
+    SINGLE(')', TOKEN_PAREN_CLOSE, 0);
+    SINGLE('{', TOKEN_BRACE_OPEN, 0);
+    SINGLE('}', TOKEN_BRACE_CLOSE, 0);
+    SINGLE(';', TOKEN_SEMICOLON, 0);
+    SINGLE(',', TOKEN_COMMA, 0);
+    SINGLE('[', TOKEN_BRACKET_OPEN, 0);
+    SINGLE(']', TOKEN_BRACKET_CLOSE, 0);
+#undef SINGLE
+    pair_tokens['>'] = (TokenKind){1, TOKEN_GTE, 'G'};
+    pair_tokens['<'] = (TokenKind){1, TOKEN_LTE, 'L'};
+    pair_tokens['='] = (TokenKind){1, TOKEN_EQ, '='};
+    pair_tokens['!'] = (TokenKind){1, TOKEN_NEQ, '!'};
+    char_tables_ready = 1;
+}
+
+// Perfect hash over the six keywords: (length + first + 2 * last) & 7 is
+// distinct for each, so one compare confirms or rejects a candidate
+typedef struct {
+    const char* text;
+    int length;
+    int type;
+} Keyword;
+
+Keyword keyword_table[8] = {
+    [0] = {"func", 4, TOKEN_KEYWORD_FUNC},
+    [3] = {"else", 4, TOKEN_KEYWORD_ELSE},
+    [4] = {"return", 6, TOKEN_KEYWORD_RETURN},
+    [5] = {"var", 3, TOKEN_KEYWORD_VAR},
+    [6] = {"while", 5, TOKEN_KEYWORD_WHILE},
+    [7] = {"if", 2, TOKEN_KEYWORD_IF},
+};
+
+int keyword_lookup(const char* word, int length) {
+    unsigned char first = word[0], last = word[length - 1];
+    Keyword* k = &keyword_table[(length + first + 2 * last) & 7];
+    if (k->length == length && memcmp(k->text, word, length) == 0) return k->type;
+    return 0;
+}
+
+// Length of the run of spaces / identifier characters at s, reading at most
+// n bytes. The vector loops only run while a full vector fits before the end
+// of the input, so they never read past it.
+#if defined(__SSE2__)
+__m128i in_range_16(__m128i v, char lo, char hi) {
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(hi - lo)), t);
+}
+#endif
+#if defined(__AVX2__)
+__m256i in_range_32(__m256i v, char lo, char hi) {
+    __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(hi - lo)), t);
+}
+#endif
+
+int space_run(const char* s, int n) {
+    int i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+        if (mask != 0xFFFFFFFFu) return i + __builtin_ctz(~mask);
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+        if (mask != 0xFFFF) return i + __builtin_ctz(~mask);
+    }
+#endif
+    while (i < n && s[i] == ' ') i++;
+    return i;
+}
+
+int ident_run(const char* s, int n) {
+    int i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i alnum = _mm256_or_si256(in_range_32(v, '0', '9'),
+                                        in_range_32(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z'));
+        uint32_t mask = _mm256_movemask_epi8(alnum);
+        if (mask != 0xFFFFFFFFu) return i + __builtin_ctz(~mask);
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i alnum = _mm_or_si128(in_range_16(v, '0', '9'),
+                                     in_range_16(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z'));
+        uint32_t mask = _mm_movemask_epi8(alnum);
+        if (mask != 0xFFFF) return i + __builtin_ctz(~mask);
+    }
+#endif
+    while (i < n && (char_class[(unsigned char)s[i]] & CHAR_ALNUM)) i++;
+    return i;
+}
+
+// Scans the token at lx->pos, skipping whitespace before it
+Token scan_token(Lexer* lx) {
+    const char* input = lx->input;
+    int i = lx->pos;
+    int line = lx->line;
+    int column = lx->column;
+    Token t;
+
+    while (char_class[(unsigned char)input[i]] & CHAR_SPACE) {
+        if (input[i] == '\n') {
+            line++;
+            column = 1;
+            i++;
+        } else if (input[i] == ' ' && input[i + 1] == ' ') {
+            // Indentation: worth a vector scan
+            int run = space_run(input + i, lx->length - i);
+            i += run;
+            column += run;
+        } else {
+            i++;
+            column++;
+        }
+    }
+
+    unsigned char ch = input[i];
+    uint8_t cls = char_class[ch];
+    if (ch == '\0') {
+        t = make_token(TOKEN_EOF, i, 0, 0, line, column);
+    } else if (cls & CHAR_DIGIT) {
+        int start = i++;
+        while (char_class[(unsigned char)input[i]] & CHAR_DIGIT) i++;
+        t = make_token(TOKEN_NUMBER, start, i - start, 0, line, column);
+        column += i - start;
+    } else if (cls & CHAR_ALPHA) {
+        int start = i++;
+        // Most names are short; only long ones reach the vector scan
+        while (i - start < 8 && (char_class[(unsigned char)input[i]] & CHAR_ALNUM)) i++;
+        if (i - start == 8) i += ident_run(input + i, lx->length - i);
+        int kw = i - start <= 6 ? keyword_lookup(input + start, i - start) : 0;
+        t = make_token(kw ? kw : TOKEN_IDENTIFIER, start, i - start, 0, line, column);
+        column += i - start;
+    } else if (input[i + 1] == '=' && pair_tokens[ch].present) {
+        t = make_token(pair_tokens[ch].type, i, 2, pair_tokens[ch].op, line, column);
+        i += 2;
+        column += 2;
+    } else if (single_tokens[ch].present) {
+        t = make_token(single_tokens[ch].type, i, 1, single_tokens[ch].op, line, column);
+        i++;
+        column++;
+    } else if (ch == '"' || ch == '\'') {
+        int start_col = column++;
+        int start = ++i;
+        while (input[i] != '\0' && input[i] != (char)ch) {
+            if (input[i] == '\\' && input[i + 1] != '\0') {
+                i++; column++;
+            }
+            i++; column++;
+        }
+        if (input[i] != (char)ch) {
+            printf("TOKENIZER: Unterminated string literal at line %d, column %d\n", line, start_col);
+            exit(1);
+        }
+        t = make_token(TOKEN_STRING, start, i - start, 0, line, start_col);
+        i++;
+        column++;
+    } else if (ch == '!') {
+        printf("TOKENIZER: Unexpected character '!' at line %d, column %d\n", line, column);
+        exit(1);
+    } else {
+        printf("TOKENIZER: Unknown character '%c' at line %d, column %d\n", ch, line, column);
+        exit(1);
+    }
+
+    lx->pos = i;
+    lx->line = line;
+    lx->column = column;
+    return t;
+}
+
+void init_lexer(Lexer* lx, const char* input) {
+    if (!char_tables_ready) init_char_tables();
+    lx->input = input;
+    lx->length = strlen(input);
+    lx->pos = 0;
+    lx->line = 1;
+    lx->column = 1;
+}
+
+// Materializes every token up front
+void tokenize(const char* input) {
+    token_source = input;
+    token_stream = 0;
+    token_count = 0;
+    Lexer lx;
+    init_lexer(&lx, input);
+
+    // Roughly one token per four bytes of source; add_token() grows it if not
+    int wanted = lx.length / 4 + 16;
+    if (wanted > token_capacity) {
+        token_capacity = wanted;
+        tokens = realloc(tokens, sizeof(Token) * token_capacity);
     }
 
-    add_token(TOKEN_EOF, "", 0, 0, line, column);
+    Token t;
+    do {
+        t = scan_token(&lx);
+        add_token(t);
+    } while (t.type != TOKEN_EOF);
+}
+
+// Pull-based alternative to tokenize(): token_at() scans tokens as the
+// parser asks for them and keeps only the last few in a ring
+#define TOKEN_RING_SIZE 8   // the parser looks back one token and ahead two
+
+int token_stream = 0;
+Lexer stream_lexer;
+Token token_ring[TOKEN_RING_SIZE];
+int streamed_count = 0;
+
+void begin_token_stream(const char* input) {
+    token_source = input;
+    token_stream = 1;
+    streamed_count = 0;
+    init_lexer(&stream_lexer, input);
+}
+
+Token token_at(int index) {
+    if (!token_stream) return tokens[index < token_count ? index : token_count - 1];
+    while (streamed_count <= index) {
+        token_ring[streamed_count % TOKEN_RING_SIZE] = scan_token(&stream_lexer);
+        streamed_count++;
+    }
+    if (index <= streamed_count - TOKEN_RING_SIZE) {
+        printf("PARSER: Token %d is no longer buffered (ring holds %d)\n", index, TOKEN_RING_SIZE);
+        exit(1);
+    }
+    return token_ring[index % TOKEN_RING_SIZE];
+}
+
+// Tokens left from index on, estimated from the unscanned bytes when
+// streaming; the parser sizes its lists from it
+int tokens_remaining(int index) {
+    if (!token_stream) return token_count - index;
+    return (int)((stream_lexer.length - stream_lexer.pos) / 4) + streamed_count - index;
 }
 
 /*
@@ -197,7 +493,7 @@ int main() {
 
     for (int i = 0; i < token_count; i++) {
         Token t = tokens[i];
-        printf("Type: %d, Lexeme: '%s'\n", t.type, t.lexeme);
+        printf("Type: %d, Lexeme: '%.*s'\n", t.type, (int)t.length, token_text(t));
     }
 
     return 0;
@@ -0,0 +1,191 @@
+#include "definitions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Intern table: every String the VM sees is unique by content, so string
+// equality is a pointer (and therefore a Value) comparison.
+String** intern_table = NULL;
+int intern_count = 0;
+int intern_capacity = 0;
+
+uint32_t hash_chars(const char* chars, int length) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        h = (h ^ (unsigned char)chars[i]) * 16777619u;
+    }
+    return h;
+}
+
+void grow_intern_table() {
+    int capacity = intern_capacity ? intern_capacity * 2 : 256;
+    String** table = calloc(capacity, sizeof(String*));
+    for (int i = 0; i < intern_capacity; i++) {
+        String* s = intern_table[i];
+        if (!s) continue;
+        int b = s->hash & (capacity - 1);
+        while (table[b]) b = (b + 1) & (capacity - 1);
+        table[b] = s;
+    }
+    free(intern_table);
+    intern_table = table;
+    intern_capacity = capacity;
+}
+
+String* intern_string(const char* chars, int length) {
+    if ((intern_count + 1) * 2 > intern_capacity) grow_intern_table();
+
+    uint32_t hash = hash_chars(chars, length);
+    int b = hash & (intern_capacity - 1);
+    while (intern_table[b]) {
+        String* s = intern_table[b];
+        if (s->hash == hash && (int)s->length == length && memcmp(s->chars, chars, length) == 0) {
+            return s;
+        }
+        b = (b + 1) & (intern_capacity - 1);
+    }
+
+    String* s = malloc(sizeof(String) + length + 1);
+    s->length = length;
+    s->hash = hash;
+    memcpy(s->chars, chars, length);
+    s->chars[length] = '\0';
+    intern_table[b] = s;
+    intern_count++;
+    return s;
+}
+
+// Contents of a string value, flattening (and interning) it if it is a rope.
+// Walks the tree with an explicit stack, since a string built in a loop is a
+// rope as deep as the loop ran; the buffer is filled from the end, so the
+// usual left-leaning tree never needs more than a couple of stack entries.
+String* flatten(Value v) {
+    if (!is_rope(v)) return as_string(v);
+    Rope* rope = as_rope(v);
+    if (rope->flat) return rope->flat;
+
+    char* text = malloc(rope->length);
+    uint32_t end = rope->length;
+    int capacity = 64;
+    int depth = 0;
+    Value* pending = malloc(sizeof(Value) * capacity);
+    pending[depth++] = v;
+    while (depth > 0) {
+        Value part = pending[--depth];
+        if (is_rope(part) && !as_rope(part)->flat) {
+            if (depth + 2 > capacity) {
+                capacity *= 2;
+                pending = realloc(pending, sizeof(Value) * capacity);
+            }
+            pending[depth++] = as_rope(part)->left;
+            pending[depth++] = as_rope(part)->right;
+            continue;
+        }
+        String* s = is_rope(part) ? as_rope(part)->flat : as_string(part);
+        end -= s->length;
+        memcpy(text + end, s->chars, s->length);
+    }
+    free(pending);
+
+    rope->flat = intern_string(text, rope->length);
+    free(text);
+    return rope->flat;
+}
+
+uint32_t text_length(Value v) {
+    return is_rope(v) ? as_rope(v)->length : as_string(v)->length;
+}
+
+// a + b for two strings. Short results are copied into an interned String
+// straight away; longer ones become a rope node and are copied only once,
+// when they are flattened.
+Value concat_strings(Value a, Value b) {
+    uint64_t length = (uint64_t)text_length(a) + text_length(b);
+    if (length > INT32_MAX) {
+        flush_output();
+        printf("VM ERROR: String too long\n");
+        exit(1);
+    }
+    if (length <= SHORT_STRING_LENGTH) {
+        char text[SHORT_STRING_LENGTH];
+        String* left = flatten(a);
+        String* right = flatten(b);
+        memcpy(text, left->chars, left->length);
+        memcpy(text + left->length, right->chars, right->length);
+        return make_string(intern_string(text, length));
+    }
+    Rope* rope = malloc(sizeof(Rope));
+    rope->length = length;
+    rope->left = a;
+    rope->right = b;
+    rope->flat = NULL;
+    return (Value)(uintptr_t)rope + ROPE_TAG;
+}
+
+// Equality once either side may be a rope; both sides are flattened, after
+// which interning makes it a pointer comparison again
+int strings_equal(Value a, Value b) {
+    if (!is_text(a) || !is_text(b) || text_length(a) != text_length(b)) return 0;
+    return flatten(a) == flatten(b);
+}
+
+// Writes v to the script output buffer (output.c)
+void print_value(Value v) {
+    if (is_int(v)) {
+        output_int(as_int(v));
+    } else if (is_rope(v)) {
+        String* s = flatten(v);
+        output_bytes(s->chars, s->length);
+    } else if (is_string(v)) {
+        output_bytes(as_string(v)->chars, as_string(v)->length);
+    } else if (is_array(v)) {
+        print_array(as_array(v));
+    } else if (v == VAL_TRUE) {
+        output_bytes("true", 4);
+    } else if (v == VAL_FALSE) {
+        output_bytes("false", 5);
+    } else {
+        output_bytes("nil", 3);
+    }
+}
+
+const char* value_type_name(Value v) {
+    if (is_int(v)) return "int";
+    if (is_text(v)) return "string";
+    if (is_array(v)) return "array";
+    if (v == VAL_TRUE || v == VAL_FALSE) return "bool";
+    return "nil";
+}
+
+void unknown_builtin(const char* name) {
+    flush_output();
+    printf("VM ERROR: Unknown built-in function '%s'\n", name);
+    exit(1);
+}
+
+// Slow paths for operands that are not both ints. The engines handle the
+// int/int case inline and only call these when a tag check fails.
+Value binary_slow(Opcode op, Value a, Value b) {
+    if (op == OP_ADD && is_text(a) && is_text(b)) return concat_strings(a, b);
+    const char* verbs[] = {[OP_ADD] = "add", [OP_SUB] = "subtract", [OP_MUL] = "multiply", [OP_DIV] = "divide"};
+    flush_output();
+    printf("VM ERROR: Cannot %s %s and %s\n", verbs[op], value_type_name(a), value_type_name(b));
+    exit(1);
+}
+
+Value divide(Value a, Value b) {
+    if (!both_ints(a, b)) return binary_slow(OP_DIV, a, b);
+    if (as_int(b) == 0) {
+        flush_output();
+        printf("VM ERROR: Division by zero\n");
+        exit(1);
+    }
+    return make_int(as_int(a) / as_int(b));
+}
+
+// Ordered comparisons are only defined on ints
+void compare_slow(Value a, Value b) {
+    flush_output();
+    printf("VM ERROR: Cannot compare %s and %s\n", value_type_name(a), value_type_name(b));
+    exit(1);
+}
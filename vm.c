@@ -3,230 +3,597 @@
 #include <stdlib.h>
 #include "definitions.h"
 
-#define STACK_SIZE 1024
-#define MAX_VARS 256
-
-int stack[STACK_SIZE];
+Value stack[STACK_SIZE];
 int sp = -1;
 
-Variable vars[MAX_VARS];
-int var_count = 0;
+// Flat variable storage indexed by the slots resolve_symbols() assigned
+Value slots[MAX_VARS];
 
-#define MAX_FUNCS 64
+// A call frame remembers where to resume and the caller's frame base.
+// The callee's locals live on the value stack starting at its own base:
+// arguments are already there, the remaining locals are pushed as nil.
 
 typedef struct {
-    char name[32];
-    int address; // instruction index of function entry
-} FunctionLabel;
+    int return_ip;   // byte offset (switch engine) or op index (threaded engine)
+    int base;        // caller's frame base
+} Frame;
 
-FunctionLabel func_table[MAX_FUNCS];
-int func_count = 0;
+Frame frames[CALL_STACK_SIZE];
+int frame_count = 0;
 
-int get_func_address(const char* name) {
-    for (int i = 0; i < func_count; i++) {
-        if (strcmp(func_table[i].name, name) == 0) {
-            return func_table[i].address;
-        }
+void push(Value value) {
+    if (sp >= STACK_SIZE - 1) {
+        flush_output();
+        printf("VM ERROR: Stack overflow\n");
+        exit(1);
     }
-    printf("VM ERROR: Unknown function '%s'\n", name);
-    exit(1);
+    stack[++sp] = value;
 }
 
-#define CALL_STACK_SIZE 256
-int call_stack[CALL_STACK_SIZE];
-int call_sp = -1;
-
-void push_call(int addr) {
-    if (call_sp >= CALL_STACK_SIZE - 1) {
-        printf("VM ERROR: Call stack overflow\n");
+Value pop() {
+    if (sp < 0) {
+        flush_output();
+        printf("VM ERROR: Stack underflow\n");
         exit(1);
     }
-    call_stack[++call_sp] = addr;
+    return stack[sp--];
 }
 
-int pop_call() {
-    if (call_sp < 0) {
-        printf("VM ERROR: Call stack underflow\n");
+// Enters f with its arguments on top of the stack; returns the new frame base
+int enter_frame(Function* f, int return_ip, int base) {
+    if (frame_count >= CALL_STACK_SIZE) {
+        flush_output();
+        printf("VM ERROR: Call stack overflow in '%s'\n", f->name);
         exit(1);
     }
-    return call_stack[call_sp--];
+    frames[frame_count].return_ip = return_ip;
+    frames[frame_count].base = base;
+    frame_count++;
+    int new_base = sp - f->param_count + 1;
+    for (int i = f->param_count; i < f->local_count; i++) push(VAL_NIL);
+    return new_base;
 }
 
-int get_var_index(const char* name) {
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(vars[i].name, name) == 0) return i;
+// Drops the callee's locals, leaves its result on the stack and returns
+// where the caller resumes
+int leave_frame(int* base) {
+    if (frame_count <= 0) {
+        flush_output();
+        printf("VM ERROR: Call stack underflow\n");
+        exit(1);
     }
-    return -1;
+    Value result = pop();
+    Frame frame = frames[--frame_count];
+    sp = *base - 1;
+    push(result);
+    *base = frame.base;
+    return frame.return_ip;
 }
 
-void set_var(const char* name, int value) {
-    int idx = get_var_index(name);
-    if (idx >= 0) {
-        vars[idx].value = value;
-    } else {
-        strcpy(vars[var_count].name, name);
-        vars[var_count].value = value;
-        var_count++;
-    }
+// Arguments are the top arg_count stack entries; they are replaced by the result
+void call_builtin(int index, int arg_count) {
+    Value result = builtins[index].call(&stack[sp - arg_count + 1], arg_count);
+    sp -= arg_count;
+    push(result);
 }
 
-int get_var(const char* name) {
-    int idx = get_var_index(name);
-    if (idx >= 0) return vars[idx].value;
-    printf("VM ERROR: Undefined variable '%s'\n", name);
-    exit(1);
+// Replaces the top count values with an array holding them
+void build_array(int count) {
+    Value array = array_literal(&stack[sp - count + 1], count);
+    sp -= count;
+    push(array);
 }
 
-void push(int value) {
-    if (sp >= STACK_SIZE - 1) {
-        printf("VM ERROR: Stack overflow\n");
-        exit(1);
-    }
-    stack[++sp] = value;
-}
+#ifdef PENGUIN_COUNT_OPS
+unsigned long long vm_op_count = 0;
+#endif
 
-int pop() {
-    if (sp < 0) {
-        printf("VM ERROR: Stack underflow\n");
-        exit(1);
-    }
-    return stack[sp--];
+void reset_vm() {
+    sp = -1;
+    frame_count = 0;
+    for (int i = 0; i < MAX_VARS; i++) slots[i] = VAL_NIL;
 }
 
-void call_builtin(const char* name, int arg_count) {
-    if (strcmp(name, "print") == 0) {
-        for (int i = arg_count - 1; i >= 0; i--) {
-            int val = pop();
-            printf("%d", val);
-            if (i > 0) printf(" ");
-        }
-        printf("\n");
-    } else {
-        printf("VM ERROR: Unknown built-in function '%s'\n", name);
-        exit(1);
-    }
-}
+// A taken jump to an earlier offset closes a loop; with the JIT on it may
+// run natively from there. next is the offset just past the jump.
+#ifdef PENGUIN_JIT
+#define JUMP_TO(target, next) ((use_jit && (target) < (next)) ? jit_loop((target), (next), base) : (target))
+#else
+#define JUMP_TO(target, next) (target)
+#endif
 
-void run_vm(Instruction* code, int count) {
+// Portable engine: decodes the bytecode as it goes
+void run_vm_switch(Chunk* chunk) {
+    const uint8_t* code = chunk->code;
+    Constant* constants = chunk->constants.items;
+    int count = chunk->count;
     int ip = 0;
+    int base = 0;   // frame base of the running function
     while (ip < count) {
-        Instruction instr = code[ip++];
-        switch (instr.opcode) {
+        PROFILE_OP(ip);
+        Opcode op = code[ip++];
+        COUNT_OP();
+        switch (op) {
             case OP_LOAD_CONST:
-                push(instr.int_value);
+                push(constants[read_u16(code + ip)].value);
+                ip += 2;
                 break;
             case OP_PUSH:
-                push(instr.int_value);
+                push(VAL_NIL);
                 break;
             case OP_POP:
                 pop();
                 break;
-            case OP_LOAD_VAR:
-                push(get_var(instr.str_value));
+            case OP_LOAD_SLOT:
+                push(slots[read_u16(code + ip)]);
+                ip += 2;
                 break;
-            case OP_STORE_VAR: {
-                int val = pop();
-                set_var(instr.str_value, val);
+            case OP_STORE_SLOT:
+                slots[read_u16(code + ip)] = pop();
+                ip += 2;
                 break;
-            }
             case OP_ADD: {
-                int b = pop();
-                int a = pop();
-                push(a + b);
+                Value b = pop();
+                Value a = pop();
+                push(VALUE_ADD(a, b));
                 break;
             }
             case OP_SUB: {
-                int b = pop();
-                int a = pop();
-                push(a - b);
+                Value b = pop();
+                Value a = pop();
+                push(VALUE_SUB(a, b));
                 break;
             }
             case OP_MUL: {
-                int b = pop();
-                int a = pop();
-                push(a * b);
+                Value b = pop();
+                Value a = pop();
+                push(VALUE_MUL(a, b));
                 break;
             }
             case OP_DIV: {
-                int b = pop();
-                int a = pop();
-                if (b == 0) {
-                    printf("VM ERROR: Division by zero\n");
-                    exit(1);
-                }
-                push(a / b);
+                Value b = pop();
+                Value a = pop();
+                push(divide(a, b));
                 break;
             }
             case OP_EQ: {
-                int b = pop();
-                int a = pop();
-                push(a == b);
+                Value b = pop();
+                Value a = pop();
+                push(make_bool(VALUE_EQ(a, b)));
                 break;
             }
             case OP_NEQ: {
-                int b = pop();
-                int a = pop();
-                push(a != b);
+                Value b = pop();
+                Value a = pop();
+                push(make_bool(!VALUE_EQ(a, b)));
                 break;
             }
             case OP_GT: {
-                int b = pop();
-                int a = pop();
-                push(a > b);
+                Value b = pop();
+                Value a = pop();
+                push(make_bool(VALUE_CMP(a, >, b)));
                 break;
             }
             case OP_LT: {
-                int b = pop();
-                int a = pop();
-                push(a < b);
+                Value b = pop();
+                Value a = pop();
+                push(make_bool(VALUE_CMP(a, <, b)));
                 break;
             }
             case OP_GTE: {
-                int b = pop();
-                int a = pop();
-                push(a >= b);
+                Value b = pop();
+                Value a = pop();
+                push(make_bool(VALUE_CMP(a, >=, b)));
                 break;
             }
             case OP_LTE: {
-                int b = pop();
-                int a = pop();
-                push(a <= b);
+                Value b = pop();
+                Value a = pop();
+                push(make_bool(VALUE_CMP(a, <=, b)));
                 break;
             }
             case OP_PRINT: {
-                int val = pop();
-                printf("%d\n", val);
+                print_value(pop());
+                output_char('\n');
                 break;
             }
-            case OP_JMP:
-                ip = instr.int_value;
+            case OP_ADD_SLOT_CONST:
+            case OP_SUB_SLOT_CONST:
+            case OP_ADD_LOCAL_CONST:
+            case OP_SUB_LOCAL_CONST: {
+                int local = op == OP_ADD_LOCAL_CONST || op == OP_SUB_LOCAL_CONST;
+                Value* var = local ? &stack[base + read_u16(code + ip)] : &slots[read_u16(code + ip)];
+                Value k = constants[read_u16(code + ip + 2)].value;
+                *var = op == OP_ADD_SLOT_CONST || op == OP_ADD_LOCAL_CONST ? VALUE_ADD(*var, k) : VALUE_SUB(*var, k);
+                ip += 4;
                 break;
-            case OP_JMP_IF_FALSE: {
-                int cond = pop();
-                if (!cond) ip = instr.int_value;
+            }
+            case OP_LOAD_SLOT_ADD_CONST:
+                push(VALUE_ADD(slots[read_u16(code + ip)], constants[read_u16(code + ip + 2)].value));
+                ip += 4;
+                break;
+            case OP_LOAD_SLOT_SUB_CONST:
+                push(VALUE_SUB(slots[read_u16(code + ip)], constants[read_u16(code + ip + 2)].value));
+                ip += 4;
+                break;
+            case OP_LOAD_LOCAL_ADD_CONST:
+                push(VALUE_ADD(stack[base + read_u16(code + ip)], constants[read_u16(code + ip + 2)].value));
+                ip += 4;
+                break;
+            case OP_LOAD_LOCAL_SUB_CONST:
+                push(VALUE_SUB(stack[base + read_u16(code + ip)], constants[read_u16(code + ip + 2)].value));
+                ip += 4;
+                break;
+            case OP_LOAD_SLOT_CONST:
+                push(slots[read_u16(code + ip)]);
+                push(constants[read_u16(code + ip + 2)].value);
+                ip += 4;
+                break;
+            case OP_LOAD_LOCAL_CONST:
+                push(stack[base + read_u16(code + ip)]);
+                push(constants[read_u16(code + ip + 2)].value);
+                ip += 4;
+                break;
+            case OP_JMP_IF_NOT_EQ:
+            case OP_JMP_IF_NOT_NEQ:
+            case OP_JMP_IF_NOT_GT:
+            case OP_JMP_IF_NOT_LT:
+            case OP_JMP_IF_NOT_GTE:
+            case OP_JMP_IF_NOT_LTE: {
+                Value b = pop();
+                Value a = pop();
+                int cond;
+                switch (op) {
+                    case OP_JMP_IF_NOT_EQ: cond = VALUE_EQ(a, b); break;
+                    case OP_JMP_IF_NOT_NEQ: cond = !VALUE_EQ(a, b); break;
+                    case OP_JMP_IF_NOT_GT: cond = VALUE_CMP(a, >, b); break;
+                    case OP_JMP_IF_NOT_LT: cond = VALUE_CMP(a, <, b); break;
+                    case OP_JMP_IF_NOT_GTE: cond = VALUE_CMP(a, >=, b); break;
+                    default: cond = VALUE_CMP(a, <=, b); break;
+                }
+                ip = cond ? ip + 4 : JUMP_TO(read_u32(code + ip), ip + 4);
                 break;
             }
-            case OP_LABEL:
-                // No-op for now
+            case OP_JMP:
+                ip = JUMP_TO(read_u32(code + ip), ip + 4);
+                break;
+            case OP_JMP_IF_FALSE:
+                ip = is_falsey(pop()) ? JUMP_TO(read_u32(code + ip), ip + 4) : ip + 4;
+                break;
+            case OP_LOAD_LOCAL:
+                push(stack[base + read_u16(code + ip)]);
+                ip += 2;
+                break;
+            case OP_STORE_LOCAL:
+                stack[base + read_u16(code + ip)] = pop();
+                ip += 2;
                 break;
             case OP_CALL: {
-                if (strcmp(instr.str_value, "print") == 0) {
-                    int val = pop();
-                    printf("%d\n", val);
-                } else {
-                    int addr = get_func_address(instr.str_value);
-                    push_call(ip);
-                    ip = addr;
-                }
+                Function* f = &chunk->functions[read_u16(code + ip)];
+                base = enter_frame(f, ip + 2, base);
+                ip = f->entry;
                 break;
             }
-            case OP_RET: {
-                ip = pop_call();
+            case OP_CALL_BUILTIN:
+                call_builtin(read_u16(code + ip), read_u16(code + ip + 2));
+                ip += 4;
+                break;
+            case OP_CALL_NATIVE:
+                unknown_builtin(constants[read_u16(code + ip)].str_value);
+                break;
+            case OP_ARRAY:
+                build_array(read_u16(code + ip));
+                ip += 2;
+                break;
+            case OP_INDEX: {
+                Value index = pop();
+                push(index_array(pop(), index));
                 break;
             }
+            case OP_STORE_INDEX: {
+                Value value = pop();
+                Value index = pop();
+                store_index(pop(), index, value);
+                break;
+            }
+            case OP_RET:
+                ip = leave_frame(&base);
+                break;
+            case OP_HALT:
+                return;
             default:
-                printf("VM ERROR: Unknown opcode %d\n", instr.opcode);
+                flush_output();
+                printf("VM ERROR: Unknown opcode %d at %04d\n", op, ip - 1);
                 exit(1);
         }
     }
-}
\ No newline at end of file
+}
+
+#ifdef PENGUIN_THREADED
+typedef struct {
+    void* handler;   // label address of the opcode's implementation
+    int operand;     // decoded operand; jumps and calls hold the target op index
+    int operand2;    // OP_CALL: function index; OP_CALL_BUILTIN: argument count
+    Value constant;  // OP_LOAD_CONST and fused slot + constant ops: the constant
+} ThreadedOp;
+
+// Direct-threaded engine: the bytecode is pre-decoded into handler addresses
+// once, and each handler jumps straight to the next one (GCC labels-as-values)
+void run_vm_threaded(Chunk* chunk) {
+    static void* handlers[] = {
+        [OP_LOAD_CONST] = &&do_load_const,
+        [OP_LOAD_SLOT] = &&do_load_slot,
+        [OP_STORE_SLOT] = &&do_store_slot,
+        [OP_ADD] = &&do_add,
+        [OP_SUB] = &&do_sub,
+        [OP_MUL] = &&do_mul,
+        [OP_DIV] = &&do_div,
+        [OP_JMP] = &&do_jmp,
+        [OP_JMP_IF_FALSE] = &&do_jmp_if_false,
+        [OP_CALL] = &&do_call,
+        [OP_RET] = &&do_ret,
+        [OP_POP] = &&do_pop,
+        [OP_PUSH] = &&do_push,
+        [OP_EQ] = &&do_eq,
+        [OP_NEQ] = &&do_neq,
+        [OP_GT] = &&do_gt,
+        [OP_LT] = &&do_lt,
+        [OP_GTE] = &&do_gte,
+        [OP_LTE] = &&do_lte,
+        [OP_PRINT] = &&do_print,
+        [OP_ADD_SLOT_CONST] = &&do_add_slot_const,
+        [OP_SUB_SLOT_CONST] = &&do_sub_slot_const,
+        [OP_LOAD_SLOT_ADD_CONST] = &&do_load_slot_add_const,
+        [OP_LOAD_SLOT_SUB_CONST] = &&do_load_slot_sub_const,
+        [OP_LOAD_SLOT_CONST] = &&do_load_slot_const,
+        [OP_ADD_LOCAL_CONST] = &&do_add_local_const,
+        [OP_SUB_LOCAL_CONST] = &&do_sub_local_const,
+        [OP_LOAD_LOCAL_ADD_CONST] = &&do_load_local_add_const,
+        [OP_LOAD_LOCAL_SUB_CONST] = &&do_load_local_sub_const,
+        [OP_LOAD_LOCAL_CONST] = &&do_load_local_const,
+        [OP_JMP_IF_NOT_EQ] = &&do_jmp_if_not_eq,
+        [OP_JMP_IF_NOT_NEQ] = &&do_jmp_if_not_neq,
+        [OP_JMP_IF_NOT_GT] = &&do_jmp_if_not_gt,
+        [OP_JMP_IF_NOT_LT] = &&do_jmp_if_not_lt,
+        [OP_JMP_IF_NOT_GTE] = &&do_jmp_if_not_gte,
+        [OP_JMP_IF_NOT_LTE] = &&do_jmp_if_not_lte,
+        [OP_LOAD_LOCAL] = &&do_load_local,
+        [OP_STORE_LOCAL] = &&do_store_local,
+        [OP_CALL_NATIVE] = &&do_call_native,
+        [OP_CALL_BUILTIN] = &&do_call_builtin,
+        [OP_HALT] = &&do_halt,
+        [OP_ARRAY] = &&do_array,
+        [OP_INDEX] = &&do_index,
+        [OP_STORE_INDEX] = &&do_store_index,
+    };
+    int handler_count = sizeof(handlers) / sizeof(handlers[0]);
+    const uint8_t* code = chunk->code;
+    Constant* constants = chunk->constants.items;
+
+    // Byte offset -> op index, so jump targets and return addresses can be
+    // translated; the extra entry maps the end of the chunk to the halt op
+    int* op_at = malloc(sizeof(int) * (chunk->count + 1));
+    int* byte_at = malloc(sizeof(int) * (chunk->count + 1));
+    int op_count = 0;
+    for (int ip = 0; ip <= chunk->count; ip++) op_at[ip] = -1;
+    for (int ip = 0; ip < chunk->count; ip += 1 + operand_size(code[ip])) {
+        byte_at[op_count] = ip;
+        op_at[ip] = op_count++;
+    }
+    byte_at[op_count] = chunk->count;
+    op_at[chunk->count] = op_count;
+
+    // One extra op so falling off the end (or jumping to it) halts
+    ThreadedOp* ops = malloc(sizeof(ThreadedOp) * (op_count + 1));
+    for (int i = 0; i < op_count; i++) {
+        int ip = byte_at[i];
+        Opcode op = code[ip];
+        if ((int)op >= handler_count || !handlers[op]) {
+            flush_output();
+            printf("VM ERROR: Unknown opcode %d at %04d\n", op, ip);
+            exit(1);
+        }
+        ops[i].handler = handlers[op];
+        ops[i].operand = 0;
+        ops[i].operand2 = 0;
+        ops[i].constant = VAL_NIL;
+        if (is_jump(op)) {
+            int target = read_u32(code + ip + 1);
+            if (target < 0 || target > chunk->count || op_at[target] < 0) {
+                flush_output();
+                printf("VM ERROR: Jump at %04d into the middle of an instruction (%04d)\n", ip, target);
+                exit(1);
+            }
+            ops[i].operand = op_at[target];
+            continue;
+        }
+        switch (op) {
+            case OP_LOAD_CONST:
+                ops[i].constant = constants[read_u16(code + ip + 1)].value;
+                break;
+            case OP_ADD_SLOT_CONST:
+            case OP_SUB_SLOT_CONST:
+            case OP_LOAD_SLOT_ADD_CONST:
+            case OP_LOAD_SLOT_SUB_CONST:
+            case OP_LOAD_SLOT_CONST:
+            case OP_ADD_LOCAL_CONST:
+            case OP_SUB_LOCAL_CONST:
+            case OP_LOAD_LOCAL_ADD_CONST:
+            case OP_LOAD_LOCAL_SUB_CONST:
+            case OP_LOAD_LOCAL_CONST:
+                ops[i].operand = read_u16(code + ip + 1);
+                ops[i].constant = constants[read_u16(code + ip + 3)].value;
+                break;
+            case OP_CALL: {
+                int f = read_u16(code + ip + 1);
+                ops[i].operand = op_at[chunk->functions[f].entry];
+                ops[i].operand2 = f;
+                break;
+            }
+            case OP_CALL_NATIVE:
+                ops[i].operand = read_u16(code + ip + 1);
+                break;
+            case OP_CALL_BUILTIN:
+                ops[i].operand = read_u16(code + ip + 1);
+                ops[i].operand2 = read_u16(code + ip + 3);
+                break;
+            default:
+                if (operand_size(op) == 2) ops[i].operand = read_u16(code + ip + 1);
+                break;
+        }
+    }
+    ops[op_count].handler = &&do_halt;
+    ops[op_count].operand = 0;
+
+    ThreadedOp* pc = ops;
+    int base = 0;   // frame base of the running function
+#define NEXT() do { COUNT_OP(); PROFILE_OP(byte_at[pc - ops]); goto *(pc++)->handler; } while (0)
+#define OPERAND (pc[-1].operand)
+#define OPERAND2 (pc[-1].operand2)
+#define CONSTANT (pc[-1].constant)
+#define BRANCH_UNLESS(cond) do { Value b = pop(); Value a = pop(); if (!(cond)) pc = ops + OPERAND; NEXT(); } while (0)
+#define BINARY(expr) do { Value b = pop(); Value a = pop(); push(expr); NEXT(); } while (0)
+
+    NEXT();
+
+do_load_const:
+    push(CONSTANT);
+    NEXT();
+do_push:
+    push(VAL_NIL);
+    NEXT();
+do_pop:
+    pop();
+    NEXT();
+do_load_slot:
+    push(slots[OPERAND]);
+    NEXT();
+do_store_slot:
+    slots[OPERAND] = pop();
+    NEXT();
+do_add: BINARY(VALUE_ADD(a, b));
+do_sub: BINARY(VALUE_SUB(a, b));
+do_mul: BINARY(VALUE_MUL(a, b));
+do_div: BINARY(divide(a, b));
+do_eq: BINARY(make_bool(VALUE_EQ(a, b)));
+do_neq: BINARY(make_bool(!VALUE_EQ(a, b)));
+do_gt: BINARY(make_bool(VALUE_CMP(a, >, b)));
+do_lt: BINARY(make_bool(VALUE_CMP(a, <, b)));
+do_gte: BINARY(make_bool(VALUE_CMP(a, >=, b)));
+do_lte: BINARY(make_bool(VALUE_CMP(a, <=, b)));
+do_print:
+    print_value(pop());
+    output_char('\n');
+    NEXT();
+do_add_slot_const:
+    slots[OPERAND] = VALUE_ADD(slots[OPERAND], CONSTANT);
+    NEXT();
+do_sub_slot_const:
+    slots[OPERAND] = VALUE_SUB(slots[OPERAND], CONSTANT);
+    NEXT();
+do_load_slot_add_const:
+    push(VALUE_ADD(slots[OPERAND], CONSTANT));
+    NEXT();
+do_load_slot_sub_const:
+    push(VALUE_SUB(slots[OPERAND], CONSTANT));
+    NEXT();
+do_load_slot_const:
+    push(slots[OPERAND]);
+    push(CONSTANT);
+    NEXT();
+do_add_local_const:
+    stack[base + OPERAND] = VALUE_ADD(stack[base + OPERAND], CONSTANT);
+    NEXT();
+do_sub_local_const:
+    stack[base + OPERAND] = VALUE_SUB(stack[base + OPERAND], CONSTANT);
+    NEXT();
+do_load_local_add_const:
+    push(VALUE_ADD(stack[base + OPERAND], CONSTANT));
+    NEXT();
+do_load_local_sub_const:
+    push(VALUE_SUB(stack[base + OPERAND], CONSTANT));
+    NEXT();
+do_load_local_const:
+    push(stack[base + OPERAND]);
+    push(CONSTANT);
+    NEXT();
+do_jmp_if_not_eq: BRANCH_UNLESS(VALUE_EQ(a, b));
+do_jmp_if_not_neq: BRANCH_UNLESS(!VALUE_EQ(a, b));
+do_jmp_if_not_gt: BRANCH_UNLESS(VALUE_CMP(a, >, b));
+do_jmp_if_not_lt: BRANCH_UNLESS(VALUE_CMP(a, <, b));
+do_jmp_if_not_gte: BRANCH_UNLESS(VALUE_CMP(a, >=, b));
+do_jmp_if_not_lte: BRANCH_UNLESS(VALUE_CMP(a, <=, b));
+do_jmp:
+    pc = ops + OPERAND;
+    NEXT();
+do_jmp_if_false:
+    if (is_falsey(pop())) pc = ops + OPERAND;
+    NEXT();
+do_load_local:
+    push(stack[base + OPERAND]);
+    NEXT();
+do_store_local:
+    stack[base + OPERAND] = pop();
+    NEXT();
+do_call:
+    base = enter_frame(&chunk->functions[OPERAND2], pc - ops, base);
+    pc = ops + OPERAND;
+    NEXT();
+do_call_builtin:
+    call_builtin(OPERAND, OPERAND2);
+    NEXT();
+do_call_native:
+    unknown_builtin(constants[OPERAND].str_value);
+    NEXT();
+do_array:
+    build_array(OPERAND);
+    NEXT();
+do_index: BINARY(index_array(a, b));
+do_store_index: {
+    Value value = pop();
+    Value index = pop();
+    store_index(pop(), index, value);
+    NEXT();
+}
+do_ret:
+    pc = ops + leave_frame(&base);
+    NEXT();
+do_halt:
+    free(ops);
+    free(op_at);
+    free(byte_at);
+
+#undef NEXT
+#undef OPERAND
+#undef OPERAND2
+#undef CONSTANT
+#undef BINARY
+#undef BRANCH_UNLESS
+}
+#endif
+
+void run_vm(Chunk* chunk) {
+#ifdef PENGUIN_PROFILE
+    profile_begin(chunk);
+#endif
+#ifdef PENGUIN_JIT
+    // Native loops resume the interpreter at a byte offset, which is what
+    // the switch engine runs on
+    if (use_jit) {
+        jit_begin(chunk);
+        run_vm_switch(chunk);
+        jit_end();
+    } else
+#endif
+    {
+#ifdef PENGUIN_THREADED
+        run_vm_threaded(chunk);
+#else
+        run_vm_switch(chunk);
+#endif
+    }
+    flush_output();
+#ifdef PENGUIN_PROFILE
+    profile_end();
+#endif
+}